@@ -1,36 +1,194 @@
 #include "AnimNode_RuntimeAnim.h"
 #include "Animation/AnimCurveUtils.h"
+#include "SpeechSoundGenerator.h"
+#include "RuntimeAnimEvaluationSubsystem.h"
+#include "Components/SkeletalMeshComponent.h"
 
 void FAnimNode_RuntimeAnim::Update_AnyThread(const FAnimationUpdateContext& Context)
 {
     Super::Update_AnyThread(Context);
     GetEvaluateGraphExposedInputs().Execute(Context);
     DeltaTime = Context.GetDeltaTime();
+
+    const int32 LODLevel = Context.AnimInstanceProxy->GetLODLevel();
+    if (OffLODThreshold >= 0 && LODLevel >= OffLODThreshold)
+    {
+        CurrentLOD = ERuntimeAnimLOD::Off;
+    }
+    else if (JawOnlyLODThreshold >= 0 && LODLevel >= JawOnlyLODThreshold)
+    {
+        CurrentLOD = ERuntimeAnimLOD::JawOnly;
+    }
+    else if (MouthOnlyLODThreshold >= 0 && LODLevel >= MouthOnlyLODThreshold)
+    {
+        CurrentLOD = ERuntimeAnimLOD::MouthOnly;
+    }
+    else
+    {
+        CurrentLOD = ERuntimeAnimLOD::Full;
+    }
+
+    if (RuntimeAnimation)
+    {
+        RuntimeAnimation->LastPlayedFrame = GFrameCounter;
+    }
+
+    // Only batch what this node copies out, reduced rate sampling evaluates on its own a few times a second
+    if (RuntimeAnimation && bUseBatchedEvaluation && CurrentLOD != ERuntimeAnimLOD::Off && GetEvaluationRate(CurrentLOD) <= 0.0f)
+    {
+        RuntimeAnimation->LastUsedFrame = GFrameCounter;
+
+        // Several nodes playing the animation get the most detailed LOD any of them needs
+        uint8 RequestLOD = RuntimeAnimation->BatchRequestLOD.load(std::memory_order_relaxed);
+        while (static_cast<uint8>(CurrentLOD) < RequestLOD && !RuntimeAnimation->BatchRequestLOD.compare_exchange_weak(RequestLOD, static_cast<uint8>(CurrentLOD), std::memory_order_relaxed))
+        {
+        }
+        RuntimeAnimation->bBatchRequestSyncToAudioClock.store(bSyncToAudioClock, std::memory_order_relaxed);
+        RuntimeAnimation->BatchRequestLatencyCompensation.store(AudioLatencyCompensation, std::memory_order_relaxed);
+
+        if (!RuntimeAnimation->bInEvaluationBatch)
+        {
+            const USkeletalMeshComponent* Component = Context.AnimInstanceProxy->GetSkelMeshComponent();
+            const UWorld* World = Component ? Component->GetWorld() : nullptr;
+            if (URuntimeAnimEvaluationSubsystem* Subsystem = World ? World->GetSubsystem<URuntimeAnimEvaluationSubsystem>() : nullptr)
+            {
+                Subsystem->Register(RuntimeAnimation);
+            }
+        }
+    }
+}
+
+void FAnimNode_RuntimeAnim::EvaluateCurves(const TArray<int32>* CurveIndices, float Time, TArray<float>& OutValues) const
+{
+    const int32 NumValues = CurveIndices ? CurveIndices->Num() : RuntimeAnimation->GetNumCurves();
+    OutValues.SetNumUninitialized(NumValues);
+    for (int32 ValueIndex = 0; ValueIndex < NumValues; ++ValueIndex)
+    {
+        const int32 CurveIndex = CurveIndices ? (*CurveIndices)[ValueIndex] : ValueIndex;
+        OutValues[ValueIndex] = RuntimeAnimation->EvaluateCurve(CurveIndex, Time);
+    }
+}
+
+float FAnimNode_RuntimeAnim::GetEvaluationRate(ERuntimeAnimLOD LOD) const
+{
+    switch (LOD)
+    {
+    case ERuntimeAnimLOD::MouthOnly:
+        return MouthOnlyEvaluationRate;
+    case ERuntimeAnimLOD::JawOnly:
+        return JawOnlyEvaluationRate;
+    default:
+        return FullEvaluationRate;
+    }
 }
 
 void FAnimNode_RuntimeAnim::Evaluate_AnyThread(FPoseContext& Output)
+{
+    EvaluateRuntimeCurves(Output.Curve);
+}
+
+void FAnimNode_RuntimeAnim::EvaluateRuntimeCurves(FBlendedCurve& OutCurve)
 {
     if (RuntimeAnimation)
     {
+        // Without a playback time from the clock, e.g. while its sound is not playing, the animation advances by DeltaTime
+        double AudioTime = 0.0;
+        const bool bUseAudioClock = bSyncToAudioClock && RuntimeAnimation->AudioClock.IsValid() && RuntimeAnimation->AudioClock->GetPlaybackTime(AudioTime);
+        const float EvaluationRate = GetEvaluationRate(CurrentLOD);
+
+        // Values the subsystem evaluated this frame with the same settings are copied out instead of evaluated again,
+        // at the time the batch was evaluated at so every value comes from the same point in the animation
+        const bool bUseBatchedValues = bUseBatchedEvaluation && EvaluationRate <= 0.0f && CurrentLOD != ERuntimeAnimLOD::Off
+            && RuntimeAnimation->BatchedTime >= 0.0f && RuntimeAnimation->BatchedLOD <= static_cast<uint8>(CurrentLOD)
+            && RuntimeAnimation->bBatchedSyncToAudioClock == bUseAudioClock
+            && (!bUseAudioClock || RuntimeAnimation->BatchedLatencyCompensation == AudioLatencyCompensation)
+            && RuntimeAnimation->BatchedValues.Num() == RuntimeAnimation->GetNumCurves();
+        if (bUseBatchedValues)
+        {
+            RuntimeAnimation->CurTime = RuntimeAnimation->BatchedTime;
+        }
+        else if (bUseAudioClock)
+        {
+            RuntimeAnimation->CurTime = FMath::Max(0.0, AudioTime - AudioLatencyCompensation - RuntimeAnimation->AudioStartTime);
+        }
+
         float CurTime = RuntimeAnimation->CurTime;
         if (CurTime >= RuntimeAnimation->Duration)
         {
             return;
         }
-        TMap<FName, float> CurveMap;
-        CurveMap.Reserve(RuntimeAnimation->FloatCurves.Num());
-        for (const FFloatCurve& FloatCurve : RuntimeAnimation->FloatCurves)
+
+        const TArray<int32>* CurveIndices = nullptr;
+        switch (CurrentLOD)
+        {
+        case ERuntimeAnimLOD::MouthOnly:
+            CurveIndices = &RuntimeAnimation->MouthCurveIndices;
+            break;
+        case ERuntimeAnimLOD::JawOnly:
+            CurveIndices = &RuntimeAnimation->JawCurveIndices;
+            break;
+        default:
+            break;
+        }
+
+        if (CurrentLOD != ERuntimeAnimLOD::Off)
         {
-            CurveMap.FindOrAdd(FloatCurve.GetName()) = FloatCurve.Evaluate(CurTime);
+            float Alpha = 0.0f;
+            if (EvaluationRate > 0.0f)
+            {
+                // Sample at a reduced rate and interpolate, each sample period only evaluates one new set of values
+                const int64 SampleIndex = FMath::FloorToInt64(CurTime * EvaluationRate);
+                const bool bCacheValid = CachedAnimation == RuntimeAnimation && CachedLOD == CurrentLOD && CachedSampleIndex != INDEX_NONE;
+                if (bCacheValid && SampleIndex == CachedSampleIndex + 1)
+                {
+                    Swap(PrevSampleValues, NextSampleValues);
+                    EvaluateCurves(CurveIndices, (SampleIndex + 1) / EvaluationRate, NextSampleValues);
+                }
+                else if (!bCacheValid || SampleIndex != CachedSampleIndex)
+                {
+                    EvaluateCurves(CurveIndices, SampleIndex / EvaluationRate, PrevSampleValues);
+                    EvaluateCurves(CurveIndices, (SampleIndex + 1) / EvaluationRate, NextSampleValues);
+                }
+                CachedAnimation = RuntimeAnimation;
+                CachedLOD = CurrentLOD;
+                CachedSampleIndex = SampleIndex;
+
+                Alpha = CurTime * EvaluationRate - SampleIndex;
+            }
+
+            TMap<FName, float> CurveMap;
+            const int32 NumValues = CurveIndices ? CurveIndices->Num() : RuntimeAnimation->GetNumCurves();
+            CurveMap.Reserve(NumValues);
+            for (int32 ValueIndex = 0; ValueIndex < NumValues; ++ValueIndex)
+            {
+                const int32 CurveIndex = CurveIndices ? (*CurveIndices)[ValueIndex] : ValueIndex;
+                float Value;
+                if (EvaluationRate > 0.0f)
+                {
+                    Value = FMath::Lerp(PrevSampleValues[ValueIndex], NextSampleValues[ValueIndex], Alpha);
+                }
+                else if (bUseBatchedValues)
+                {
+                    Value = RuntimeAnimation->BatchedValues[CurveIndex];
+                }
+                else
+                {
+                    Value = RuntimeAnimation->EvaluateCurve(CurveIndex, CurTime);
+                }
+                CurveMap.FindOrAdd(RuntimeAnimation->GetCurveName(CurveIndex)) = Value;
+            }
+            FBlendedCurve Curve;
+            UE::Anim::FCurveUtils::BuildUnsorted(Curve, CurveMap);
+            OutCurve.Combine(Curve);
         }
-        FBlendedCurve Curve;
-        UE::Anim::FCurveUtils::BuildUnsorted(Curve, CurveMap);
-        Output.Curve.Combine(Curve);
         // UE_LOG(LogTemp, Warning, TEXT("FAnimNode_RuntimeAnim::Evaluate_AnyThread %f / %f"), RuntimeAnimation->CurTime, RuntimeAnimation->Duration);
-        RuntimeAnimation->CurTime += DeltaTime;
+        if (!bUseAudioClock)
+        {
+            RuntimeAnimation->CurTime += DeltaTime;
+        }
         // if (RuntimeAnimation->CurTime >= RuntimeAnimation->Duration)
         // {
         //     UE_LOG(LogTemp, Warning, TEXT("FAnimNode_RuntimeAnim finish speech animation"));
         // }
     }
-}
\ No newline at end of file
+}
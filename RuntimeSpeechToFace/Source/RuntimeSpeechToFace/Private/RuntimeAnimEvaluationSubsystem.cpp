@@ -0,0 +1,137 @@
+#include "RuntimeAnimEvaluationSubsystem.h"
+#include "AnimNode_RuntimeAnim.h"
+#include "Async/ParallelFor.h"
+#include "Engine/World.h"
+#include "RuntimeAnimation.h"
+#include "RuntimeSpeechToFaceSettings.h"
+#include "SpeechSoundGenerator.h"
+
+// Animations evaluated per task, small enough to spread a crowd across workers
+static constexpr int32 AnimationsPerBatch = 8;
+
+// Frames an animation stays in the batch after its last anim node stopped playing it
+static constexpr uint64 UnusedFramesBeforeRemoval = 2;
+
+bool URuntimeAnimEvaluationSubsystem::ShouldCreateSubsystem(UObject* Outer) const
+{
+    if (!GetDefault<URuntimeSpeechToFaceSettings>()->bBatchCurveEvaluation)
+    {
+        return false;
+    }
+    const UWorld* World = Cast<UWorld>(Outer);
+    return World && World->IsGameWorld();
+}
+
+void URuntimeAnimEvaluationSubsystem::Initialize(FSubsystemCollectionBase& Collection)
+{
+    Super::Initialize(Collection);
+    PreActorTickHandle = FWorldDelegates::OnWorldPreActorTick.AddUObject(this, &URuntimeAnimEvaluationSubsystem::OnWorldPreActorTick);
+}
+
+void URuntimeAnimEvaluationSubsystem::Deinitialize()
+{
+    FWorldDelegates::OnWorldPreActorTick.Remove(PreActorTickHandle);
+    for (const TWeakObjectPtr<URuntimeAnimation>& Animation : Animations)
+    {
+        if (Animation.IsValid())
+        {
+            Animation->bInEvaluationBatch = false;
+            Animation->BatchedTime = -1.0f;
+        }
+    }
+    Animations.Empty();
+    Super::Deinitialize();
+}
+
+void URuntimeAnimEvaluationSubsystem::Register(URuntimeAnimation* Animation)
+{
+    if (!Animation->bInEvaluationBatch.exchange(true))
+    {
+        FScopeLock Lock(&PendingLock);
+        PendingAnimations.Add(Animation);
+    }
+}
+
+void URuntimeAnimEvaluationSubsystem::OnWorldPreActorTick(UWorld* InWorld, ELevelTick TickType, float DeltaSeconds)
+{
+    if (InWorld != GetWorld())
+    {
+        return;
+    }
+
+    {
+        FScopeLock Lock(&PendingLock);
+        Animations.Append(PendingAnimations);
+        PendingAnimations.Reset();
+    }
+
+    // Drop animations that are gone or that no anim node played recently
+    for (int32 AnimationIndex = Animations.Num() - 1; AnimationIndex >= 0; --AnimationIndex)
+    {
+        URuntimeAnimation* Animation = Animations[AnimationIndex].Get();
+        if (!Animation || Animation->LastUsedFrame + UnusedFramesBeforeRemoval < GFrameCounter)
+        {
+            if (Animation)
+            {
+                Animation->bInEvaluationBatch = false;
+                Animation->BatchedTime = -1.0f;
+            }
+            Animations.RemoveAtSwap(AnimationIndex, 1, EAllowShrinking::No);
+        }
+    }
+
+    ParallelFor(TEXT("RuntimeAnimEvaluation"), Animations.Num(), AnimationsPerBatch, [this](int32 AnimationIndex)
+        {
+            URuntimeAnimation* Animation = Animations[AnimationIndex].Get();
+
+            // Evaluated the way the anim nodes asked for during their last update, they ignore values evaluated any other way
+            const uint8 LOD = Animation->BatchRequestLOD.exchange(MAX_uint8, std::memory_order_relaxed);
+            const float LatencyCompensation = Animation->BatchRequestLatencyCompensation.load(std::memory_order_relaxed);
+            if (LOD >= static_cast<uint8>(ERuntimeAnimLOD::Off))
+            {
+                Animation->BatchedTime = -1.0f;
+                return;
+            }
+
+            // Like the anim nodes, fall back to the advanced time until the clock has a playback time
+            double Time = Animation->CurTime;
+            double AudioTime = 0.0;
+            const bool bSyncToAudioClock = Animation->bBatchRequestSyncToAudioClock.load(std::memory_order_relaxed) && Animation->AudioClock.IsValid()
+                && Animation->AudioClock->GetPlaybackTime(AudioTime);
+            if (bSyncToAudioClock)
+            {
+                Time = FMath::Max(0.0, AudioTime - LatencyCompensation - Animation->AudioStartTime);
+            }
+            if (Time >= Animation->Duration)
+            {
+                Animation->BatchedTime = -1.0f;
+                return;
+            }
+
+            Animation->BatchedValues.SetNumUninitialized(Animation->GetNumCurves(), EAllowShrinking::No);
+            const TArray<int32>* CurveIndices = nullptr;
+            if (LOD == static_cast<uint8>(ERuntimeAnimLOD::MouthOnly))
+            {
+                CurveIndices = &Animation->MouthCurveIndices;
+            }
+            else if (LOD == static_cast<uint8>(ERuntimeAnimLOD::JawOnly))
+            {
+                CurveIndices = &Animation->JawCurveIndices;
+            }
+            if (CurveIndices)
+            {
+                for (const int32 CurveIndex : *CurveIndices)
+                {
+                    Animation->BatchedValues[CurveIndex] = Animation->EvaluateCurve(CurveIndex, Time);
+                }
+            }
+            else
+            {
+                Animation->EvaluateAllCurves(Time, Animation->BatchedValues);
+            }
+            Animation->BatchedTime = Time;
+            Animation->BatchedLOD = LOD;
+            Animation->bBatchedSyncToAudioClock = bSyncToAudioClock;
+            Animation->BatchedLatencyCompensation = LatencyCompensation;
+        });
+}
@@ -1 +1,439 @@
 #include "RuntimeAnimation.h"
+#include "SpeechSoundWave.h"
+#include "SpeechSoundGenerator.h"
+#include "DataDefs.h"
+#include "Algo/BinarySearch.h"
+#include "HAL/FileManager.h"
+#include "Misc/FileHelper.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
+#include "RuntimeSpeechToFace.h"
+#include "RuntimeSpeechToFaceMemorySubsystem.h"
+
+static constexpr uint32 BakedAnimationMagic = 0x41463253; // "S2FA"
+static constexpr uint32 BakedAnimationVersion = 1;
+
+void URuntimeAnimation::SetAudioClock(USpeechSoundWave* SoundWave)
+{
+    AudioClock = SoundWave ? SoundWave->GetPlaybackState() : nullptr;
+}
+
+static float GetQuantizedSample(const FRuntimeAnimTrack& Track, int32 SampleIndex)
+{
+    if (Track.Format == ERuntimeAnimTrackFormat::Quantized8)
+    {
+        return Track.RangeMin + Track.RangeExtent * (Track.QuantizedData[SampleIndex] / 255.0f);
+    }
+    uint16 Value;
+    FMemory::Memcpy(&Value, &Track.QuantizedData[SampleIndex * sizeof(uint16)], sizeof(uint16));
+    return Track.RangeMin + Track.RangeExtent * (Value / 65535.0f);
+}
+
+float FRuntimeAnimTrack::Evaluate(float Time) const
+{
+    switch (Format)
+    {
+    case ERuntimeAnimTrackFormat::Keys:
+    {
+        if (Time <= KeyTimes[0])
+        {
+            return KeyValues[0];
+        }
+        if (Time >= KeyTimes.Last())
+        {
+            return KeyValues.Last();
+        }
+        const int32 NextIndex = Algo::UpperBound(KeyTimes, Time);
+        const int32 PrevIndex = NextIndex - 1;
+        const float Alpha = (Time - KeyTimes[PrevIndex]) / (KeyTimes[NextIndex] - KeyTimes[PrevIndex]);
+        return FMath::Lerp(KeyValues[PrevIndex], KeyValues[NextIndex], Alpha);
+    }
+    case ERuntimeAnimTrackFormat::Quantized8:
+    case ERuntimeAnimTrackFormat::Quantized16:
+    {
+        const int32 NumSamples = Format == ERuntimeAnimTrackFormat::Quantized8 ? QuantizedData.Num() : QuantizedData.Num() / sizeof(uint16);
+        const float SamplePosition = FMath::Clamp(Time * SampleRate, 0.0f, static_cast<float>(NumSamples - 1));
+        const int32 PrevIndex = FMath::FloorToInt32(SamplePosition);
+        const int32 NextIndex = FMath::Min(PrevIndex + 1, NumSamples - 1);
+        return FMath::Lerp(GetQuantizedSample(*this, PrevIndex), GetQuantizedSample(*this, NextIndex), SamplePosition - PrevIndex);
+    }
+    default:
+        return RangeMin;
+    }
+}
+
+void URuntimeAnimation::EvaluateAllCurves(float Time, TArrayView<float> OutValues) const
+{
+    check(OutValues.Num() == GetNumCurves());
+    if (!IsCompressed())
+    {
+        for (int32 CurveIndex = 0; CurveIndex < FloatCurves.Num(); ++CurveIndex)
+        {
+            OutValues[CurveIndex] = FloatCurves[CurveIndex].Evaluate(Time);
+        }
+        return;
+    }
+
+    // Quantized tracks of one animation share their sample rate and length, so the sample position is computed once
+    float CachedSampleRate = -1.0f;
+    int32 CachedNumSamples = INDEX_NONE;
+    int32 PrevIndex = 0;
+    int32 NextIndex = 0;
+    float Alpha = 0.0f;
+    for (int32 TrackIndex = 0; TrackIndex < CompressedTracks.Num(); ++TrackIndex)
+    {
+        const FRuntimeAnimTrack& Track = CompressedTracks[TrackIndex];
+        switch (Track.Format)
+        {
+        case ERuntimeAnimTrackFormat::Constant:
+            OutValues[TrackIndex] = Track.RangeMin;
+            break;
+        case ERuntimeAnimTrackFormat::Quantized8:
+        case ERuntimeAnimTrackFormat::Quantized16:
+        {
+            const int32 NumSamples = Track.Format == ERuntimeAnimTrackFormat::Quantized8 ? Track.QuantizedData.Num() : Track.QuantizedData.Num() / sizeof(uint16);
+            if (Track.SampleRate != CachedSampleRate || NumSamples != CachedNumSamples)
+            {
+                CachedSampleRate = Track.SampleRate;
+                CachedNumSamples = NumSamples;
+                const float SamplePosition = FMath::Clamp(Time * Track.SampleRate, 0.0f, static_cast<float>(NumSamples - 1));
+                PrevIndex = FMath::FloorToInt32(SamplePosition);
+                NextIndex = FMath::Min(PrevIndex + 1, NumSamples - 1);
+                Alpha = SamplePosition - PrevIndex;
+            }
+            OutValues[TrackIndex] = FMath::Lerp(GetQuantizedSample(Track, PrevIndex), GetQuantizedSample(Track, NextIndex), Alpha);
+            break;
+        }
+        default:
+            OutValues[TrackIndex] = Track.Evaluate(Time);
+            break;
+        }
+    }
+}
+
+SIZE_T FRuntimeAnimTrack::GetAllocatedSize() const
+{
+    return KeyTimes.GetAllocatedSize() + KeyValues.GetAllocatedSize() + QuantizedData.GetAllocatedSize();
+}
+
+void FRuntimeAnimTrack::Serialize(FArchive& Ar)
+{
+    // Names are stored as strings so plain memory and file archives can be used
+    FString NameString = CurveName.ToString();
+    Ar << NameString;
+    uint8 FormatValue = static_cast<uint8>(Format);
+    Ar << FormatValue;
+    if (Ar.IsLoading())
+    {
+        CurveName = FName(*NameString);
+        Format = static_cast<ERuntimeAnimTrackFormat>(FormatValue);
+    }
+    Ar << RangeMin << RangeExtent << SampleRate;
+    Ar << KeyTimes << KeyValues << QuantizedData;
+}
+
+static void CompressCurve(const FFloatCurve& Curve, const FRuntimeAnimCompressionSettings& Settings, FRuntimeAnimTrack& OutTrack)
+{
+    const TArray<FRichCurveKey>& Keys = Curve.FloatCurve.GetConstRefOfKeys();
+    OutTrack.CurveName = Curve.GetName();
+
+    if (Keys.Num() == 0)
+    {
+        OutTrack.Format = ERuntimeAnimTrackFormat::Constant;
+        OutTrack.RangeMin = Curve.FloatCurve.Eval(0.0f);
+        return;
+    }
+
+    float MinValue = Keys[0].Value;
+    float MaxValue = Keys[0].Value;
+    for (const FRichCurveKey& Key : Keys)
+    {
+        MinValue = FMath::Min(MinValue, Key.Value);
+        MaxValue = FMath::Max(MaxValue, Key.Value);
+    }
+
+    if (MaxValue - MinValue <= Settings.Tolerance)
+    {
+        OutTrack.Format = ERuntimeAnimTrackFormat::Constant;
+        OutTrack.RangeMin = (MinValue + MaxValue) * 0.5f;
+        return;
+    }
+
+    // Greedily extend each linear segment until one of the keys it skips would be off by more than the tolerance
+    TArray<int32> KeptKeys = { 0 };
+    int32 AnchorIndex = 0;
+    for (int32 EndIndex = 2; EndIndex < Keys.Num(); ++EndIndex)
+    {
+        const FRichCurveKey& Anchor = Keys[AnchorIndex];
+        const FRichCurveKey& End = Keys[EndIndex];
+        for (int32 KeyIndex = AnchorIndex + 1; KeyIndex < EndIndex; ++KeyIndex)
+        {
+            const float Alpha = (Keys[KeyIndex].Time - Anchor.Time) / (End.Time - Anchor.Time);
+            if (FMath::Abs(FMath::Lerp(Anchor.Value, End.Value, Alpha) - Keys[KeyIndex].Value) > Settings.Tolerance)
+            {
+                AnchorIndex = EndIndex - 1;
+                KeptKeys.Add(AnchorIndex);
+                break;
+            }
+        }
+    }
+    if (KeptKeys.Last() != Keys.Num() - 1)
+    {
+        KeptKeys.Add(Keys.Num() - 1);
+    }
+
+    // Quantized samples need the keys to be uniformly spaced from time 0, which is how generated curves are built
+    bool bCanQuantize = Settings.bAllowQuantization && Keys.Num() > 1 && FMath::IsNearlyZero(Keys[0].Time);
+    const float SampleInterval = bCanQuantize ? Keys[1].Time - Keys[0].Time : 0.0f;
+    for (int32 KeyIndex = 1; bCanQuantize && KeyIndex < Keys.Num(); ++KeyIndex)
+    {
+        bCanQuantize = FMath::IsNearlyEqual(Keys[KeyIndex].Time, KeyIndex * SampleInterval, SampleInterval * 0.01f);
+    }
+
+    const float Range = MaxValue - MinValue;
+    const bool bFitsIn8Bits = Range / 255.0f * 0.5f <= Settings.Tolerance;
+    const bool bFitsIn16Bits = Range / 65535.0f * 0.5f <= Settings.Tolerance;
+    bCanQuantize = bCanQuantize && bFitsIn16Bits;
+
+    const int32 KeyBytes = KeptKeys.Num() * 2 * sizeof(float);
+    const int32 QuantizedBytes = Keys.Num() * (bFitsIn8Bits ? sizeof(uint8) : sizeof(uint16));
+
+    if (bCanQuantize && QuantizedBytes < KeyBytes)
+    {
+        OutTrack.Format = bFitsIn8Bits ? ERuntimeAnimTrackFormat::Quantized8 : ERuntimeAnimTrackFormat::Quantized16;
+        OutTrack.RangeMin = MinValue;
+        OutTrack.RangeExtent = Range;
+        OutTrack.SampleRate = 1.0f / SampleInterval;
+        OutTrack.QuantizedData.SetNumUninitialized(QuantizedBytes);
+        for (int32 KeyIndex = 0; KeyIndex < Keys.Num(); ++KeyIndex)
+        {
+            const float Normalized = (Keys[KeyIndex].Value - MinValue) / Range;
+            if (bFitsIn8Bits)
+            {
+                OutTrack.QuantizedData[KeyIndex] = static_cast<uint8>(FMath::RoundToInt32(Normalized * 255.0f));
+            }
+            else
+            {
+                const uint16 Value = static_cast<uint16>(FMath::RoundToInt32(Normalized * 65535.0f));
+                FMemory::Memcpy(&OutTrack.QuantizedData[KeyIndex * sizeof(uint16)], &Value, sizeof(uint16));
+            }
+        }
+        return;
+    }
+
+    OutTrack.Format = ERuntimeAnimTrackFormat::Keys;
+    OutTrack.KeyTimes.Reserve(KeptKeys.Num());
+    OutTrack.KeyValues.Reserve(KeptKeys.Num());
+    for (int32 KeyIndex : KeptKeys)
+    {
+        OutTrack.KeyTimes.Add(Keys[KeyIndex].Time);
+        OutTrack.KeyValues.Add(Keys[KeyIndex].Value);
+    }
+}
+
+void URuntimeAnimation::CompressCurves(TConstArrayView<FFloatCurve> Curves, const FRuntimeAnimCompressionSettings& Settings, TArray<FRuntimeAnimTrack>& OutTracks)
+{
+    OutTracks.Reset();
+    OutTracks.SetNum(Curves.Num());
+    for (int32 CurveIndex = 0; CurveIndex < Curves.Num(); ++CurveIndex)
+    {
+        CompressCurve(Curves[CurveIndex], Settings, OutTracks[CurveIndex]);
+    }
+}
+
+bool URuntimeAnimation::Compress(const FRuntimeAnimCompressionSettings& Settings)
+{
+    check(IsInGameThread());
+    if (FloatCurves.Num() == 0)
+    {
+        return IsCompressed();
+    }
+
+    // Anim worker threads and the evaluation subsystem read FloatCurves without locking
+    const uint64 PlayedFrame = LastPlayedFrame;
+    if (bInEvaluationBatch || (PlayedFrame != 0 && PlayedFrame + 2 >= GFrameCounter))
+    {
+        UE_LOG(LogRuntimeSpeechToFace, Warning, TEXT("%s: not compressing an animation that is playing"), *GetName());
+        return false;
+    }
+
+    // Built aside so IsCompressed only turns true once the tracks are complete
+    TArray<FRuntimeAnimTrack> Tracks;
+    CompressCurves(FloatCurves, Settings, Tracks);
+    CompressedTracks = MoveTemp(Tracks);
+    FloatCurves.Empty();
+    return true;
+}
+
+static void SerializeBakedHeader(FArchive& Ar, uint32& Magic, uint32& Version, FString& SourceHash)
+{
+    Ar << Magic << Version << SourceHash;
+}
+
+bool URuntimeAnimation::SaveBakedAnimation(const FString& FilePath, const FString& SourceHash, float InDuration, TArray<FRuntimeAnimTrack>& Tracks)
+{
+    TArray<uint8> FileData;
+    FMemoryWriter Writer(FileData);
+
+    uint32 Magic = BakedAnimationMagic;
+    uint32 Version = BakedAnimationVersion;
+    FString Hash = SourceHash;
+    SerializeBakedHeader(Writer, Magic, Version, Hash);
+
+    int32 NumTracks = Tracks.Num();
+    Writer << InDuration << NumTracks;
+    for (FRuntimeAnimTrack& Track : Tracks)
+    {
+        Track.Serialize(Writer);
+    }
+
+    return FFileHelper::SaveArrayToFile(FileData, *FilePath);
+}
+
+bool URuntimeAnimation::ReadBakedAnimationHash(const FString& FilePath, FString& OutSourceHash)
+{
+    TUniquePtr<FArchive> Reader(IFileManager::Get().CreateFileReader(*FilePath));
+    if (!Reader)
+    {
+        return false;
+    }
+
+    uint32 Magic = 0;
+    uint32 Version = 0;
+    SerializeBakedHeader(*Reader, Magic, Version, OutSourceHash);
+    return !Reader->IsError() && Magic == BakedAnimationMagic && Version == BakedAnimationVersion;
+}
+
+// Evaluate indexes the track data without bounds checks, so tracks read from a file are checked before use
+static bool IsValidTrack(const FRuntimeAnimTrack& Track)
+{
+    if (!FMath::IsFinite(Track.RangeMin) || !FMath::IsFinite(Track.RangeExtent))
+    {
+        return false;
+    }
+
+    switch (Track.Format)
+    {
+    case ERuntimeAnimTrackFormat::Constant:
+        return true;
+    case ERuntimeAnimTrackFormat::Keys:
+        if (Track.KeyTimes.Num() == 0 || Track.KeyTimes.Num() != Track.KeyValues.Num())
+        {
+            return false;
+        }
+        for (int32 KeyIndex = 1; KeyIndex < Track.KeyTimes.Num(); ++KeyIndex)
+        {
+            if (!(Track.KeyTimes[KeyIndex] > Track.KeyTimes[KeyIndex - 1]))
+            {
+                return false;
+            }
+        }
+        return true;
+    case ERuntimeAnimTrackFormat::Quantized8:
+        return Track.QuantizedData.Num() > 0 && FMath::IsFinite(Track.SampleRate) && Track.SampleRate >= 0.0f;
+    case ERuntimeAnimTrackFormat::Quantized16:
+        return Track.QuantizedData.Num() > 0 && Track.QuantizedData.Num() % sizeof(uint16) == 0 && FMath::IsFinite(Track.SampleRate) && Track.SampleRate >= 0.0f;
+    default:
+        return false;
+    }
+}
+
+URuntimeAnimation* URuntimeAnimation::LoadBakedAnimation(const FString& FilePath)
+{
+    TArray<uint8> FileData;
+    if (!FFileHelper::LoadFileToArray(FileData, *FilePath))
+    {
+        UE_LOG(LogRuntimeSpeechToFace, Error, TEXT("Failed to load baked animation at path: %s"), *FilePath);
+        return nullptr;
+    }
+
+    FMemoryReader Reader(FileData);
+    uint32 Magic = 0;
+    uint32 Version = 0;
+    FString SourceHash;
+    SerializeBakedHeader(Reader, Magic, Version, SourceHash);
+    if (Magic != BakedAnimationMagic || Version != BakedAnimationVersion)
+    {
+        UE_LOG(LogRuntimeSpeechToFace, Error, TEXT("Baked animation has an unsupported format: %s"), *FilePath);
+        return nullptr;
+    }
+
+    URuntimeAnimation* Animation = NewObject<URuntimeAnimation>();
+    int32 NumTracks = 0;
+    Reader << Animation->Duration << NumTracks;
+
+    // Every track takes at least a few bytes, so a count larger than the file is corrupt rather than worth allocating for
+    if (Reader.IsError() || !FMath::IsFinite(Animation->Duration) || NumTracks < 0 || NumTracks > Reader.TotalSize() - Reader.Tell())
+    {
+        UE_LOG(LogRuntimeSpeechToFace, Error, TEXT("Baked animation is corrupt: %s"), *FilePath);
+        return nullptr;
+    }
+
+    Animation->CompressedTracks.SetNum(NumTracks);
+    bool bTracksValid = true;
+    for (FRuntimeAnimTrack& Track : Animation->CompressedTracks)
+    {
+        Track.Serialize(Reader);
+        bTracksValid = bTracksValid && !Reader.IsError() && IsValidTrack(Track);
+    }
+    if (Reader.IsError() || !bTracksValid)
+    {
+        UE_LOG(LogRuntimeSpeechToFace, Error, TEXT("Baked animation is corrupt: %s"), *FilePath);
+        return nullptr;
+    }
+
+    Animation->BuildLODCurveSets();
+    URuntimeSpeechToFaceMemorySubsystem::Track(Animation);
+    return Animation;
+}
+
+SIZE_T URuntimeAnimation::GetCurveMemorySize() const
+{
+    SIZE_T Size = FloatCurves.GetAllocatedSize() + CompressedTracks.GetAllocatedSize();
+    for (const FFloatCurve& Curve : FloatCurves)
+    {
+        Size += Curve.FloatCurve.Keys.GetAllocatedSize();
+    }
+    for (const FRuntimeAnimTrack& Track : CompressedTracks)
+    {
+        Size += Track.GetAllocatedSize();
+    }
+    return Size + MouthCurveIndices.GetAllocatedSize() + JawCurveIndices.GetAllocatedSize() + BatchedValues.GetAllocatedSize();
+}
+
+void URuntimeAnimation::GetResourceSizeEx(FResourceSizeEx& CumulativeResourceSize)
+{
+    Super::GetResourceSizeEx(CumulativeResourceSize);
+    CumulativeResourceSize.AddDedicatedSystemMemoryBytes(GetCurveMemorySize());
+}
+
+void URuntimeAnimation::ReleaseCurves()
+{
+    // Anim nodes stop at the duration before touching any curve
+    Duration = 0.0f;
+    BatchedTime = -1.0f;
+    FloatCurves.Empty();
+    CompressedTracks.Empty();
+    MouthCurveIndices.Empty();
+    JawCurveIndices.Empty();
+    BatchedValues.Empty();
+}
+
+void URuntimeAnimation::BuildLODCurveSets()
+{
+    MouthCurveIndices.Reset();
+    JawCurveIndices.Reset();
+
+    for (int32 CurveIndex = 0; CurveIndex < GetNumCurves(); ++CurveIndex)
+    {
+        const FString CurveName = GetCurveName(CurveIndex).ToString();
+        if (UE::MetaHuman::MouthOnlyRawControls.Contains(CurveName))
+        {
+            MouthCurveIndices.Add(CurveIndex);
+            if (CurveName.StartsWith(TEXT("CTRL_expressions_jaw")))
+            {
+                JawCurveIndices.Add(CurveIndex);
+            }
+        }
+    }
+}
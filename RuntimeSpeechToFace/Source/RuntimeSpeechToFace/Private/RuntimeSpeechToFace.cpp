@@ -1,6 +1,10 @@
 // Copyright Epic Games, Inc. All Rights Reserved.
 
 #include "RuntimeSpeechToFace.h"
+#include "Misc/CoreDelegates.h"
+#include "RuntimeSpeechToFaceAsyncTask.h"
+#include "RuntimeSpeechToFaceSettings.h"
+#include "SpeechToFacePipeline.h"
 
 #define LOCTEXT_NAMESPACE "FRuntimeSpeechToFaceModule"
 
@@ -8,10 +12,25 @@ DEFINE_LOG_CATEGORY(LogRuntimeSpeechToFace);
 
 void FRuntimeSpeechToFaceModule::StartupModule()
 {	
+	FCoreDelegates::OnPostEngineInit.AddRaw(this, &FRuntimeSpeechToFaceModule::PrewarmModels);
 }
 
 void FRuntimeSpeechToFaceModule::ShutdownModule()
 {
+	FCoreDelegates::OnPostEngineInit.RemoveAll(this);
+	SpeechToFacePipeline::ShutdownInferenceThreadPool();
+}
+
+void FRuntimeSpeechToFaceModule::PrewarmModels()
+{
+	if (IsRunningCommandlet())
+	{
+		return;
+	}
+	for (const FName QualityTier : GetDefault<URuntimeSpeechToFaceSettings>()->PrewarmQualityTiers)
+	{
+		URuntimeSpeechToFaceAsync::PrewarmModels(QualityTier);
+	}
 }
 
 #undef LOCTEXT_NAMESPACE
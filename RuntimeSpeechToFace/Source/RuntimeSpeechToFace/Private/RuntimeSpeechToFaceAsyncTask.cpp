@@ -2,566 +2,417 @@
 
 #include "RuntimeSpeechToFaceAsyncTask.h"
 #include "RuntimeSpeechToFace.h"
-#include "Animation/BuiltInAttributeTypes.h"
-#include "AudioDecompress.h"
-#include "Interfaces/IAudioFormat.h"
-#include "NNEModelData.h"
-#include "NNE.h"
-#include "AudioResampler.h"
-#include "SampleBuffer.h"
-#include "DataDefs.h"
-#include "GuiToRawControlsUtils.h"
+#include "RuntimeSpeechToFaceMemorySubsystem.h"
 #include "RuntimeSpeechToFaceSettings.h"
 #include "SpeechSoundWave.h"
+#include "SpeechSoundGenerator.h"
+#include "Tasks/Task.h"
+#include "UObject/StrongObjectPtr.h"
 
-using FloatSamples = Audio::VectorOps::FAlignedFloatBuffer;
-
-using FAnimationFrame = TMap<FString, float>;
-
-static const FName RootBoneName = TEXT("root");
-
-static constexpr uint32 AudioEncoderSampleRateHz = 16000;
-static constexpr float RigLogicPredictorOutputFps = 50.0f;
-static constexpr float RigLogicPredictorMaxAudioSamples = AudioEncoderSampleRateHz * 30;
-static constexpr float RigLogicPredictorFrameDuration = 1.f / RigLogicPredictorOutputFps;
-static constexpr float SamplesPerFrame = AudioEncoderSampleRateHz * RigLogicPredictorFrameDuration;
-static constexpr float AnimationOutputFps = 30.0f;
-
-static constexpr int32 StreamBufferSize = 19200;
-
-TSharedPtr<UE::NNE::IModelInstanceCPU> URuntimeSpeechToFaceAsync::AudioExtractor;
-TSharedPtr<UE::NNE::IModelInstanceCPU> URuntimeSpeechToFaceAsync::RigLogicPredictor;
-
-bool URuntimeSpeechToFaceAsync::bHasProcessingInstance = false;
-
-static TSharedPtr<UE::NNE::IModelInstanceCPU> TryLoadModelData(const FSoftObjectPath& InModelAssetPath)
+/** Models of one quality tier, with a set of instances for each request running inference on them at the same time */
+struct FSpeechToFaceTierModels
 {
-	const FSoftObjectPtr ModelAsset(InModelAssetPath);
-	UNNEModelData* ModelData = Cast<UNNEModelData>(ModelAsset.LoadSynchronous());
+	TSharedPtr<FSpeechToFaceModels> Models;
 
-	if (!IsValid(ModelData))
-	{
-		check(false);
-		UE_LOG(LogTemp, Error, TEXT("Failed to load model, it is invalid (nullptr)"));
-		return nullptr;
-	}
+	FCriticalSection InstancesLock;
+	TArray<FSpeechToFaceModelInstances> FreeInstances;
 
-	if (!FModuleManager::Get().LoadModule(TEXT("NNERuntimeORT")))
+	FSpeechToFaceModelInstances CheckOut()
 	{
-		UE_LOG(LogTemp, Error, TEXT("Failed to load model, could not load NNE Runtime module (NNERuntimeORT): %s"), *ModelData->GetPathName());
-		return nullptr;
-	}
-
-	const TWeakInterfacePtr<INNERuntimeCPU> NNERuntimeCPU = UE::NNE::GetRuntime<INNERuntimeCPU>(TEXT("NNERuntimeORTCpu"));
-
-	if (!NNERuntimeCPU.IsValid())
-	{
-		UE_LOG(LogTemp, Error, TEXT("Failed to load model, could not load NNE Runtime: %s"), *ModelData->GetPathName());
-		return nullptr;
-	}
-
-	TSharedPtr<UE::NNE::IModelCPU> ModelCpu = NNERuntimeCPU->CreateModelCPU(ModelData);
-
-	if (!ModelCpu.IsValid())
-	{
-		UE_LOG(LogTemp, Error, TEXT("Failed to load model, could not create model CPU: %s"), *ModelData->GetPathName());
-		return nullptr;
+		{
+			FScopeLock Lock(&InstancesLock);
+			if (FreeInstances.Num() > 0)
+			{
+				return FreeInstances.Pop(EAllowShrinking::No);
+			}
+		}
+		return Models->CreateInstances();
 	}
 
-	TSharedPtr<UE::NNE::IModelInstanceCPU> ModelInstance = ModelCpu->CreateModelInstanceCPU();
-
-	if (ModelInstance.IsValid())
-	{
-		UE_LOG(LogTemp, Display, TEXT("Loaded model: %s"), *ModelData->GetPathName());
-	}
-	else
+	void CheckIn(FSpeechToFaceModelInstances&& Instances)
 	{
-		UE_LOG(LogTemp, Error, TEXT("Failed to load model, could not create model instance: %s"), *ModelData->GetPathName());
+		FScopeLock Lock(&InstancesLock);
+		FreeInstances.Add(MoveTemp(Instances));
 	}
+};
 
-	return ModelInstance;
-}
-
-URuntimeSpeechToFaceAsync* URuntimeSpeechToFaceAsync::SpeechToFaceAnim(UObject* WorldContextObject, USoundWave* SoundWave, USkeleton* Skeleton, EAudioDrivenAnimationMood Mood, float MoodIntensity, bool bGenerateBlinks, bool bGenerateHeadAnimation)
+/** Animation generated for one channel of a request, or for all of its channels mixed down */
+struct FSpeechToFaceRequestOutput
 {
-	URuntimeSpeechToFaceAsync* Action = NewObject<URuntimeSpeechToFaceAsync>();
-	Action->RegisterWithGameInstance(WorldContextObject);
-	Action->SoundWave = SoundWave;
-	Action->Skeleton = Skeleton;
-	Action->Mood = Mood;
-	Action->MoodIntensity = MoodIntensity;
-	Action->bGenerateBlinks = bGenerateBlinks;
-	Action->bGenerateHeadAnimation = bGenerateHeadAnimation;
-	return Action;
-}
+	int32 Channel = INDEX_NONE;
+	uint64 AudioFeaturesHash = 0;
 
-static bool GetImportedSoundWaveData(USoundWave* SoundWave, TArray<uint8>& OutRawPCMData, uint32& OutSampleRate, uint16& OutNumChannels)
-{
-	if (!SoundWave)
-	{
-		return false;
-	}
-	OutSampleRate = SoundWave->GetSampleRateForCurrentPlatform();
-	OutNumChannels = SoundWave->NumChannels;
+	// Found in the feature cache by the decode stage, or the samples at the encoder rate to extract them from
+	TSharedPtr<const FSpeechAudioFeatures> Features;
+	TArray<float> EncoderSamples;
 
-	USpeechSoundWave* SpeechSoundWave = Cast<USpeechSoundWave>(SoundWave);
-	if (SpeechSoundWave)
-	{
-		OutRawPCMData = SpeechSoundWave->GetPCMData();
-		return true;
-	}
+	FSpeechToFaceAnimationData AnimationData;
+	TArray<FFloatCurve> Curves;
+	TArray<FRuntimeAnimTrack> Tracks;
+};
 
-	int BufferLen = FMath::CeilToInt(sizeof(int16) * OutSampleRate * OutNumChannels * SoundWave->Duration);
-	OutRawPCMData.Reserve(BufferLen);
+/** Inputs and results of one request, shared by its pipeline stages so none of them depends on the async action */
+struct FSpeechToFaceRequest
+{
+	// Released on the game thread by the last stage
+	TStrongObjectPtr<USoundWave> SoundWave;
 
-	if (SoundWave->bProcedural)
-	{
-		OutRawPCMData.Reset(BufferLen);
-		SoundWave->GeneratePCMData(OutRawPCMData.GetData(), BufferLen);
-		return true;
-	}
+	TSharedPtr<FSpeechToFaceTierModels> TierModels;
+	FName QualityTier;
+	FSpeechToFaceParams Params;
+	bool bCompress = false;
+	FRuntimeAnimCompressionSettings CompressionSettings;
 
-	FName RuntimeFormat = SoundWave->GetRuntimeFormat();
-	TArray<uint8> RawPCMData;
+	// Span of the sound wave the animation covers, and where decoding starts to give its first frames context
+	float StartTime = 0.0f;
+	float EndTime = 0.0f;
+	float DecodeStartTime = 0.0f;
 
-	FByteBulkData* BulkData = SoundWave->GetCompressedData(RuntimeFormat);
-	if (!BulkData || BulkData->GetBulkDataSize() <= 0)
-	{
-		return false;
-	}
+	float Duration = 0.0f;
+	TSharedPtr<const FSpeechPlaybackState> AudioClock;
+	uint64 AudioFeaturesHash = 0;
 
-	const void* CompressedData = BulkData->LockReadOnly();
-	int32 CompressedDataSize = BulkData->GetBulkDataSize();
+	// Decoded once and converted to the encoder samples of every output, then released
+	FSpeechAudioData Audio;
+	TArray<FSpeechToFaceRequestOutput> Outputs;
 
-	ICompressedAudioInfo* AudioInfo = IAudioInfoFactoryRegistry::Get().Create(SoundWave->GetRuntimeFormat());
+	// Set by the stage that failed, later stages skip their work
+	FString Error;
+};
 
-	if (!AudioInfo)
-	{
-		BulkData->Unlock();
-		return false;
-	}
+static TMap<FName, TSharedPtr<FSpeechToFaceTierModels>> QualityTierModels;
 
-	FSoundQualityInfo QualityInfo = { 0 };
+// Audio decoded on each side of a requested span, so the models see the speech around its first and last frames
+static constexpr float SpanContextMargin = 0.5f;
 
-	// Get the header information of our compressed format
-	if (!AudioInfo->StreamCompressedInfo(SoundWave, &QualityInfo))
+// Models of the quality tier, loaded on first use. Null if they fail to load.
+static TSharedPtr<FSpeechToFaceTierModels> LoadTierModels(FName QualityTier)
+{
+	TSharedPtr<FSpeechToFaceTierModels>& TierModels = QualityTierModels.FindOrAdd(QualityTier);
+	if (!TierModels)
 	{
-		BulkData->Unlock();
-		return false;
+		TierModels = MakeShared<FSpeechToFaceTierModels>();
 	}
-
-	// Stream read
-	while (OutRawPCMData.Num() < BufferLen)
+	if (!TierModels->Models)
 	{
-		int32 NumBytesStreamed = FMath::Min(StreamBufferSize, BufferLen - OutRawPCMData.Num());
-		int OldSize = OutRawPCMData.Num();
-		OutRawPCMData.AddZeroed(NumBytesStreamed);
-		AudioInfo->StreamCompressedData(OutRawPCMData.GetData() + OldSize, false, NumBytesStreamed, NumBytesStreamed);
+		TierModels->Models = FSpeechToFaceModels::Load(QualityTier);
 	}
-
-	delete AudioInfo;
-	BulkData->Unlock();
-	
-	return true;
+	return TierModels->Models ? TierModels : nullptr;
 }
 
-static bool ResampleAudio(FloatSamples InSamples, int32 InSampleRate, int32 InResampleRate, FloatSamples& OutResampledSamples)
+int32 URuntimeSpeechToFaceAsync::NumActiveRequests = 0;
+double URuntimeSpeechToFaceAsync::AverageLatency = 0.0;
+
+static void DecodeAudio(FSpeechToFaceRequest& Request)
 {
-	const Audio::FResamplingParameters Params = {
-		Audio::EResamplingMethod::Linear,
-		1, // NumChannels
-		static_cast<float>(InSampleRate),
-		static_cast<float>(InResampleRate),
-		InSamples
-	};
-
-	const int32 ExpectedSampleCount = GetOutputBufferSize(Params);
-	OutResampledSamples.SetNumUninitialized(ExpectedSampleCount);
-
-	Audio::FResamplerResults Result;
-	Result.OutBuffer = &OutResampledSamples;
-
-	const bool bIsSuccess = Audio::Resample(Params, Result);
-	if (!bIsSuccess)
+	const float DecodeEndTime = Request.EndTime > Request.StartTime ? Request.EndTime + SpanContextMargin : 0.0f;
+	if (!SpeechToFacePipeline::GetSoundWaveAudio(Request.SoundWave.Get(), Request.Audio, Request.DecodeStartTime, DecodeEndTime))
 	{
-		return false;
+		Request.Error = TEXT("RuntimeSpeechToFaceAsync: GetSoundWaveAudio.");
+		return;
 	}
-
-	if (Result.OutputFramesGenerated != ExpectedSampleCount)
+	Request.AudioFeaturesHash = SpeechToFacePipeline::HashAudio(Request.Audio, Request.QualityTier);
+	for (FSpeechToFaceRequestOutput& Output : Request.Outputs)
 	{
-		OutResampledSamples.SetNum(Result.OutputFramesGenerated, EAllowShrinking::No);
-	}
+		Output.AudioFeaturesHash = SpeechToFacePipeline::HashAudioChannel(Request.AudioFeaturesHash, Output.Channel);
 
-	return true;
+		// Conversion and resampling run here rather than on the inference threads, unless the features are cached.
+		// Holding the cached features keeps them from being evicted before inference gets to them.
+		Output.Features = SpeechToFacePipeline::FindCachedAudioFeatures(Output.AudioFeaturesHash);
+		if (!Output.Features && !SpeechToFacePipeline::GetEncoderSamples(Request.Audio, Output.Channel, Output.EncoderSamples, Request.Error))
+		{
+			break;
+		}
+	}
+	Request.Audio = FSpeechAudioData();
 }
 
-static bool GetFloatSamples(const TWeakObjectPtr<const USoundWave>& SoundWave, const TArray<uint8>& PcmData, uint32 SampleRate, bool bDownmixChannels, uint32 ChannelToUse, float SecondsToSkip, FloatSamples& OutSamples)
+static void RunInference(FSpeechToFaceRequest& Request)
 {
-	int16 Sample;
-	const uint32 TotalSampleCount = PcmData.Num() / sizeof(Sample);
-	const uint32 TotalSamplesToSkip = SecondsToSkip * SampleRate * SoundWave->NumChannels;
-	if (TotalSamplesToSkip >= TotalSampleCount)
+	if (!Request.Error.IsEmpty())
 	{
-		UE_LOG(LogTemp, Error, TEXT("Could not get float samples with %d skipped samples from %d samples for SoundWave %s"), TotalSamplesToSkip, TotalSampleCount, *SoundWave->GetName());
-		return false;
+		return;
 	}
 
-	// Audio data is stored as 16 bit signed samples with channels interleaved so that must be taken into account
-	const uint8* PcmDataPtr = PcmData.GetData() + TotalSamplesToSkip * sizeof(Sample);
-
-	const uint32 SamplesToSkipPerChannel = SecondsToSkip * SampleRate;
-	const uint32 SampleCountPerChannel = PcmData.Num() / (sizeof(Sample) * SoundWave->NumChannels) - SamplesToSkipPerChannel;
-	OutSamples.SetNumUninitialized(SampleCountPerChannel);
-
-	if (bDownmixChannels && SoundWave->NumChannels > 1)
+	FSpeechToFaceModelInstances Instances = Request.TierModels->CheckOut();
+	if (!Instances.IsValid())
 	{
-		const int32 SampleCount = TotalSampleCount - TotalSamplesToSkip;
-
-		Audio::FAlignedFloatBuffer Buffer;
-		Buffer.SetNumUninitialized(SampleCount);
-		Audio::ArrayPcm16ToFloat(MakeArrayView((int16*)PcmDataPtr, SampleCount), Buffer);
-
-		Audio::TSampleBuffer<float> FloatSampleBuffer(Buffer, SoundWave->NumChannels, SampleRate);
-		FloatSampleBuffer.MixBufferToChannels(1);
-		Audio::FAlignedFloatBuffer MonoBuffer;
-		MonoBuffer.SetNumUninitialized(FloatSampleBuffer.GetNumSamples());
-		MonoBuffer = FloatSampleBuffer.GetArrayView();
-		const float MaxValue = Audio::ArrayMaxAbsValue(MonoBuffer);
-		if (MaxValue > 1.f)
-		{
-			Audio::ArrayMultiplyByConstantInPlace(MonoBuffer, 1.f / MaxValue);
-		}
-
-		OutSamples = MonoBuffer;
+		Request.Error = TEXT("RuntimeSpeechToFaceAsync: Failed to create model instances.");
+		return;
 	}
-	else
+
+	// Channels run back to back on the same instances, which stay pinned to their shapes between them
+	for (FSpeechToFaceRequestOutput& Output : Request.Outputs)
 	{
-		for (uint32 SampleIndex = 0; SampleIndex < SampleCountPerChannel; SampleIndex++)
+		// Extract audio features, or reuse them when the same audio was processed before
+		TSharedPtr<const FSpeechAudioFeatures> Features = MoveTemp(Output.Features);
+		if (Features)
 		{
-			// Position ourselves at the sample of appropriate channel, taking into account the channel layout
-			const uint8* SampleData = PcmDataPtr + ChannelToUse * sizeof(uint16);
-			FMemory::Memcpy(&Sample, SampleData, sizeof(Sample));
-			// Convert to range [-1.0, 1.0)
-			OutSamples[SampleIndex] = Sample / 32768.0f;
-
-			PcmDataPtr += sizeof(Sample) * SoundWave->NumChannels;
+			// Found by the decode stage
 		}
-	}
-
-	if (SampleRate != AudioEncoderSampleRateHz)
-	{
-		FloatSamples ResampledAudio;
-		if (!ResampleAudio(MoveTemp(OutSamples), SampleRate, AudioEncoderSampleRateHz, ResampledAudio))
+		else if (Request.SoundWave)
 		{
-			UE_LOG(LogTemp, Error, TEXT("Could not resample audio from %d to %d for SoundWave %s"), SampleRate, AudioEncoderSampleRateHz, *SoundWave->GetName());
-			return false;
+			Features = SpeechToFacePipeline::GetAudioFeatures(Instances, Output.EncoderSamples, Output.AudioFeaturesHash, Request.SoundWave->GetName(), Request.Error);
+			Output.EncoderSamples.Empty();
 		}
-		OutSamples = MoveTemp(ResampledAudio);
-	}
-
-	return true;
-}
-
-static bool ExtractAudioFeatures(const FloatSamples& Samples, const TSharedPtr<UE::NNE::IModelInstanceCPU>& AudioExtractor, TArray<float>& OutAudioData)
-{
-	using namespace UE::NNE;
-
-	OutAudioData.Empty((Samples.Num() / SamplesPerFrame) * 512);
-
-	// Restrict extracting of audio features to 30 second chunks as the model does not support more
-	for (int32 SampleIndex = 0; SampleIndex < Samples.Num(); SampleIndex += RigLogicPredictorMaxAudioSamples)
-	{
-		const uint32 SamplesCount = FMath::Clamp(Samples.Num() - SampleIndex, 0, RigLogicPredictorMaxAudioSamples);
-
-		TArray<uint32, TInlineAllocator<2>> ExtractorInputShapesData = { 1, SamplesCount };
-		TArray<FTensorShape, TInlineAllocator<1>> ExtractorInputShapes = { FTensorShape::Make(ExtractorInputShapesData) };
-		if (AudioExtractor->SetInputTensorShapes(ExtractorInputShapes) != IModelInstanceCPU::ESetInputTensorShapesStatus::Ok)
+		else
 		{
-			UE_LOG(LogTemp, Error, TEXT("Could not set the audio extractor input tensor shapes"));
-			return false;
+			Features = SpeechToFacePipeline::FindCachedAudioFeatures(Output.AudioFeaturesHash);
+			if (!Features)
+			{
+				Request.Error = TEXT("RuntimeSpeechToFaceAsync: Audio features are no longer cached, use Speech To Face Anim.");
+			}
 		}
 
-		// Todo: last frame of the last chunk will not be complete (if not multiple of SamplesPerFrame). Should we ceil/pad/0-fill? 
-		const uint32 NumFrames = static_cast<uint32>(SamplesCount / SamplesPerFrame);
-		TArray<uint32, TInlineAllocator<3>> ExtractorOutputShapeData = { 1, NumFrames, 512 };
-		FTensorShape ExtractorOutputShape = FTensorShape::Make(ExtractorOutputShapeData);
-		TArray<float> ExtractorOutputData;
-		ExtractorOutputData.SetNumUninitialized(ExtractorOutputShape.Volume());
-
-		TArray<FTensorBindingCPU, TInlineAllocator<1>> ExtractorInputBindings = { {(void*)(Samples.GetData() + SampleIndex), SamplesCount * sizeof(float)} };
-		TArray<FTensorBindingCPU, TInlineAllocator<1>> ExtractorOutputBindings = { {(void*)ExtractorOutputData.GetData(), ExtractorOutputData.Num() * sizeof(float)} };
-		if (AudioExtractor->RunSync(ExtractorInputBindings, ExtractorOutputBindings) != IModelInstanceCPU::ESetInputTensorShapesStatus::Ok)
+		if (!Features || !SpeechToFacePipeline::GenerateAnimation(Instances, *Features, Request.Params, Output.AnimationData, Request.Error))
 		{
-			UE_LOG(LogTemp, Error, TEXT("The audio extractor NNE model failed to execute"));
-			return false;
+			break;
 		}
-
-		OutAudioData.Append(ExtractorOutputData.GetData(), ExtractorOutputData.Num());
 	}
-	return true;
+	Request.TierModels->CheckIn(MoveTemp(Instances));
 }
 
-static bool RunPredictor(
-	const TSharedPtr<UE::NNE::IModelInstanceCPU>& RigLogicPredictor,
-	const uint32 InFaceControlNum,
-	const uint32 InBlinkControlNum,
-	const uint32 InSamplesNum,
-	const TArray<float>& InAudioData,
-	const EAudioDrivenAnimationMood& Mood,
-	const float DesiredMoodIntensity,
-	TArray<float>& OutRigLogicValues,
-	TArray<float>& OutRigLogicBlinkValues,
-	TArray<float>& OutRigLogicHeadValues
-)
+static void BuildCurves(FSpeechToFaceRequest& Request)
 {
-	using namespace UE::NNE;
-
-	const uint32 NumFrames = static_cast<uint32>(InSamplesNum / SamplesPerFrame);
-	TArray<uint32, TInlineAllocator<2>> AudioShapeData = { 1, NumFrames, 512 };
-
-	int32 MoodIndex = Mood == EAudioDrivenAnimationMood::AutoDetect ? -1 : static_cast<int32>(Mood);
-	const TArray<int32, TInlineAllocator<1>> MoodIndexArray = { MoodIndex, };
-	TArray<uint32, TInlineAllocator<1>> MoodIndexShapeData = { 1, };
-
-	const TArray<float, TInlineAllocator<1>> MoodIntensityArray = { DesiredMoodIntensity, };
-	TArray<uint32, TInlineAllocator<1>> MoodIntensityShapeData = { 1, };
-
-	TArray<FTensorShape, TInlineAllocator<3>> InputTensorShapes = {
-		FTensorShape::Make(AudioShapeData),
-		FTensorShape::Make(MoodIndexShapeData),
-		FTensorShape::Make(MoodIntensityShapeData)
-	};
-
-	check(RigLogicPredictor);
-
-	if (RigLogicPredictor->SetInputTensorShapes(InputTensorShapes) != IModelInstanceCPU::ESetInputTensorShapesStatus::Ok)
+	if (!Request.Error.IsEmpty())
 	{
-		return false;
+		return;
 	}
 
-	// Bind the inputs
-
-	// Tensor binding requires non-const void* - we're trusting it not to mutate the input data.
-	void* AudioDataPtr = const_cast<void*>(static_cast<const void*>(InAudioData.GetData()));
-	void* MoodIndexDataPtr = const_cast<void*>(static_cast<const void*>(MoodIndexArray.GetData()));
-	void* MoodIntensityDataPtr = const_cast<void*>(static_cast<const void*>(MoodIntensityArray.GetData()));
-
-	TArray<FTensorBindingCPU, TInlineAllocator<3>> InputBindings = {
-		{AudioDataPtr, InAudioData.Num() * sizeof(float)},
-		{MoodIndexDataPtr, MoodIndexArray.Num() * sizeof(float)},
-		{MoodIntensityDataPtr, MoodIntensityArray.Num() * sizeof(float)}
-	};
-
-	// Bind the outputs
-	TArray<float> FaceParameters;
-	TArray<uint32, TInlineAllocator<3>> FaceParametersShapeData = { 1, NumFrames,  InFaceControlNum };
-	TArray<FTensorShape, TInlineAllocator<1>> FaceParametersShape = { FTensorShape::Make(FaceParametersShapeData) };
-	FaceParameters.SetNumUninitialized(FaceParametersShape[0].Volume());
-
-	TArray<float> BlinkParameters;
-	TArray<uint32, TInlineAllocator<3>> BlinkParametersShapeData = { 1, NumFrames,  InBlinkControlNum };
-	TArray<FTensorShape, TInlineAllocator<1>> BlinkParametersShape = { FTensorShape::Make(BlinkParametersShapeData) };
-	BlinkParameters.SetNumUninitialized(BlinkParametersShape[0].Volume());
-
-	const uint32 NumOutputHeadControls = static_cast<uint32>(ModelHeadControls.Num());
-
-	TArray<float> HeadParameters;
-	TArray<uint32, TInlineAllocator<3>> HeadParametersShapeData = { 1, NumFrames,  NumOutputHeadControls };
-	TArray<FTensorShape, TInlineAllocator<1>> HeadParametersShape = { FTensorShape::Make(HeadParametersShapeData) };
-	HeadParameters.SetNumUninitialized(HeadParametersShape[0].Volume());
-
-	void* FaceParametersPtr = static_cast<void*>(FaceParameters.GetData());
-	void* BlinkParametersPtr = static_cast<void*>(BlinkParameters.GetData());
-	void* HeadParametersPtr = static_cast<void*>(HeadParameters.GetData());
-
-	TArray<FTensorBindingCPU, TInlineAllocator<2>> OutputBindings = {
-		{FaceParametersPtr, FaceParameters.Num() * sizeof(float)},
-		{BlinkParametersPtr, BlinkParameters.Num() * sizeof(float)},
-		{HeadParametersPtr, HeadParameters.Num() * sizeof(float) }
-	};
-
-	if (RigLogicPredictor->RunSync(InputBindings, OutputBindings) != IModelInstanceCPU::ESetInputTensorShapesStatus::Ok)
+	for (FSpeechToFaceRequestOutput& Output : Request.Outputs)
 	{
-		UE_LOG(LogTemp, Error, TEXT("The rig logic model failed to execute"));
-		return false;
+		Output.AnimationData.TrimToRange(Request.StartTime - Request.DecodeStartTime, Request.Duration);
+		Output.AnimationData.BuildCurves(Output.Curves);
+		Output.AnimationData = FSpeechToFaceAnimationData();
+		if (Request.bCompress)
+		{
+			URuntimeAnimation::CompressCurves(Output.Curves, Request.CompressionSettings, Output.Tracks);
+			Output.Curves.Empty();
+		}
 	}
-
-	OutRigLogicValues = MoveTemp(FaceParameters);
-	OutRigLogicBlinkValues = MoveTemp(BlinkParameters);
-	OutRigLogicHeadValues = MoveTemp(HeadParameters);
-
-	return true;
 }
 
-TArray<FAnimationFrame> ResampleAnimation(TArrayView<const float> InRawAnimation, TArrayView<const FString> InRigControlNames, uint32 ControlNum, float InOutputFps)
+URuntimeSpeechToFaceAsync* URuntimeSpeechToFaceAsync::SpeechToFaceAnim(UObject* WorldContextObject, USoundWave* SoundWave, USkeleton* Skeleton, EAudioDrivenAnimationMood Mood, float MoodIntensity, bool bGenerateBlinks, bool bGenerateHeadAnimation, FName QualityTier, bool bAllowQualityFallback, float StartTime, float EndTime)
 {
-	const uint32 RawFrameCount = InRawAnimation.Num() / ControlNum;
-	const float AnimationLengthSec = RawFrameCount * RigLogicPredictorFrameDuration;
-	const uint32 ResampledFrameCount = FMath::FloorToInt32(AnimationLengthSec * InOutputFps);
-
-	// Resample using linear interpolation
-	TArray<FAnimationFrame> ResampledAnimation;
-	ResampledAnimation.AddDefaulted(ResampledFrameCount);
-
-	for (uint32 ResampledFrameIndex = 0; ResampledFrameIndex < ResampledFrameCount; ++ResampledFrameIndex)
-	{
-		// Get corresponding raw frame time
-		const float FrameStartSec = ResampledFrameIndex / InOutputFps;
-		const float RawFrameIndex = FMath::Clamp(FrameStartSec * RigLogicPredictorOutputFps, 0, RawFrameCount - 1);
-
-		// Get nearest full frames and distance between the two
-		const uint32 PrevRawFrameIndex = FMath::FloorToInt32(RawFrameIndex);
-		const uint32 NextRawFrameIndex = FMath::CeilToInt32(RawFrameIndex);
-		const float RawFramesDelta = RawFrameIndex - PrevRawFrameIndex;
-
-		// Add interpolated control values for the given frames
-		ResampledAnimation[ResampledFrameIndex].Reserve(ControlNum);
-		for (uint32 ControlIndex = 0; ControlIndex < ControlNum; ++ControlIndex)
-		{
-			const float PrevRawControlValue = InRawAnimation[PrevRawFrameIndex * ControlNum + ControlIndex];
-			const float NextRawControlValue = InRawAnimation[NextRawFrameIndex * ControlNum + ControlIndex];
-			const float ResampledValue = FMath::Lerp(PrevRawControlValue, NextRawControlValue, RawFramesDelta);
+	URuntimeSpeechToFaceAsync* Action = NewObject<URuntimeSpeechToFaceAsync>();
+	Action->RegisterWithGameInstance(WorldContextObject);
+	Action->SoundWave = SoundWave;
+	Action->Skeleton = Skeleton;
+	Action->Mood = Mood;
+	Action->MoodIntensity = MoodIntensity;
+	Action->bGenerateBlinks = bGenerateBlinks;
+	Action->bGenerateHeadAnimation = bGenerateHeadAnimation;
+	Action->QualityTier = QualityTier;
+	Action->bAllowQualityFallback = bAllowQualityFallback;
+	Action->SpanStartTime = StartTime;
+	Action->SpanEndTime = EndTime;
+	return Action;
+}
 
-			ResampledAnimation[ResampledFrameIndex].Add(InRigControlNames[ControlIndex], ResampledValue);
-		}
-	}
+URuntimeSpeechToFaceAsync* URuntimeSpeechToFaceAsync::SpeechToFaceAnimPerChannel(UObject* WorldContextObject, USoundWave* SoundWave, USkeleton* Skeleton, const TArray<int32>& Channels, EAudioDrivenAnimationMood Mood, float MoodIntensity, bool bGenerateBlinks, bool bGenerateHeadAnimation, FName QualityTier)
+{
+	URuntimeSpeechToFaceAsync* Action = SpeechToFaceAnim(WorldContextObject, SoundWave, Skeleton, Mood, MoodIntensity, bGenerateBlinks, bGenerateHeadAnimation, QualityTier);
+	Action->Channels = Channels;
+	return Action;
+}
 
-	return ResampledAnimation;
+URuntimeSpeechToFaceAsync* URuntimeSpeechToFaceAsync::RegenerateSpeechToFaceAnim(UObject* WorldContextObject, URuntimeAnimation* Animation, EAudioDrivenAnimationMood Mood, float MoodIntensity, bool bGenerateBlinks, bool bGenerateHeadAnimation)
+{
+	URuntimeSpeechToFaceAsync* Action = NewObject<URuntimeSpeechToFaceAsync>();
+	Action->RegisterWithGameInstance(WorldContextObject);
+	Action->SourceAnim = Animation;
+	Action->Mood = Mood;
+	Action->MoodIntensity = MoodIntensity;
+	Action->bGenerateBlinks = bGenerateBlinks;
+	Action->bGenerateHeadAnimation = bGenerateHeadAnimation;
+	// Cached features only fit the decoder of the tier whose encoder extracted them
+	Action->QualityTier = Animation ? Animation->QualityTier : NAME_None;
+	Action->bAllowQualityFallback = false;
+	return Action;
 }
 
 void URuntimeSpeechToFaceAsync::Activate()
 {
-	if (!(AudioExtractor.IsValid() && RigLogicPredictor.IsValid()))
+	const URuntimeSpeechToFaceSettings* Settings = GetDefault<URuntimeSpeechToFaceSettings>();
+	if (bAllowQualityFallback && Settings->TargetLatency > 0.0f && AverageLatency > Settings->TargetLatency)
 	{
-		FSoftObjectPath AudioEncoder = GetDefault<URuntimeSpeechToFaceSettings>()->AudioEncoder;
-		FSoftObjectPath AnimationDecoder = GetDefault<URuntimeSpeechToFaceSettings>()->AnimationDecoder;
-		AudioExtractor = TryLoadModelData(AudioEncoder);
-		RigLogicPredictor = TryLoadModelData(AnimationDecoder);
+		UE_LOG(LogRuntimeSpeechToFace, Verbose, TEXT("Average latency %.2f s is above the target, using quality tier %s"), AverageLatency, *Settings->FallbackQualityTier.ToString());
+		QualityTier = Settings->FallbackQualityTier;
 	}
 
-	if (!(AudioExtractor.IsValid() && RigLogicPredictor.IsValid()))
+	const TSharedPtr<FSpeechToFaceTierModels> TierModels = LoadTierModels(QualityTier);
+	if (!TierModels)
 	{
-		OnFailed.Broadcast(nullptr, TEXT("RuntimeSpeechToFaceAsync: Failed to load models."));
-		SetReadyToDestroy();
+		Fail(TEXT("RuntimeSpeechToFaceAsync: Failed to load models."));
 		return;
 	}
 
-	if (bHasProcessingInstance)
+	if (!SoundWave && !SourceAnim)
 	{
-		OnFailed.Broadcast(nullptr, TEXT("RuntimeSpeechToFaceAsync: Already processing another request."));
-		SetReadyToDestroy();
+		Fail(TEXT("RuntimeSpeechToFaceAsync: No speech input."));
 		return;
 	}
 
-	if (!SoundWave)
+	if (Channels.ContainsByPredicate([](int32 Channel) { return Channel < 0; }))
 	{
-		OnFailed.Broadcast(nullptr, TEXT("RuntimeSpeechToFaceAsync: No speech input."));
-		SetReadyToDestroy();
+		Fail(TEXT("RuntimeSpeechToFaceAsync: Negative channel index."));
 		return;
 	}
 
-	bIsProcessing = true;
-	bHasProcessingInstance = true;
+	TSharedRef<FSpeechToFaceRequest> Request = MakeShared<FSpeechToFaceRequest>();
+	Request->TierModels = TierModels;
+	Request->QualityTier = QualityTier;
+	Request->Params.Mood = Mood;
+	Request->Params.MoodIntensity = MoodIntensity;
+	Request->Params.bGenerateBlinks = bGenerateBlinks;
+	Request->Params.bGenerateHeadAnimation = bGenerateHeadAnimation;
+	Request->bCompress = Settings->bCompressAnimations;
+	Request->CompressionSettings = Settings->CompressionSettings;
+	for (const int32 Channel : Channels)
+	{
+		Request->Outputs.AddDefaulted_GetRef().Channel = Channel;
+	}
+	if (Request->Outputs.Num() == 0)
+	{
+		Request->Outputs.AddDefaulted();
+	}
+	if (SourceAnim)
+	{
+		// The cached features cover the same span and margin as when SourceAnim was generated
+		Request->StartTime = SourceAnim->AudioStartTime;
+		Request->Duration = SourceAnim->Duration;
+		Request->AudioClock = SourceAnim->AudioClock;
+		Request->Outputs[0].AudioFeaturesHash = SourceAnim->AudioFeaturesHash;
+	}
+	else
+	{
+		if (SpanStartTime >= SoundWave->Duration)
+		{
+			Fail(TEXT("RuntimeSpeechToFaceAsync: StartTime is past the end of the sound wave."));
+			return;
+		}
+		Request->SoundWave.Reset(SoundWave);
+		Request->StartTime = FMath::Max(SpanStartTime, 0.0f);
+		Request->EndTime = SpanEndTime > Request->StartTime ? FMath::Min(SpanEndTime, SoundWave->Duration) : 0.0f;
+		Request->Duration = (Request->EndTime > 0.0f ? Request->EndTime : SoundWave->Duration) - Request->StartTime;
+		const USpeechSoundWave* SpeechSoundWave = Cast<USpeechSoundWave>(SoundWave);
+		Request->AudioClock = SpeechSoundWave ? SpeechSoundWave->GetPlaybackState() : nullptr;
+	}
+
+	Request->DecodeStartTime = FMath::Max(Request->StartTime - SpanContextMargin, 0.0f);
 
-	Anim = NewObject<URuntimeAnimation>(GetTransientPackage(), URuntimeAnimation::StaticClass(), TEXT("FaceAnim"));
-	Anim->Duration = SoundWave->Duration;
+	++NumActiveRequests;
+	StartTime = FPlatformTime::Seconds();
 
-	// Generate facial animation in background thread
-	AsyncTask(ENamedThreads::AnyBackgroundThreadNormalTask, [this]()
+	// Decoding runs on the task graph, so requests decode while earlier requests run their models on the inference threads
+	TArray<UE::Tasks::FTask> DecodeTasks;
+	if (Request->SoundWave)
+	{
+		DecodeTasks.Add(UE::Tasks::Launch(TEXT("SpeechToFaceDecode"), [Request]() { DecodeAudio(*Request); }, UE::Tasks::ETaskPriority::BackgroundNormal));
+	}
+
+	UE::Tasks::FTaskEvent InferenceDone(TEXT("SpeechToFaceInference"));
+	UE::Tasks::Launch(TEXT("SpeechToFaceLaunchInference"), [Request, InferenceDone]()
 		{
-			const int NumFrames = static_cast<int>(SoundWave->Duration * 30);
+			SpeechToFacePipeline::LaunchInference([Request, InferenceDone]() mutable
+				{
+					RunInference(*Request);
+					InferenceDone.Trigger();
+				},
+				[Request, InferenceDone]() mutable
+				{
+					Request->Error = TEXT("RuntimeSpeechToFaceAsync: Inference was shut down before the request ran.");
+					InferenceDone.Trigger();
+				});
+		}, DecodeTasks, UE::Tasks::ETaskPriority::BackgroundNormal);
 
-			// Step 1: get PCM data
-			TArray<uint8> PcmData;
-			uint16 ChannelNum;
-			uint32 SampleRate;
-			GetImportedSoundWaveData(SoundWave, PcmData, SampleRate, ChannelNum);
+	const UE::Tasks::FTask CurvesTask = UE::Tasks::Launch(TEXT("SpeechToFaceCurves"), [Request]() { BuildCurves(*Request); }, UE::Tasks::Prerequisites(InferenceDone), UE::Tasks::ETaskPriority::BackgroundNormal);
 
-			FloatSamples Samples;
-			if (!GetFloatSamples(SoundWave, PcmData, SampleRate, true, 0, 0, Samples))
+	// Only the hand-off to the animation object runs on the game thread
+	UE::Tasks::Launch(TEXT("SpeechToFaceComplete"), [WeakThis = TWeakObjectPtr<URuntimeSpeechToFaceAsync>(this), Request]()
+		{
+			Request->SoundWave.Reset();
+			--NumActiveRequests;
+			if (URuntimeSpeechToFaceAsync* This = WeakThis.Get())
 			{
-				FailWithReason(TEXT("RuntimeSpeechToFaceAsync: GetFloatSamples."));
-				return;
+				This->Complete(*Request);
 			}
+			ReleaseIdleModelInstances();
+		}, UE::Tasks::Prerequisites(CurvesTask), UE::Tasks::ETaskPriority::Normal, UE::Tasks::EExtendedTaskPriority::GameThreadNormalPri);
+}
 
-			// Step 2: extract audio features
-			TArray<float> ExtractedAudioData;
-			if (!ExtractAudioFeatures(Samples, AudioExtractor, ExtractedAudioData))
-			{
-				FailWithReason(TEXT("RuntimeSpeechToFaceAsync: ExtractAudioFeatures."));
-				return;
-			}
+void URuntimeSpeechToFaceAsync::Complete(FSpeechToFaceRequest& Request)
+{
+	if (!Request.Error.IsEmpty())
+	{
+		Fail(Request.Error);
+		return;
+	}
 
-			// Step 3: run rig logic predictor to get animation data
-			TArray<float> RigLogicValues;
-			TArray<float> RigLogicBlinkValues;
-			TArray<float> RigLogicHeadValues;
+	UpdateAverageLatency();
 
-			if (!RunPredictor(RigLogicPredictor, RigControlNames.Num(), BlinkRigControlNames.Num(), Samples.Num(), ExtractedAudioData, Mood, MoodIntensity, RigLogicValues, RigLogicBlinkValues, RigLogicHeadValues))
-			{
-				FailWithReason(TEXT("RuntimeSpeechToFaceAsync: RunPredictor."));
-				return;
-			}
+	TArray<URuntimeAnimation*> Anims;
+	for (FSpeechToFaceRequestOutput& Output : Request.Outputs)
+	{
+		URuntimeAnimation* OutputAnim = NewObject<URuntimeAnimation>(GetTransientPackage(), URuntimeAnimation::StaticClass(), MakeUniqueObjectName(GetTransientPackage(), URuntimeAnimation::StaticClass(), TEXT("FaceAnim")));
+		OutputAnim->Duration = Request.Duration;
+		OutputAnim->AudioClock = Request.AudioClock;
+		OutputAnim->AudioStartTime = Request.StartTime;
+		OutputAnim->AudioFeaturesHash = Output.AudioFeaturesHash;
+		OutputAnim->QualityTier = Request.QualityTier;
+		OutputAnim->FloatCurves = MoveTemp(Output.Curves);
+		OutputAnim->CompressedTracks = MoveTemp(Output.Tracks);
+		OutputAnim->BuildLODCurveSets();
+
+		URuntimeSpeechToFaceMemorySubsystem::Track(OutputAnim);
+		Anims.Add(OutputAnim);
+	}
 
-			// Step 4: resample animation
-			TArray<FAnimationFrame> OutAnimationData = ResampleAnimation(RigLogicValues, RigControlNames, RigControlNames.Num(), AnimationOutputFps);
-			if (bGenerateBlinks)
-			{
-				TArray<FAnimationFrame> BlinkAnimation = ResampleAnimation(RigLogicBlinkValues, BlinkRigControlNames, BlinkRigControlNames.Num(), AnimationOutputFps);
-				for (int32 FrameIndex = 0; FrameIndex < BlinkAnimation.Num(); FrameIndex++)
-				{
-					for (const FString& BlinkControlName : BlinkRigControlNames)
-					{
-						OutAnimationData[FrameIndex][BlinkControlName] += BlinkAnimation[FrameIndex][BlinkControlName];
-					}
-				}
-			}
+	Anim = Anims[0];
+	OnFinishedNative.ExecuteIfBound(Anim, TEXT("Success"));
+	OnCompleted.Broadcast(Anim, TEXT("Success"));
+	OnChannelsCompleted.Broadcast(Anims, TEXT("Success"));
+	SetReadyToDestroy();
+}
 
-			for (int32 FrameIndex = 0; FrameIndex < OutAnimationData.Num(); ++FrameIndex)
-			{
-				TMap<FString, float> AnimationFrame = GuiToRawControlsUtils::ConvertGuiToRawControls(OutAnimationData[FrameIndex]);
-				if (FrameIndex == 0)
-				{
-					for (const auto& Sample : AnimationFrame)
-					{
-						Anim->FloatCurves.Add(FFloatCurve(*Sample.Key, 0));
-					}
-				}
-
-				int CurveIndex = 0;
-				const float FrameTime = FrameIndex / 30.0f;
-				for (const TPair<FString, float>& Sample : AnimationFrame)
-				{
-					Anim->FloatCurves[CurveIndex].FloatCurve.AddKey(FrameTime, Sample.Value);
-					++CurveIndex;
-				}
-			}
+void URuntimeSpeechToFaceAsync::PrewarmModels(FName QualityTier)
+{
+	const TSharedPtr<FSpeechToFaceTierModels> TierModels = LoadTierModels(QualityTier);
+	if (!TierModels)
+	{
+		UE_LOG(LogRuntimeSpeechToFace, Warning, TEXT("Failed to load the models of quality tier %s to prewarm them"), *QualityTier.ToString());
+		return;
+	}
 
-			AsyncTask(ENamedThreads::GameThread, [this]()
-				{
-					OnCompleted.Broadcast(Anim, TEXT("Success"));
-					bHasProcessingInstance = false;
-					SetReadyToDestroy();
-					bIsProcessing = false;
-				});
-		});
+	// Creating the instances sets up the runtime sessions, the slow part of a first request, so it runs with the inference work
+	SpeechToFacePipeline::LaunchInference([TierModels]()
+		{
+			TierModels->CheckIn(TierModels->Models->CreateInstances());
+		},
+		[]() {});
 }
 
-void URuntimeSpeechToFaceAsync::BeginDestroy()
+void URuntimeSpeechToFaceAsync::Fail(const FString& Reason)
 {
-	if (bIsProcessing)
+	OnFinishedNative.ExecuteIfBound(nullptr, Reason);
+	OnFailed.Broadcast(nullptr, Reason);
+	SetReadyToDestroy();
+}
+
+void URuntimeSpeechToFaceAsync::ReleaseIdleModelInstances()
+{
+	if (NumActiveRequests == 0 && GetDefault<URuntimeSpeechToFaceSettings>()->bReleaseModelInstancesWhenIdle)
 	{
-		bHasProcessingInstance = false;
+		for (TPair<FName, TSharedPtr<FSpeechToFaceTierModels>>& TierModels : QualityTierModels)
+		{
+			FScopeLock Lock(&TierModels.Value->InstancesLock);
+			TierModels.Value->FreeInstances.Empty();
+		}
 	}
-	Super::BeginDestroy();
 }
 
-void URuntimeSpeechToFaceAsync::FailWithReason(const FString& Reason)
+void URuntimeSpeechToFaceAsync::UpdateAverageLatency()
 {
-	AsyncTask(ENamedThreads::GameThread, [Reason, this]()
-		{
-			OnFailed.Broadcast(nullptr, Reason);
-			SetReadyToDestroy();
-			bIsProcessing = false;
-		});
+	const double Latency = FPlatformTime::Seconds() - StartTime;
+	AverageLatency = AverageLatency > 0.0 ? FMath::Lerp(AverageLatency, Latency, 0.2) : Latency;
 }
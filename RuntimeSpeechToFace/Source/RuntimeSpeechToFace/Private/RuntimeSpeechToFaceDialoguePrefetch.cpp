@@ -0,0 +1,224 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#include "RuntimeSpeechToFaceDialoguePrefetch.h"
+#include "RuntimeAnimation.h"
+#include "RuntimeSpeechToFace.h"
+#include "RuntimeSpeechToFaceAsyncTask.h"
+#include "RuntimeSpeechToFaceMemorySubsystem.h"
+#include "RuntimeSpeechToFaceSettings.h"
+#include "Sound/SoundWave.h"
+
+// Let the memory subsystem release what a line held once it is dropped
+static void UnpinLine(const FRuntimeSpeechToFacePrefetchEntry& Line)
+{
+	URuntimeSpeechToFaceMemorySubsystem::Unpin(Line.SoundWave);
+	URuntimeSpeechToFaceMemorySubsystem::Unpin(Line.Animation);
+}
+
+URuntimeSpeechToFaceDialoguePrefetch* URuntimeSpeechToFaceDialoguePrefetch::StartDialoguePrefetch(UObject* WorldContextObject, const TArray<FRuntimeSpeechToFaceDialogueLine>& Playlist, bool bGenerateBlinks, bool bGenerateHeadAnimation, FName QualityTier)
+{
+	URuntimeSpeechToFaceDialoguePrefetch* Prefetch = NewObject<URuntimeSpeechToFaceDialoguePrefetch>();
+	Prefetch->WorldContext = WorldContextObject;
+	Prefetch->bGenerateBlinks = bGenerateBlinks;
+	Prefetch->bGenerateHeadAnimation = bGenerateHeadAnimation;
+	Prefetch->QualityTier = QualityTier;
+	Prefetch->AddLines(Playlist);
+	return Prefetch;
+}
+
+void URuntimeSpeechToFaceDialoguePrefetch::AddLines(const TArray<FRuntimeSpeechToFaceDialogueLine>& NewLines)
+{
+	const double Now = FPlatformTime::Seconds();
+	for (const FRuntimeSpeechToFaceDialogueLine& NewLine : NewLines)
+	{
+		const FSoftObjectPath SoundWavePath = NewLine.SoundWave.ToSoftObjectPath();
+		if (SoundWavePath.IsNull())
+		{
+			continue;
+		}
+
+		FRuntimeSpeechToFacePrefetchEntry* Line = Lines.FindByPredicate([&SoundWavePath](const FRuntimeSpeechToFacePrefetchEntry& Entry) { return Entry.SoundWavePath == SoundWavePath; });
+		if (!Line)
+		{
+			Line = &Lines.AddDefaulted_GetRef();
+			Line->SoundWavePath = SoundWavePath;
+			Line->Serial = ++NextSerial;
+		}
+		Line->Deadline = Now + NewLine.Deadline;
+		if (!Line->Request && !Line->Animation)
+		{
+			Line->Mood = NewLine.Mood;
+			Line->MoodIntensity = NewLine.MoodIntensity;
+		}
+	}
+	Lines.StableSort([](const FRuntimeSpeechToFacePrefetchEntry& A, const FRuntimeSpeechToFacePrefetchEntry& B) { return A.Deadline < B.Deadline; });
+
+	// Loads are requested in deadline order, so the streamer gets to the earliest lines first
+	for (FRuntimeSpeechToFacePrefetchEntry& Line : Lines)
+	{
+		if (Line.SoundWave || Line.LoadHandle || Line.bFailed)
+		{
+			continue;
+		}
+		Line.SoundWave = Cast<USoundWave>(Line.SoundWavePath.ResolveObject());
+		if (Line.SoundWave)
+		{
+			URuntimeSpeechToFaceMemorySubsystem::Pin(Line.SoundWave);
+		}
+		else
+		{
+			Line.LoadHandle = StreamableManager.RequestAsyncLoad(Line.SoundWavePath, FStreamableDelegate::CreateUObject(this, &URuntimeSpeechToFaceDialoguePrefetch::OnLineLoaded, Line.SoundWavePath, Line.Serial));
+		}
+	}
+
+	LaunchNext();
+}
+
+URuntimeAnimation* URuntimeSpeechToFaceDialoguePrefetch::GetAnimation(USoundWave* SoundWave) const
+{
+	const FSoftObjectPath SoundWavePath(SoundWave);
+	const FRuntimeSpeechToFacePrefetchEntry* Line = Lines.FindByPredicate([&SoundWavePath](const FRuntimeSpeechToFacePrefetchEntry& Entry) { return Entry.SoundWavePath == SoundWavePath; });
+	return Line ? Line->Animation : nullptr;
+}
+
+void URuntimeSpeechToFaceDialoguePrefetch::RemoveLine(TSoftObjectPtr<USoundWave> SoundWave)
+{
+	const FSoftObjectPath SoundWavePath = SoundWave.ToSoftObjectPath();
+	const int32 LineIndex = Lines.IndexOfByPredicate([&SoundWavePath](const FRuntimeSpeechToFacePrefetchEntry& Entry) { return Entry.SoundWavePath == SoundWavePath; });
+	if (LineIndex == INDEX_NONE)
+	{
+		return;
+	}
+
+	// A request already running finishes, its result is dropped when the line is not found
+	if (Lines[LineIndex].LoadHandle)
+	{
+		Lines[LineIndex].LoadHandle->CancelHandle();
+	}
+	UnpinLine(Lines[LineIndex]);
+	Lines.RemoveAt(LineIndex);
+	LaunchNext();
+}
+
+void URuntimeSpeechToFaceDialoguePrefetch::Clear()
+{
+	for (FRuntimeSpeechToFacePrefetchEntry& Line : Lines)
+	{
+		if (Line.LoadHandle)
+		{
+			Line.LoadHandle->CancelHandle();
+		}
+		UnpinLine(Line);
+	}
+	Lines.Reset();
+}
+
+int32 URuntimeSpeechToFaceDialoguePrefetch::GetNumPendingLines() const
+{
+	int32 NumPending = 0;
+	for (const FRuntimeSpeechToFacePrefetchEntry& Line : Lines)
+	{
+		NumPending += !Line.Animation && !Line.bFailed;
+	}
+	return NumPending;
+}
+
+void URuntimeSpeechToFaceDialoguePrefetch::BeginDestroy()
+{
+	Clear();
+	Super::BeginDestroy();
+}
+
+FRuntimeSpeechToFacePrefetchEntry* URuntimeSpeechToFaceDialoguePrefetch::FindLine(const FSoftObjectPath& SoundWavePath, uint32 Serial)
+{
+	return Lines.FindByPredicate([&SoundWavePath, Serial](const FRuntimeSpeechToFacePrefetchEntry& Entry) { return Entry.Serial == Serial && Entry.SoundWavePath == SoundWavePath; });
+}
+
+void URuntimeSpeechToFaceDialoguePrefetch::OnLineLoaded(FSoftObjectPath SoundWavePath, uint32 Serial)
+{
+	FRuntimeSpeechToFacePrefetchEntry* Line = FindLine(SoundWavePath, Serial);
+	if (!Line)
+	{
+		return;
+	}
+
+	Line->LoadHandle.Reset();
+	Line->SoundWave = Cast<USoundWave>(SoundWavePath.ResolveObject());
+	URuntimeSpeechToFaceMemorySubsystem::Pin(Line->SoundWave);
+	if (!Line->SoundWave)
+	{
+		Line->bFailed = true;
+		const FString Reason = FString::Printf(TEXT("RuntimeSpeechToFaceDialoguePrefetch: Failed to load %s."), *SoundWavePath.ToString());
+		UE_LOG(LogRuntimeSpeechToFace, Warning, TEXT("%s"), *Reason);
+		OnLineFailed.Broadcast(nullptr, Reason);
+	}
+
+	LaunchNext();
+}
+
+void URuntimeSpeechToFaceDialoguePrefetch::OnLineGenerated(URuntimeAnimation* Anim, const FString& Reason, FSoftObjectPath SoundWavePath, uint32 Serial)
+{
+	FRuntimeSpeechToFacePrefetchEntry* Line = FindLine(SoundWavePath, Serial);
+	if (Line)
+	{
+		Line->Request = nullptr;
+		USoundWave* SoundWave = Line->SoundWave;
+		if (Anim)
+		{
+			// Never played until its line starts, so it would be the first the memory subsystem releases
+			Line->Animation = Anim;
+			URuntimeSpeechToFaceMemorySubsystem::Pin(Anim);
+			const double Lateness = FPlatformTime::Seconds() - Line->Deadline;
+			if (Lateness > 0.0)
+			{
+				UE_LOG(LogRuntimeSpeechToFace, Warning, TEXT("%s: animation for %s was ready %.2f s after its deadline"), *GetName(), *SoundWavePath.ToString(), Lateness);
+			}
+			OnLineReady.Broadcast(SoundWave, Anim);
+		}
+		else
+		{
+			Line->bFailed = true;
+			UE_LOG(LogRuntimeSpeechToFace, Warning, TEXT("%s: %s"), *SoundWavePath.ToString(), *Reason);
+			OnLineFailed.Broadcast(SoundWave, Reason);
+		}
+	}
+
+	LaunchNext();
+}
+
+void URuntimeSpeechToFaceDialoguePrefetch::LaunchNext()
+{
+	// Requests failing as they activate complete from within this loop
+	if (bLaunching)
+	{
+		return;
+	}
+	TGuardValue<bool> LaunchingGuard(bLaunching, true);
+
+	const int32 MaxConcurrentLines = FMath::Max(GetDefault<URuntimeSpeechToFaceSettings>()->PrefetchMaxConcurrentLines, 1);
+	for (;;)
+	{
+		int32 NumRunning = 0;
+		for (const FRuntimeSpeechToFacePrefetchEntry& Line : Lines)
+		{
+			NumRunning += Line.Request != nullptr;
+		}
+		if (NumRunning >= MaxConcurrentLines)
+		{
+			return;
+		}
+
+		// A line still loading does not hold back the loaded ones after it, the inference threads would sit idle
+		FRuntimeSpeechToFacePrefetchEntry* Line = Lines.FindByPredicate([](const FRuntimeSpeechToFacePrefetchEntry& Entry) { return Entry.SoundWave && !Entry.Request && !Entry.Animation && !Entry.bFailed; });
+		if (!Line)
+		{
+			return;
+		}
+
+		// Prefetched lines have time to spare, so they keep the requested quality whatever the latency of other requests
+		URuntimeSpeechToFaceAsync* Request = URuntimeSpeechToFaceAsync::SpeechToFaceAnim(WorldContext.Get(), Line->SoundWave, nullptr, Line->Mood, Line->MoodIntensity, bGenerateBlinks, bGenerateHeadAnimation, QualityTier, false);
+		Request->OnFinishedNative.BindUObject(this, &URuntimeSpeechToFaceDialoguePrefetch::OnLineGenerated, Line->SoundWavePath, Line->Serial);
+		Line->Request = Request;
+		Request->Activate();
+	}
+}
@@ -0,0 +1,328 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#include "RuntimeSpeechToFaceLiveSession.h"
+#include "AudioDevice.h"
+#include "AudioDeviceManager.h"
+#include "DSP/Dsp.h"
+#include "Engine/Engine.h"
+#include "Engine/World.h"
+#include "ISubmixBufferListener.h"
+#include "RuntimeAnimation.h"
+#include "RuntimeSpeechToFace.h"
+#include "RuntimeSpeechToFaceSettings.h"
+#include "Sound/SoundSubmix.h"
+#include "SpeechToFacePipeline.h"
+#include "Tasks/Task.h"
+
+// Four seconds at 48 kHz, the game thread drains the queue every frame
+static constexpr int32 LiveQueueCapacity = 48000 * 4;
+
+/** Captured audio and what inference on it needs, outliving the session while a chunk or the audio device holds it */
+struct FSpeechToFaceLiveState
+{
+	// Mono samples, pushed by a single producer (the audio render thread or the PushAudio caller) and popped on the game thread
+	Audio::TCircularAudioBuffer<float> Queue;
+	std::atomic<int32> SampleRate = 0;
+
+	// Producer only
+	TArray<float> DownmixBuffer;
+
+	TSharedPtr<FSpeechToFaceModels> Models;
+	FName QualityTier;
+	FSpeechToFaceParams Params;
+
+	// Used by one chunk at a time
+	FSpeechToFaceModelInstances Instances;
+
+	void PushAudio(const float* Samples, int32 NumFrames, int32 NumChannels, int32 InSampleRate)
+	{
+		if (NumFrames <= 0 || NumChannels <= 0)
+		{
+			return;
+		}
+
+		const float* MonoSamples = Samples;
+		if (NumChannels > 1)
+		{
+			DownmixBuffer.SetNumUninitialized(NumFrames, EAllowShrinking::No);
+			const float Scale = 1.0f / NumChannels;
+			for (int32 FrameIndex = 0; FrameIndex < NumFrames; ++FrameIndex)
+			{
+				float Sum = 0.0f;
+				for (int32 Channel = 0; Channel < NumChannels; ++Channel)
+				{
+					Sum += Samples[FrameIndex * NumChannels + Channel];
+				}
+				DownmixBuffer[FrameIndex] = Sum * Scale;
+			}
+			MonoSamples = DownmixBuffer.GetData();
+		}
+
+		SampleRate.store(InSampleRate, std::memory_order_relaxed);
+
+		// A full queue means the game thread is stalled, the audio that does not fit is dropped
+		Queue.Push(MonoSamples, NumFrames);
+	}
+};
+
+/** One chunk of new audio with the audio before it, and the curves generated for the new part */
+struct FSpeechToFaceLiveChunk
+{
+	TSharedPtr<FSpeechToFaceLiveState, ESPMode::ThreadSafe> State;
+
+	FSpeechAudioData Audio;
+
+	// Duration of the new audio at the end of Audio
+	float NewDuration = 0.0f;
+
+	TArray<FFloatCurve> Curves;
+	float AnimationDuration = 0.0f;
+
+	FString Error;
+};
+
+class FSpeechToFaceSubmixListener : public ISubmixBufferListener
+{
+public:
+	explicit FSpeechToFaceSubmixListener(const TSharedRef<FSpeechToFaceLiveState, ESPMode::ThreadSafe>& InState)
+		: State(InState)
+	{
+	}
+
+	virtual void OnNewSubmixBuffer(const USoundSubmix* OwningSubmix, float* AudioData, int32 NumSamples, int32 NumChannels, const int32 SampleRate, double AudioClock) override
+	{
+		State->PushAudio(AudioData, NumChannels > 0 ? NumSamples / NumChannels : 0, NumChannels, SampleRate);
+	}
+
+	virtual const FString& GetListenerName() const override
+	{
+		static const FString ListenerName(TEXT("RuntimeSpeechToFaceLiveSession"));
+		return ListenerName;
+	}
+
+private:
+	TSharedRef<FSpeechToFaceLiveState, ESPMode::ThreadSafe> State;
+};
+
+static void RunChunk(FSpeechToFaceLiveChunk& Chunk)
+{
+	FSpeechToFaceLiveState& State = *Chunk.State;
+	if (!State.Instances.IsValid())
+	{
+		State.Instances = State.Models->CreateInstances();
+		if (!State.Instances.IsValid())
+		{
+			Chunk.Error = TEXT("RuntimeSpeechToFaceLiveSession: Failed to create model instances.");
+			return;
+		}
+	}
+
+	FSpeechToFaceAnimationData AnimationData;
+	if (!SpeechToFacePipeline::GenerateAnimation(State.Instances, Chunk.Audio, State.Params, AnimationData, Chunk.Error))
+	{
+		return;
+	}
+
+	// Only the frames of the new audio are kept, the ones before it were generated for context
+	const int32 NumCurves = AnimationData.CurveNames.Num();
+	const int32 NumFrames = AnimationData.GetNumFrames();
+	const int32 NumChunkFrames = FMath::Min(NumFrames, FMath::CeilToInt32(Chunk.NewDuration * AnimationData.FrameRate));
+	if (NumChunkFrames <= 0)
+	{
+		Chunk.Error = TEXT("RuntimeSpeechToFaceLiveSession: No frames generated.");
+		return;
+	}
+
+	FSpeechToFaceAnimationData ChunkData;
+	ChunkData.CurveNames = MoveTemp(AnimationData.CurveNames);
+	ChunkData.FrameRate = AnimationData.FrameRate;
+	ChunkData.Values.Reserve(NumChunkFrames * 2 * NumCurves);
+	ChunkData.Values.Append(&AnimationData.Values[(NumFrames - NumChunkFrames) * NumCurves], NumChunkFrames * NumCurves);
+
+	// The last frame is held for another chunk, so a late chunk does not drop the face back to neutral
+	const int32 LastFrameOffset = (NumChunkFrames - 1) * NumCurves;
+	for (int32 FrameIndex = 0; FrameIndex < NumChunkFrames; ++FrameIndex)
+	{
+		for (int32 CurveIndex = 0; CurveIndex < NumCurves; ++CurveIndex)
+		{
+			ChunkData.Values.Add(ChunkData.Values[LastFrameOffset + CurveIndex]);
+		}
+	}
+
+	ChunkData.BuildCurves(Chunk.Curves);
+	Chunk.AnimationDuration = (ChunkData.GetNumFrames() - 1) / ChunkData.FrameRate;
+}
+
+URuntimeSpeechToFaceLiveSession* URuntimeSpeechToFaceLiveSession::StartLiveSession(UObject* WorldContextObject, USoundSubmix* Submix, bool bCaptureSubmix, EAudioDrivenAnimationMood Mood, float MoodIntensity, FName QualityTier)
+{
+	TSharedPtr<FSpeechToFaceModels> Models = FSpeechToFaceModels::Load(QualityTier);
+	if (!Models)
+	{
+		UE_LOG(LogRuntimeSpeechToFace, Error, TEXT("Failed to start live session, the models did not load"));
+		return nullptr;
+	}
+
+	URuntimeSpeechToFaceLiveSession* Session = NewObject<URuntimeSpeechToFaceLiveSession>();
+	TSharedRef<FSpeechToFaceLiveState, ESPMode::ThreadSafe> State = MakeShared<FSpeechToFaceLiveState, ESPMode::ThreadSafe>();
+	State->Queue.SetCapacity(LiveQueueCapacity);
+	State->Models = Models;
+	State->QualityTier = QualityTier;
+	State->Params.Mood = Mood;
+	State->Params.MoodIntensity = MoodIntensity;
+	Session->State = State;
+
+	if (bCaptureSubmix)
+	{
+		UWorld* World = GEngine ? GEngine->GetWorldFromContextObject(WorldContextObject, EGetWorldErrorMode::LogAndReturnNull) : nullptr;
+		FAudioDeviceHandle AudioDevice = World ? World->GetAudioDevice() : FAudioDeviceHandle();
+		if (!AudioDevice.IsValid())
+		{
+			UE_LOG(LogRuntimeSpeechToFace, Warning, TEXT("Live session has no audio device to capture, only pushed audio is animated"));
+		}
+		else
+		{
+			USoundSubmix& CapturedSubmix = Submix ? *Submix : AudioDevice->GetMainSubmixObject();
+			Session->Listener = MakeShared<FSpeechToFaceSubmixListener, ESPMode::ThreadSafe>(State);
+			Session->CapturedSubmix = &CapturedSubmix;
+			Session->AudioDeviceId = AudioDevice.GetDeviceID();
+			AudioDevice->RegisterSubmixBufferListener(Session->Listener.ToSharedRef(), CapturedSubmix);
+		}
+	}
+
+	Session->TickerHandle = FTSTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateUObject(Session, &URuntimeSpeechToFaceLiveSession::Tick));
+	return Session;
+}
+
+void URuntimeSpeechToFaceLiveSession::Stop()
+{
+	if (Listener)
+	{
+		FAudioDeviceManager* AudioDeviceManager = GEngine ? GEngine->GetAudioDeviceManager() : nullptr;
+		FAudioDevice* AudioDevice = AudioDeviceManager ? AudioDeviceManager->GetAudioDeviceRaw(AudioDeviceId) : nullptr;
+		if (AudioDevice && CapturedSubmix.IsValid())
+		{
+			AudioDevice->UnregisterSubmixBufferListener(Listener.ToSharedRef(), *CapturedSubmix);
+		}
+		Listener.Reset();
+	}
+	if (TickerHandle.IsValid())
+	{
+		FTSTicker::GetCoreTicker().RemoveTicker(TickerHandle);
+		TickerHandle.Reset();
+	}
+}
+
+void URuntimeSpeechToFaceLiveSession::PushAudio(const float* Samples, int32 NumFrames, int32 NumChannels, int32 SampleRate)
+{
+	if (State && !Listener)
+	{
+		State->PushAudio(Samples, NumFrames, NumChannels, SampleRate);
+	}
+}
+
+void URuntimeSpeechToFaceLiveSession::BeginDestroy()
+{
+	Stop();
+	Super::BeginDestroy();
+}
+
+bool URuntimeSpeechToFaceLiveSession::Tick(float DeltaTime)
+{
+	const int32 SampleRate = State->SampleRate.load(std::memory_order_relaxed);
+	const int32 NumQueued = static_cast<int32>(State->Queue.Num());
+	if (NumQueued == 0 || SampleRate <= 0)
+	{
+		return true;
+	}
+
+	if (SampleRate != HistorySampleRate)
+	{
+		History.Reset();
+		NumNewSamples = 0;
+		HistorySampleRate = SampleRate;
+	}
+
+	const int32 Offset = History.AddUninitialized(NumQueued);
+	const int32 NumPopped = State->Queue.Pop(&History[Offset], NumQueued);
+	History.SetNum(Offset + NumPopped, EAllowShrinking::No);
+	NumNewSamples += NumPopped;
+
+	const URuntimeSpeechToFaceSettings* Settings = GetDefault<URuntimeSpeechToFaceSettings>();
+
+	// When inference falls behind, the oldest waiting audio only serves as context, so the face catches up with the voice
+	const int32 MaxNewSamples = FMath::CeilToInt32(FMath::Max(Settings->LiveMaxLatency, Settings->LiveChunkDuration) * SampleRate);
+	if (NumNewSamples > MaxNewSamples)
+	{
+		UE_LOG(LogRuntimeSpeechToFace, Verbose, TEXT("%s: skipping %.2f s of audio to stay within the latency bound"), *GetName(), static_cast<float>(NumNewSamples - MaxNewSamples) / SampleRate);
+		NumNewSamples = MaxNewSamples;
+	}
+
+	// Only the context of the next chunk is kept, trimmed in batches to avoid moving the buffer every frame
+	const int32 NumUsableSamples = FMath::CeilToInt32(Settings->LiveContextDuration * SampleRate) + NumNewSamples;
+	if (History.Num() > NumUsableSamples * 2)
+	{
+		History.RemoveAt(0, History.Num() - NumUsableSamples, EAllowShrinking::No);
+	}
+
+	if (!bChunkRunning && NumNewSamples >= FMath::CeilToInt32(Settings->LiveChunkDuration * SampleRate))
+	{
+		LaunchChunk();
+	}
+	return true;
+}
+
+void URuntimeSpeechToFaceLiveSession::LaunchChunk()
+{
+	const URuntimeSpeechToFaceSettings* Settings = GetDefault<URuntimeSpeechToFaceSettings>();
+	const int32 NumWindowSamples = FMath::Min(History.Num(), FMath::CeilToInt32(Settings->LiveContextDuration * HistorySampleRate) + NumNewSamples);
+
+	TSharedRef<FSpeechToFaceLiveChunk> Chunk = MakeShared<FSpeechToFaceLiveChunk>();
+	Chunk->State = State;
+	Chunk->Audio.SampleFormat = ESpeechSampleFormat::Float32;
+	Chunk->Audio.SampleRate = HistorySampleRate;
+	Chunk->Audio.NumChannels = 1;
+	Chunk->Audio.Name = GetName();
+	Chunk->Audio.PCMData.Append(reinterpret_cast<const uint8*>(&History[History.Num() - NumWindowSamples]), NumWindowSamples * sizeof(float));
+	Chunk->NewDuration = static_cast<float>(NumNewSamples) / HistorySampleRate;
+	NumNewSamples = 0;
+	bChunkRunning = true;
+
+	UE::Tasks::FTaskEvent InferenceDone(TEXT("SpeechToFaceLiveInference"));
+	SpeechToFacePipeline::LaunchInference([Chunk, InferenceDone]() mutable
+		{
+			RunChunk(*Chunk);
+			InferenceDone.Trigger();
+		},
+		[Chunk, InferenceDone]() mutable
+		{
+			Chunk->Error = TEXT("RuntimeSpeechToFaceLiveSession: Inference was shut down before the chunk ran.");
+			InferenceDone.Trigger();
+		});
+
+	UE::Tasks::Launch(TEXT("SpeechToFaceLiveComplete"), [WeakThis = TWeakObjectPtr<URuntimeSpeechToFaceLiveSession>(this), Chunk]()
+		{
+			if (URuntimeSpeechToFaceLiveSession* This = WeakThis.Get())
+			{
+				This->CompleteChunk(*Chunk);
+			}
+		}, UE::Tasks::Prerequisites(InferenceDone), UE::Tasks::ETaskPriority::Normal, UE::Tasks::EExtendedTaskPriority::GameThreadNormalPri);
+}
+
+void URuntimeSpeechToFaceLiveSession::CompleteChunk(FSpeechToFaceLiveChunk& Chunk)
+{
+	bChunkRunning = false;
+	if (!Chunk.Error.IsEmpty())
+	{
+		UE_LOG(LogRuntimeSpeechToFace, Warning, TEXT("%s: %s"), *GetName(), *Chunk.Error);
+		return;
+	}
+
+	URuntimeAnimation* ChunkAnimation = NewObject<URuntimeAnimation>(this);
+	ChunkAnimation->Duration = Chunk.AnimationDuration;
+	ChunkAnimation->QualityTier = State->QualityTier;
+	ChunkAnimation->FloatCurves = MoveTemp(Chunk.Curves);
+	ChunkAnimation->BuildLODCurveSets();
+
+	Animation = ChunkAnimation;
+	OnAnimationUpdated.Broadcast(ChunkAnimation);
+}
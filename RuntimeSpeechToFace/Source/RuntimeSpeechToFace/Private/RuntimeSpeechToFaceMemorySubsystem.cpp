@@ -0,0 +1,200 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#include "RuntimeSpeechToFaceMemorySubsystem.h"
+#include "RuntimeAnimation.h"
+#include "RuntimeSpeechToFace.h"
+#include "RuntimeSpeechToFaceSettings.h"
+#include "SpeechSoundGenerator.h"
+#include "SpeechSoundWave.h"
+#include "UObject/ObjectKey.h"
+
+// Seconds between budget checks
+static constexpr float BudgetCheckInterval = 1.0f;
+
+// Objects created since the last budget check, they can be created on any thread
+static FCriticalSection PendingObjectsLock;
+static TArray<TWeakObjectPtr<UObject>> PendingObjects;
+
+// Pin counts of the objects that must keep their data, only touched on the game thread
+static TMap<FObjectKey, int32> PinnedObjects;
+
+static bool IsBudgetEnabled()
+{
+	return GetDefault<URuntimeSpeechToFaceSettings>()->MemoryBudget > 0;
+}
+
+bool URuntimeSpeechToFaceMemorySubsystem::ShouldCreateSubsystem(UObject* Outer) const
+{
+	return IsBudgetEnabled();
+}
+
+void URuntimeSpeechToFaceMemorySubsystem::Initialize(FSubsystemCollectionBase& Collection)
+{
+	Super::Initialize(Collection);
+	TickerHandle = FTSTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateUObject(this, &URuntimeSpeechToFaceMemorySubsystem::EnforceBudget), BudgetCheckInterval);
+}
+
+void URuntimeSpeechToFaceMemorySubsystem::Deinitialize()
+{
+	FTSTicker::GetCoreTicker().RemoveTicker(TickerHandle);
+	TrackedObjects.Empty();
+	{
+		FScopeLock Lock(&PendingObjectsLock);
+		PendingObjects.Empty();
+	}
+	Super::Deinitialize();
+}
+
+void URuntimeSpeechToFaceMemorySubsystem::Track(UObject* Object)
+{
+	if (IsBudgetEnabled())
+	{
+		FScopeLock Lock(&PendingObjectsLock);
+		PendingObjects.Add(Object);
+	}
+}
+
+void URuntimeSpeechToFaceMemorySubsystem::Pin(UObject* Object)
+{
+	check(IsInGameThread());
+	if (Object)
+	{
+		++PinnedObjects.FindOrAdd(FObjectKey(Object));
+	}
+}
+
+void URuntimeSpeechToFaceMemorySubsystem::Unpin(UObject* Object)
+{
+	check(IsInGameThread());
+	const FObjectKey Key(Object);
+	if (int32* PinCount = PinnedObjects.Find(Key))
+	{
+		if (--*PinCount <= 0)
+		{
+			PinnedObjects.Remove(Key);
+		}
+	}
+}
+
+void URuntimeSpeechToFaceMemorySubsystem::GetMemoryUsage(int64& OutAudioBytes, int64& OutAnimationBytes) const
+{
+	OutAudioBytes = 0;
+	OutAnimationBytes = 0;
+	for (const FTrackedObject& Tracked : TrackedObjects)
+	{
+		if (const USpeechSoundWave* SoundWave = Cast<USpeechSoundWave>(Tracked.Object.Get()))
+		{
+			OutAudioBytes += SoundWave->GetAudioMemorySize();
+		}
+		else if (const URuntimeAnimation* Animation = Cast<URuntimeAnimation>(Tracked.Object.Get()))
+		{
+			OutAnimationBytes += Animation->GetCurveMemorySize();
+		}
+	}
+}
+
+bool URuntimeSpeechToFaceMemorySubsystem::EnforceBudget(float DeltaTime)
+{
+	const URuntimeSpeechToFaceSettings* Settings = GetDefault<URuntimeSpeechToFaceSettings>();
+	const double Now = FPlatformTime::Seconds();
+
+	{
+		FScopeLock Lock(&PendingObjectsLock);
+		for (const TWeakObjectPtr<UObject>& Object : PendingObjects)
+		{
+			FTrackedObject& Tracked = TrackedObjects.AddDefaulted_GetRef();
+			Tracked.Object = Object;
+			Tracked.LastPlayedTime = Now;
+		}
+		PendingObjects.Reset();
+	}
+
+	// Refresh when each object last played and what it takes
+	int64 TotalSize = 0;
+	for (int32 TrackedIndex = TrackedObjects.Num() - 1; TrackedIndex >= 0; --TrackedIndex)
+	{
+		FTrackedObject& Tracked = TrackedObjects[TrackedIndex];
+		UObject* Object = Tracked.Object.Get();
+		if (const USpeechSoundWave* SoundWave = Cast<USpeechSoundWave>(Object))
+		{
+			// Stamped by the audio render thread for every block a voice renders
+			Tracked.LastPlayedTime = FMath::Max(Tracked.LastPlayedTime, SoundWave->GetPlaybackState()->PlaybackPublishTime.load(std::memory_order_relaxed));
+			Tracked.Size = SoundWave->GetAudioMemorySize();
+		}
+		else if (const URuntimeAnimation* Animation = Cast<URuntimeAnimation>(Object))
+		{
+			const uint64 LastPlayedFrame = Animation->LastPlayedFrame;
+			if (LastPlayedFrame != Tracked.LastPlayedFrame)
+			{
+				Tracked.LastPlayedFrame = LastPlayedFrame;
+				Tracked.LastPlayedTime = Now;
+			}
+			Tracked.Size = Animation->GetCurveMemorySize();
+		}
+		else
+		{
+			TrackedObjects.RemoveAtSwap(TrackedIndex, 1, EAllowShrinking::No);
+			continue;
+		}
+		TotalSize += Tracked.Size;
+	}
+
+	const int64 Budget = static_cast<int64>(Settings->MemoryBudget) * 1024 * 1024;
+	if (TotalSize <= Budget)
+	{
+		return true;
+	}
+
+	TrackedObjects.Sort([](const FTrackedObject& A, const FTrackedObject& B) { return A.LastPlayedTime < B.LastPlayedTime; });
+
+	// Compressed animations still play, so every animation not played in the last frames is compressed before anything is released
+	for (FTrackedObject& Tracked : TrackedObjects)
+	{
+		URuntimeAnimation* Animation = Cast<URuntimeAnimation>(Tracked.Object.Get());
+		if (Animation && !Animation->IsCompressed() && Animation->LastPlayedFrame + 2 < GFrameCounter)
+		{
+			Animation->Compress(Settings->CompressionSettings);
+			const int64 CompressedSize = Animation->GetCurveMemorySize();
+			TotalSize -= Tracked.Size - CompressedSize;
+			Tracked.Size = CompressedSize;
+			if (TotalSize <= Budget)
+			{
+				return true;
+			}
+		}
+	}
+
+	for (FTrackedObject& Tracked : TrackedObjects)
+	{
+		if (TotalSize <= Budget)
+		{
+			break;
+		}
+		UObject* Object = Tracked.Object.Get();
+		if (Tracked.Size == 0 || Now - Tracked.LastPlayedTime < Settings->MinIdleTimeBeforeRelease || PinnedObjects.Contains(FObjectKey(Object)))
+		{
+			continue;
+		}
+
+		if (USpeechSoundWave* SoundWave = Cast<USpeechSoundWave>(Object))
+		{
+			if (!SoundWave->ReleaseAudio())
+			{
+				continue;
+			}
+		}
+		else if (URuntimeAnimation* Animation = Cast<URuntimeAnimation>(Object))
+		{
+			Animation->ReleaseCurves();
+		}
+		TotalSize -= Tracked.Size;
+		Tracked.Size = 0;
+		OnReleased.Broadcast(Object);
+	}
+
+	if (TotalSize > Budget)
+	{
+		UE_LOG(LogRuntimeSpeechToFace, Verbose, TEXT("Speech to face memory is %.1f MB over budget, everything left has played recently"), (TotalSize - Budget) / (1024.0 * 1024.0));
+	}
+	return true;
+}
@@ -5,3 +5,22 @@ URuntimeSpeechToFaceSettings::URuntimeSpeechToFaceSettings()
 	AudioEncoder = TEXT("/MetaHuman/Speech2Face/NNE_AudioDrivenAnimation_AudioEncoder.NNE_AudioDrivenAnimation_AudioEncoder");
 	AnimationDecoder = TEXT("/MetaHuman/Speech2Face/NNE_AudioDrivenAnimation_AnimationDecoder.NNE_AudioDrivenAnimation_AnimationDecoder");
 }
+
+bool URuntimeSpeechToFaceSettings::GetQualityTierModels(FName QualityTier, FSoftObjectPath& OutAudioEncoder, FSoftObjectPath& OutAnimationDecoder) const
+{
+	if (QualityTier.IsNone())
+	{
+		OutAudioEncoder = AudioEncoder;
+		OutAnimationDecoder = AnimationDecoder;
+		return true;
+	}
+
+	const FRuntimeSpeechToFaceQualityTier* Tier = QualityTiers.FindByPredicate([QualityTier](const FRuntimeSpeechToFaceQualityTier& Tier) { return Tier.Name == QualityTier; });
+	if (!Tier)
+	{
+		return false;
+	}
+	OutAudioEncoder = Tier->AudioEncoder;
+	OutAnimationDecoder = Tier->AnimationDecoder;
+	return true;
+}
@@ -0,0 +1,431 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#include "RuntimeSpeechToFaceStreamComponent.h"
+#include "Engine/World.h"
+#include "GameFramework/Actor.h"
+#include "Misc/Compression.h"
+#include "RuntimeAnimation.h"
+#include "RuntimeSpeechToFace.h"
+#include "RuntimeSpeechToFaceSettings.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
+
+static void WriteVarUInt(TArray<uint8>& Data, uint32 Value)
+{
+	while (Value >= 0x80)
+	{
+		Data.Add(static_cast<uint8>(Value) | 0x80);
+		Value >>= 7;
+	}
+	Data.Add(static_cast<uint8>(Value));
+}
+
+static bool ReadVarUInt(const TArray<uint8>& Data, int32& Offset, uint32& OutValue)
+{
+	OutValue = 0;
+	for (int32 Shift = 0; Shift < 32; Shift += 7)
+	{
+		if (Offset >= Data.Num())
+		{
+			return false;
+		}
+		const uint8 Byte = Data[Offset++];
+		OutValue |= static_cast<uint32>(Byte & 0x7F) << Shift;
+		if ((Byte & 0x80) == 0)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+// Curve names and ranges of a few hundred curves take a few KB, anything much larger is not a real stream
+static constexpr int32 MaxStreamCurveDataSize = 1024 * 1024;
+
+// Same as the ClampMax of URuntimeSpeechToFaceSettings::StreamFrameRate
+static constexpr float MaxStreamFrameRate = 60.0f;
+
+static int32 GetMaxStreamFrames(float Duration, float FrameRate)
+{
+	return FMath::FloorToInt32(Duration * FrameRate) + 1;
+}
+
+// Array counts come from the sender, so each is checked against the bytes left before anything is allocated for it
+static bool ReadCurveData(const TArray<uint8>& CurveData, TArray<FString>& OutCurveNames, TArray<float>& OutRangeMin, TArray<float>& OutRangeExtent)
+{
+	FMemoryReader Reader(CurveData);
+	Reader.ArMaxSerializeSize = CurveData.Num();
+
+	// Every name takes at least the four bytes of its length
+	int32 NumCurves = 0;
+	Reader << NumCurves;
+	if (Reader.IsError() || NumCurves <= 0 || NumCurves > (Reader.TotalSize() - Reader.Tell()) / static_cast<int64>(sizeof(int32)))
+	{
+		return false;
+	}
+	OutCurveNames.SetNum(NumCurves);
+	for (FString& CurveName : OutCurveNames)
+	{
+		Reader << CurveName;
+		if (Reader.IsError())
+		{
+			return false;
+		}
+	}
+
+	for (TArray<float>* Values : { &OutRangeMin, &OutRangeExtent })
+	{
+		int32 NumValues = 0;
+		Reader << NumValues;
+		if (Reader.IsError() || NumValues != NumCurves || NumValues > (Reader.TotalSize() - Reader.Tell()) / static_cast<int64>(sizeof(float)))
+		{
+			return false;
+		}
+		Values->SetNumUninitialized(NumValues);
+		for (float& Value : *Values)
+		{
+			Reader << Value;
+		}
+	}
+	return !Reader.IsError();
+}
+
+URuntimeSpeechToFaceStreamComponent::URuntimeSpeechToFaceStreamComponent()
+{
+	PrimaryComponentTick.bCanEverTick = true;
+	PrimaryComponentTick.bStartWithTickEnabled = false;
+	SetIsReplicatedByDefault(true);
+}
+
+void URuntimeSpeechToFaceStreamComponent::StreamAnimation(URuntimeAnimation* InAnimation)
+{
+	const AActor* Owner = GetOwner();
+	if (!InAnimation || !Owner)
+	{
+		return;
+	}
+	if (!Owner->HasAuthority() && !Owner->GetNetConnection())
+	{
+		UE_LOG(LogRuntimeSpeechToFace, Warning, TEXT("%s: animations can only be streamed from the server or the owning client"), *GetPathName());
+		return;
+	}
+
+	const URuntimeSpeechToFaceSettings* Settings = GetDefault<URuntimeSpeechToFaceSettings>();
+	if (InAnimation->Duration > Settings->StreamMaxDuration)
+	{
+		UE_LOG(LogRuntimeSpeechToFace, Warning, TEXT("%s: animation is longer than the stream limit of %.0f s, not streaming it"), *GetPathName(), Settings->StreamMaxDuration);
+		return;
+	}
+
+	Animation = InAnimation;
+	NumCurves = InAnimation->GetNumCurves();
+	bIsSource = true;
+	NextStreamId = NextStreamId % 0x7FFF + 1;
+	SourceStreamId = static_cast<uint16>(NextStreamId << 1 | (Owner->HasAuthority() ? 0 : 1));
+	SourceFrameRate = FMath::Clamp(Settings->StreamFrameRate, 1.0f, MaxStreamFrameRate);
+	const int32 NumFrames = GetMaxStreamFrames(InAnimation->Duration, SourceFrameRate);
+
+	// Sample the whole animation up front, the ranges have to be known before the first frame is quantized
+	TArray<float> Values;
+	Values.SetNumUninitialized(NumFrames * NumCurves);
+	for (int32 FrameIndex = 0; FrameIndex < NumFrames; ++FrameIndex)
+	{
+		InAnimation->EvaluateAllCurves(FrameIndex / SourceFrameRate, TArrayView<float>(&Values[FrameIndex * NumCurves], NumCurves));
+	}
+
+	TArray<FString> CurveNames;
+	TArray<float> RangeMin;
+	TArray<float> RangeExtent;
+	CurveNames.SetNum(NumCurves);
+	RangeMin.SetNumUninitialized(NumCurves);
+	RangeExtent.SetNumUninitialized(NumCurves);
+	for (int32 CurveIndex = 0; CurveIndex < NumCurves; ++CurveIndex)
+	{
+		float MinValue = Values[CurveIndex];
+		float MaxValue = Values[CurveIndex];
+		for (int32 FrameIndex = 1; FrameIndex < NumFrames; ++FrameIndex)
+		{
+			MinValue = FMath::Min(MinValue, Values[FrameIndex * NumCurves + CurveIndex]);
+			MaxValue = FMath::Max(MaxValue, Values[FrameIndex * NumCurves + CurveIndex]);
+		}
+		CurveNames[CurveIndex] = InAnimation->GetCurveName(CurveIndex).ToString();
+		RangeMin[CurveIndex] = MinValue;
+		RangeExtent[CurveIndex] = MaxValue - MinValue;
+	}
+
+	SourceFrames.SetNumUninitialized(NumFrames * NumCurves);
+	for (int32 ValueIndex = 0; ValueIndex < Values.Num(); ++ValueIndex)
+	{
+		const int32 CurveIndex = ValueIndex % NumCurves;
+		const float Normalized = RangeExtent[CurveIndex] > UE_KINDA_SMALL_NUMBER ? (Values[ValueIndex] - RangeMin[CurveIndex]) / RangeExtent[CurveIndex] : 0.0f;
+		SourceFrames[ValueIndex] = static_cast<uint8>(FMath::Clamp(FMath::RoundToInt32(Normalized * 255.0f), 0, 255));
+	}
+	SentValues.Reset();
+	SentValues.SetNumZeroed(NumCurves);
+	NumSentFrames = 0;
+	SourceStartTime = GetWorld()->GetTimeSeconds();
+
+	FRuntimeSpeechToFaceStreamHeader Header;
+	Header.StreamId = SourceStreamId;
+	Header.Duration = InAnimation->Duration;
+	Header.FrameRate = SourceFrameRate;
+	Header.NumFrames = NumFrames;
+
+	TArray<uint8> CurveData;
+	FMemoryWriter Writer(CurveData);
+	Writer << CurveNames << RangeMin << RangeExtent;
+	Header.CurveDataSize = CurveData.Num();
+	int32 CompressedSize = FCompression::CompressMemoryBound(NAME_Zlib, CurveData.Num());
+	Header.CurveData.SetNumUninitialized(CompressedSize);
+	if (!FCompression::CompressMemory(NAME_Zlib, Header.CurveData.GetData(), CompressedSize, CurveData.GetData(), CurveData.Num()))
+	{
+		UE_LOG(LogRuntimeSpeechToFace, Error, TEXT("%s: failed to compress the curves of a streamed animation"), *GetPathName());
+		bIsSource = false;
+		return;
+	}
+	Header.CurveData.SetNum(CompressedSize);
+
+	if (Owner->HasAuthority())
+	{
+		MulticastBeginStream(Header);
+	}
+	else
+	{
+		ServerBeginStream(Header);
+	}
+	SetComponentTickEnabled(true);
+}
+
+void URuntimeSpeechToFaceStreamComponent::TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction)
+{
+	Super::TickComponent(DeltaTime, TickType, ThisTickFunction);
+
+	if (!bIsSource)
+	{
+		SetComponentTickEnabled(false);
+		return;
+	}
+
+	// Frames are sent a lead time ahead of playback and grouped into chunks, so each RPC carries several frames
+	const URuntimeSpeechToFaceSettings* Settings = GetDefault<URuntimeSpeechToFaceSettings>();
+	const int32 NumFrames = SourceFrames.Num() / FMath::Max(NumCurves, 1);
+	const double SendUntilTime = GetWorld()->GetTimeSeconds() - SourceStartTime + Settings->StreamLeadTime;
+	const int32 NumDueFrames = FMath::Min(FMath::FloorToInt32(SendUntilTime * SourceFrameRate) + 1, NumFrames) - NumSentFrames;
+	const int32 FramesPerChunk = FMath::Max(Settings->StreamFramesPerChunk, 1);
+	if (NumDueFrames >= FramesPerChunk || (NumDueFrames > 0 && NumSentFrames + NumDueFrames == NumFrames))
+	{
+		SendFrames(NumDueFrames);
+	}
+
+	if (NumSentFrames >= NumFrames)
+	{
+		bIsSource = false;
+		SourceFrames.Empty();
+		SetComponentTickEnabled(false);
+	}
+}
+
+void URuntimeSpeechToFaceStreamComponent::SendFrames(int32 NumFrames)
+{
+	FRuntimeSpeechToFaceStreamChunk Chunk;
+	Chunk.StreamId = SourceStreamId;
+	Chunk.FirstFrame = NumSentFrames;
+	Chunk.NumFrames = NumFrames;
+
+	// Per frame: the number of changed curves, then for each the gap to the previous changed curve and the zigzag coded delta
+	for (int32 FrameIndex = NumSentFrames; FrameIndex < NumSentFrames + NumFrames; ++FrameIndex)
+	{
+		const uint8* FrameValues = &SourceFrames[FrameIndex * NumCurves];
+		int32 NumChanged = 0;
+		for (int32 CurveIndex = 0; CurveIndex < NumCurves; ++CurveIndex)
+		{
+			NumChanged += FrameValues[CurveIndex] != SentValues[CurveIndex];
+		}
+		WriteVarUInt(Chunk.Data, NumChanged);
+
+		int32 PrevIndex = INDEX_NONE;
+		for (int32 CurveIndex = 0; CurveIndex < NumCurves; ++CurveIndex)
+		{
+			if (FrameValues[CurveIndex] != SentValues[CurveIndex])
+			{
+				const int32 Delta = FrameValues[CurveIndex] - SentValues[CurveIndex];
+				WriteVarUInt(Chunk.Data, CurveIndex - PrevIndex - 1);
+				WriteVarUInt(Chunk.Data, static_cast<uint32>((Delta << 1) ^ (Delta >> 31)));
+				SentValues[CurveIndex] = FrameValues[CurveIndex];
+				PrevIndex = CurveIndex;
+			}
+		}
+	}
+	NumSentFrames += NumFrames;
+
+	if (GetOwner()->HasAuthority())
+	{
+		MulticastStreamFrames(Chunk);
+	}
+	else
+	{
+		ServerStreamFrames(Chunk);
+	}
+}
+
+bool URuntimeSpeechToFaceStreamComponent::IsValidHeader(const FRuntimeSpeechToFaceStreamHeader& Header)
+{
+	const URuntimeSpeechToFaceSettings* Settings = GetDefault<URuntimeSpeechToFaceSettings>();
+	return Header.StreamId != 0
+		&& FMath::IsFinite(Header.Duration) && Header.Duration >= 0.0f && Header.Duration <= Settings->StreamMaxDuration
+		&& FMath::IsFinite(Header.FrameRate) && Header.FrameRate > 0.0f && Header.FrameRate <= MaxStreamFrameRate
+		&& Header.NumFrames > 0 && Header.NumFrames <= GetMaxStreamFrames(Header.Duration, Header.FrameRate)
+		&& Header.CurveDataSize > 0 && Header.CurveDataSize <= MaxStreamCurveDataSize
+		&& Header.CurveData.Num() > 0 && Header.CurveData.Num() <= FCompression::CompressMemoryBound(NAME_Zlib, Header.CurveDataSize);
+}
+
+bool URuntimeSpeechToFaceStreamComponent::IsValidChunk(const FRuntimeSpeechToFaceStreamChunk& Chunk)
+{
+	const URuntimeSpeechToFaceSettings* Settings = GetDefault<URuntimeSpeechToFaceSettings>();
+	const int32 MaxFrames = GetMaxStreamFrames(Settings->StreamMaxDuration, MaxStreamFrameRate);
+	return Chunk.StreamId != 0 && Chunk.FirstFrame >= 0 && Chunk.NumFrames > 0 && Chunk.FirstFrame < MaxFrames && Chunk.NumFrames <= MaxFrames - Chunk.FirstFrame;
+}
+
+bool URuntimeSpeechToFaceStreamComponent::ServerBeginStream_Validate(const FRuntimeSpeechToFaceStreamHeader& Header)
+{
+	// Only the owning client sends to the server, and its stream ids are odd
+	return (Header.StreamId & 1) != 0 && IsValidHeader(Header);
+}
+
+void URuntimeSpeechToFaceStreamComponent::ServerBeginStream_Implementation(const FRuntimeSpeechToFaceStreamHeader& Header)
+{
+	MulticastBeginStream(Header);
+}
+
+bool URuntimeSpeechToFaceStreamComponent::ServerStreamFrames_Validate(const FRuntimeSpeechToFaceStreamChunk& Chunk)
+{
+	return (Chunk.StreamId & 1) != 0 && IsValidChunk(Chunk);
+}
+
+void URuntimeSpeechToFaceStreamComponent::ServerStreamFrames_Implementation(const FRuntimeSpeechToFaceStreamChunk& Chunk)
+{
+	MulticastStreamFrames(Chunk);
+}
+
+void URuntimeSpeechToFaceStreamComponent::MulticastBeginStream_Implementation(const FRuntimeSpeechToFaceStreamHeader& Header)
+{
+	// The sender plays its own animation, and a dedicated server has no face to animate
+	if (Header.StreamId == SourceStreamId || GetNetMode() == NM_DedicatedServer)
+	{
+		return;
+	}
+
+	if (!IsValidHeader(Header))
+	{
+		UE_LOG(LogRuntimeSpeechToFace, Warning, TEXT("%s: ignoring invalid animation stream"), *GetPathName());
+		Animation = nullptr;
+		return;
+	}
+
+	TArray<uint8> CurveData;
+	CurveData.SetNumUninitialized(Header.CurveDataSize);
+	TArray<FString> CurveNames;
+	TArray<float> RangeMin;
+	TArray<float> RangeExtent;
+	if (!FCompression::UncompressMemory(NAME_Zlib, CurveData.GetData(), CurveData.Num(), Header.CurveData.GetData(), Header.CurveData.Num())
+		|| !ReadCurveData(CurveData, CurveNames, RangeMin, RangeExtent))
+	{
+		UE_LOG(LogRuntimeSpeechToFace, Warning, TEXT("%s: ignoring invalid animation stream"), *GetPathName());
+		Animation = nullptr;
+		return;
+	}
+
+	URuntimeAnimation* StreamedAnimation = NewObject<URuntimeAnimation>(this);
+	StreamedAnimation->Duration = Header.Duration;
+	StreamedAnimation->CompressedTracks.SetNum(CurveNames.Num());
+	for (int32 CurveIndex = 0; CurveIndex < CurveNames.Num(); ++CurveIndex)
+	{
+		FRuntimeAnimTrack& Track = StreamedAnimation->CompressedTracks[CurveIndex];
+		Track.CurveName = FName(*CurveNames[CurveIndex]);
+		Track.RangeMin = RangeMin[CurveIndex];
+		if (RangeExtent[CurveIndex] > UE_KINDA_SMALL_NUMBER)
+		{
+			// Allocated for the whole stream up front, so anim threads can read it while chunks are written
+			Track.Format = ERuntimeAnimTrackFormat::Quantized8;
+			Track.RangeExtent = RangeExtent[CurveIndex];
+			Track.SampleRate = Header.FrameRate;
+			Track.QuantizedData.SetNumZeroed(Header.NumFrames);
+		}
+	}
+	StreamedAnimation->BuildLODCurveSets();
+
+	Animation = StreamedAnimation;
+	NumCurves = CurveNames.Num();
+	ReceivedStreamId = Header.StreamId;
+	NumStreamFrames = Header.NumFrames;
+	ReceivedValues.Reset();
+	ReceivedValues.SetNumZeroed(NumCurves);
+	NumReceivedFrames = 0;
+
+	OnStreamStarted.Broadcast(StreamedAnimation);
+}
+
+void URuntimeSpeechToFaceStreamComponent::MulticastStreamFrames_Implementation(const FRuntimeSpeechToFaceStreamChunk& Chunk)
+{
+	if (Chunk.StreamId == SourceStreamId || !Animation || Chunk.StreamId != ReceivedStreamId || Chunk.FirstFrame != NumReceivedFrames)
+	{
+		return;
+	}
+	if (!IsValidChunk(Chunk) || Chunk.NumFrames > NumStreamFrames - NumReceivedFrames)
+	{
+		UE_LOG(LogRuntimeSpeechToFace, Warning, TEXT("%s: animation stream is corrupt"), *GetPathName());
+		Animation = nullptr;
+		return;
+	}
+
+	TArray<FRuntimeAnimTrack>& Tracks = Animation->CompressedTracks;
+	int32 Offset = 0;
+	for (int32 FrameIndex = Chunk.FirstFrame; FrameIndex < Chunk.FirstFrame + Chunk.NumFrames; ++FrameIndex)
+	{
+		uint32 NumChanged = 0;
+		if (!ReadVarUInt(Chunk.Data, Offset, NumChanged))
+		{
+			UE_LOG(LogRuntimeSpeechToFace, Warning, TEXT("%s: animation stream is corrupt"), *GetPathName());
+			Animation = nullptr;
+			return;
+		}
+
+		int32 CurveIndex = INDEX_NONE;
+		for (uint32 ChangeIndex = 0; ChangeIndex < NumChanged; ++ChangeIndex)
+		{
+			uint32 Gap = 0;
+			uint32 ZigZagDelta = 0;
+			if (!ReadVarUInt(Chunk.Data, Offset, Gap) || !ReadVarUInt(Chunk.Data, Offset, ZigZagDelta) || CurveIndex + static_cast<int64>(Gap) + 1 >= NumCurves)
+			{
+				UE_LOG(LogRuntimeSpeechToFace, Warning, TEXT("%s: animation stream is corrupt"), *GetPathName());
+				Animation = nullptr;
+				return;
+			}
+			CurveIndex += Gap + 1;
+			const int32 Delta = static_cast<int32>(ZigZagDelta >> 1) ^ -static_cast<int32>(ZigZagDelta & 1);
+			ReceivedValues[CurveIndex] = static_cast<uint8>(ReceivedValues[CurveIndex] + Delta);
+		}
+
+		for (int32 TrackIndex = 0; TrackIndex < NumCurves; ++TrackIndex)
+		{
+			FRuntimeAnimTrack& Track = Tracks[TrackIndex];
+			if (Track.Format == ERuntimeAnimTrackFormat::Quantized8 && Track.QuantizedData.IsValidIndex(FrameIndex))
+			{
+				Track.QuantizedData[FrameIndex] = ReceivedValues[TrackIndex];
+			}
+		}
+	}
+	NumReceivedFrames += Chunk.NumFrames;
+
+	// Frames that have not arrived yet hold the latest values, should playback catch up with the stream. Only the
+	// next couple of chunks are filled, so the work per chunk does not grow with the length of the stream.
+	const int32 NumFramesToFill = FMath::Min(2 * Chunk.NumFrames, NumStreamFrames - NumReceivedFrames);
+	for (int32 TrackIndex = 0; TrackIndex < NumCurves && NumFramesToFill > 0; ++TrackIndex)
+	{
+		FRuntimeAnimTrack& Track = Tracks[TrackIndex];
+		if (Track.Format == ERuntimeAnimTrackFormat::Quantized8 && NumReceivedFrames + NumFramesToFill <= Track.QuantizedData.Num())
+		{
+			FMemory::Memset(&Track.QuantizedData[NumReceivedFrames], ReceivedValues[TrackIndex], NumFramesToFill);
+		}
+	}
+}
@@ -0,0 +1,376 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#include "SpeechAudioBuffer.h"
+
+// Frames in an ADPCM block. Every block starts from a stored predictor, so any block decodes on its own.
+static constexpr int32 AdpcmBlockFrames = 1024;
+
+// Predictor and step index stored at the start of every channel of a block
+static constexpr int32 AdpcmChannelHeaderBytes = 4;
+
+static const int32 AdpcmStepTable[89] =
+{
+	7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45, 50, 55, 60, 66, 73, 80, 88, 97, 107, 118,
+	130, 143, 157, 173, 190, 209, 230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963, 1060,
+	1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484,
+	7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+static const int32 AdpcmIndexTable[16] = { -1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8 };
+
+struct FAdpcmChannelState
+{
+	int32 Predictor = 0;
+	int32 StepIndex = 0;
+};
+
+static int32 GetAdpcmBlockBytes(int32 NumFrames, int32 NumChannels)
+{
+	return NumChannels * (AdpcmChannelHeaderBytes + (NumFrames + 1) / 2);
+}
+
+static void StepAdpcm(uint8 Nibble, FAdpcmChannelState& State)
+{
+	const int32 Step = AdpcmStepTable[State.StepIndex];
+	int32 Delta = Step >> 3;
+	if (Nibble & 4)
+	{
+		Delta += Step;
+	}
+	if (Nibble & 2)
+	{
+		Delta += Step >> 1;
+	}
+	if (Nibble & 1)
+	{
+		Delta += Step >> 2;
+	}
+	State.Predictor = FMath::Clamp(State.Predictor + ((Nibble & 8) ? -Delta : Delta), -32768, 32767);
+	State.StepIndex = FMath::Clamp(State.StepIndex + AdpcmIndexTable[Nibble], 0, 88);
+}
+
+static uint8 EncodeAdpcmSample(int32 Sample, FAdpcmChannelState& State)
+{
+	const int32 Step = AdpcmStepTable[State.StepIndex];
+	int32 Diff = Sample - State.Predictor;
+	uint8 Nibble = 0;
+	if (Diff < 0)
+	{
+		Nibble = 8;
+		Diff = -Diff;
+	}
+	if (Diff >= Step)
+	{
+		Nibble |= 4;
+		Diff -= Step;
+	}
+	if (Diff >= Step >> 1)
+	{
+		Nibble |= 2;
+		Diff -= Step >> 1;
+	}
+	if (Diff >= Step >> 2)
+	{
+		Nibble |= 1;
+	}
+
+	// Track what the decoder will reconstruct, so the error does not accumulate
+	StepAdpcm(Nibble, State);
+	return Nibble;
+}
+
+static int32 ReadPcmSampleAsInt16(const uint8* SampleData, ESpeechSampleFormat Format)
+{
+	if (Format == ESpeechSampleFormat::Float32)
+	{
+		float Sample;
+		FMemory::Memcpy(&Sample, SampleData, sizeof(Sample));
+		return FMath::Clamp(FMath::RoundToInt32(Sample * 32768.0f), -32768, 32767);
+	}
+
+	int16 Sample;
+	FMemory::Memcpy(&Sample, SampleData, sizeof(Sample));
+	return Sample;
+}
+
+// Encode interleaved PCM data of whole frames into ADPCM blocks, every channel of a block stored one after the other
+static void EncodeAdpcm(const TArray<uint8>& PCMData, ESpeechSampleFormat Format, int32 NumChannels, TArray<uint8>& OutData)
+{
+	const int32 SampleSize = GetSpeechSampleByteSize(Format);
+	const int32 NumFrames = PCMData.Num() / (SampleSize * NumChannels);
+	const int32 NumFullBlocks = NumFrames / AdpcmBlockFrames;
+	const int32 LastBlockFrames = NumFrames % AdpcmBlockFrames;
+	OutData.SetNumZeroed(NumFullBlocks * GetAdpcmBlockBytes(AdpcmBlockFrames, NumChannels) + (LastBlockFrames > 0 ? GetAdpcmBlockBytes(LastBlockFrames, NumChannels) : 0));
+
+	// Chunks are encoded on their own, so each one starts from its first sample and a step fitting the change to its second,
+	// rather than ramping up from silence over its first samples. Later blocks carry on from the block before them.
+	TArray<FAdpcmChannelState, TInlineAllocator<8>> States;
+	States.SetNum(NumChannels);
+	for (int32 Channel = 0; Channel < NumChannels && NumFrames > 0; ++Channel)
+	{
+		const uint8* SamplePtr = PCMData.GetData() + Channel * SampleSize;
+		FAdpcmChannelState& State = States[Channel];
+		State.Predictor = ReadPcmSampleAsInt16(SamplePtr, Format);
+		if (NumFrames > 1)
+		{
+			const int32 FirstDelta = FMath::Abs(ReadPcmSampleAsInt16(SamplePtr + NumChannels * SampleSize, Format) - State.Predictor);
+			while (State.StepIndex < 88 && AdpcmStepTable[State.StepIndex] < FirstDelta)
+			{
+				++State.StepIndex;
+			}
+		}
+	}
+	uint8* OutPtr = OutData.GetData();
+	for (int32 FirstFrame = 0; FirstFrame < NumFrames; FirstFrame += AdpcmBlockFrames)
+	{
+		const int32 BlockFrames = FMath::Min(AdpcmBlockFrames, NumFrames - FirstFrame);
+		for (int32 Channel = 0; Channel < NumChannels; ++Channel)
+		{
+			FAdpcmChannelState& State = States[Channel];
+			const int16 Predictor = static_cast<int16>(State.Predictor);
+			FMemory::Memcpy(OutPtr, &Predictor, sizeof(Predictor));
+			OutPtr[2] = static_cast<uint8>(State.StepIndex);
+			OutPtr += AdpcmChannelHeaderBytes;
+
+			const uint8* SamplePtr = PCMData.GetData() + (static_cast<int64>(FirstFrame) * NumChannels + Channel) * SampleSize;
+			for (int32 FrameIndex = 0; FrameIndex < BlockFrames; ++FrameIndex)
+			{
+				const uint8 Nibble = EncodeAdpcmSample(ReadPcmSampleAsInt16(SamplePtr, Format), State);
+				OutPtr[FrameIndex >> 1] |= (FrameIndex & 1) ? Nibble << 4 : Nibble;
+				SamplePtr += NumChannels * SampleSize;
+			}
+			OutPtr += (BlockFrames + 1) / 2;
+		}
+	}
+}
+
+FSpeechAudioBuffer::~FSpeechAudioBuffer()
+{
+	FChunk* Chunk = Head.load(std::memory_order_acquire);
+	while (Chunk)
+	{
+		FChunk* Next = Chunk->Next.load(std::memory_order_relaxed);
+		delete Chunk;
+		Chunk = Next;
+	}
+}
+
+void FSpeechAudioBuffer::Append(TArray<uint8>&& PCMData)
+{
+	if (Storage == ESpeechAudioStorage::ADPCM)
+	{
+		// Only whole frames are encoded, a partial frame at the end of the data waits for the rest of its samples
+		if (PartialFrame.Num() > 0)
+		{
+			PartialFrame.Append(PCMData);
+			PCMData = MoveTemp(PartialFrame);
+		}
+		const int32 NumPartialBytes = PCMData.Num() % (GetSpeechSampleByteSize(SampleFormat) * NumChannels);
+		if (NumPartialBytes > 0)
+		{
+			PartialFrame.Append(PCMData.GetData() + PCMData.Num() - NumPartialBytes, NumPartialBytes);
+			PCMData.SetNum(PCMData.Num() - NumPartialBytes, EAllowShrinking::No);
+		}
+	}
+
+	if (PCMData.Num() == 0)
+	{
+		return;
+	}
+
+	FChunk* NewChunk = new FChunk();
+	NewChunk->NumBytes = PCMData.Num();
+	if (Storage == ESpeechAudioStorage::ADPCM)
+	{
+		EncodeAdpcm(PCMData, SampleFormat, NumChannels, NewChunk->Data);
+		NewChunk->bEncoded = true;
+	}
+	else
+	{
+		NewChunk->Data = MoveTemp(PCMData);
+	}
+	Publish(NewChunk);
+}
+
+void FSpeechAudioBuffer::Finish()
+{
+	// A partial frame left over is never completed, so it is kept as it is
+	if (PartialFrame.Num() > 0)
+	{
+		FChunk* NewChunk = new FChunk();
+		NewChunk->NumBytes = PartialFrame.Num();
+		NewChunk->Data = MoveTemp(PartialFrame);
+		Publish(NewChunk);
+	}
+
+	bFinished.store(true, std::memory_order_release);
+}
+
+void FSpeechAudioBuffer::Publish(FChunk* NewChunk)
+{
+	NewChunk->Offset = NumBytes.load(std::memory_order_relaxed);
+	StoredBytes.fetch_add(NewChunk->Data.Num(), std::memory_order_relaxed);
+
+	if (Tail)
+	{
+		Tail->Next.store(NewChunk, std::memory_order_release);
+	}
+	else
+	{
+		Head.store(NewChunk, std::memory_order_release);
+	}
+	Tail = NewChunk;
+
+	// Publish the bytes only once the chunk is linked, readers never look past NumBytes
+	NumBytes.store(NewChunk->Offset + NewChunk->NumBytes, std::memory_order_release);
+}
+
+TArray<uint8> FSpeechAudioBuffer::CopyData() const
+{
+	const int64 BytesAvailable = GetNumBytes();
+
+	TArray<uint8> Result;
+	Result.Reserve(BytesAvailable);
+	TArray<uint8> Block;
+	for (const FChunk* Chunk = Head.load(std::memory_order_acquire); Chunk && Result.Num() < BytesAvailable; Chunk = Chunk->Next.load(std::memory_order_acquire))
+	{
+		if (!Chunk->bEncoded)
+		{
+			Result.Append(Chunk->Data);
+			continue;
+		}
+
+		const int32 NumBlocks = FMath::DivideAndRoundUp(Chunk->NumBytes, GetBlockNumBytes());
+		for (int32 BlockIndex = 0; BlockIndex < NumBlocks; ++BlockIndex)
+		{
+			DecodeBlock(*Chunk, BlockIndex, Block);
+			Result.Append(Block);
+		}
+	}
+	return Result;
+}
+
+int32 FSpeechAudioBuffer::GetBlockNumBytes() const
+{
+	return AdpcmBlockFrames * NumChannels * GetSpeechSampleByteSize(SampleFormat);
+}
+
+void FSpeechAudioBuffer::DecodeBlock(const FChunk& Chunk, int32 BlockIndex, TArray<uint8>& OutData) const
+{
+	const int32 SampleSize = GetSpeechSampleByteSize(SampleFormat);
+	const int32 ChunkFrames = Chunk.NumBytes / (SampleSize * NumChannels);
+	const int32 BlockFrames = FMath::Min(AdpcmBlockFrames, ChunkFrames - BlockIndex * AdpcmBlockFrames);
+	OutData.SetNumUninitialized(BlockFrames * NumChannels * SampleSize, EAllowShrinking::No);
+
+	const uint8* InPtr = Chunk.Data.GetData() + BlockIndex * GetAdpcmBlockBytes(AdpcmBlockFrames, NumChannels);
+	for (int32 Channel = 0; Channel < NumChannels; ++Channel)
+	{
+		FAdpcmChannelState State;
+		int16 Predictor;
+		FMemory::Memcpy(&Predictor, InPtr, sizeof(Predictor));
+		State.Predictor = Predictor;
+		State.StepIndex = FMath::Min<int32>(InPtr[2], 88);
+		InPtr += AdpcmChannelHeaderBytes;
+
+		uint8* OutPtr = OutData.GetData() + Channel * SampleSize;
+		for (int32 FrameIndex = 0; FrameIndex < BlockFrames; ++FrameIndex)
+		{
+			const uint8 Nibble = (FrameIndex & 1) ? InPtr[FrameIndex >> 1] >> 4 : InPtr[FrameIndex >> 1] & 0xF;
+			StepAdpcm(Nibble, State);
+			if (SampleFormat == ESpeechSampleFormat::Float32)
+			{
+				const float Sample = State.Predictor / 32768.0f;
+				FMemory::Memcpy(OutPtr, &Sample, sizeof(Sample));
+			}
+			else
+			{
+				const int16 Sample = static_cast<int16>(State.Predictor);
+				FMemory::Memcpy(OutPtr, &Sample, sizeof(Sample));
+			}
+			OutPtr += NumChannels * SampleSize;
+		}
+		InPtr += (BlockFrames + 1) / 2;
+	}
+}
+
+void FSpeechAudioReader::SetBuffer(const TSharedPtr<const FSpeechAudioBuffer>& InBuffer)
+{
+	Buffer = InBuffer;
+	Chunk = nullptr;
+	Position = 0;
+	DecodedChunk = nullptr;
+	DecodedBlockIndex = INDEX_NONE;
+}
+
+int32 FSpeechAudioReader::Read(uint8* OutData, int32 NumBytes)
+{
+	if (!Buffer)
+	{
+		return 0;
+	}
+
+	const int64 BytesAvailable = Buffer->GetNumBytes() - Position;
+	int32 BytesToCopy = static_cast<int32>(FMath::Clamp<int64>(BytesAvailable, 0, NumBytes));
+	int32 BytesCopied = 0;
+
+	if (!Chunk && BytesToCopy > 0)
+	{
+		Chunk = Buffer->Head.load(std::memory_order_acquire);
+	}
+
+	while (BytesToCopy > 0)
+	{
+		// Everything up to NumBytes is linked, so the next chunk is always there when needed
+		while (Position >= Chunk->Offset + Chunk->NumBytes)
+		{
+			Chunk = Chunk->Next.load(std::memory_order_acquire);
+		}
+
+		const int32 ChunkOffset = static_cast<int32>(Position - Chunk->Offset);
+		int32 ChunkBytes = 0;
+		if (Chunk->bEncoded)
+		{
+			// Decode only the block under the read position, the next reads continue from it
+			const int32 BlockNumBytes = Buffer->GetBlockNumBytes();
+			const int32 BlockIndex = ChunkOffset / BlockNumBytes;
+			if (DecodedChunk != Chunk || DecodedBlockIndex != BlockIndex)
+			{
+				Buffer->DecodeBlock(*Chunk, BlockIndex, DecodedBlock);
+				DecodedChunk = Chunk;
+				DecodedBlockIndex = BlockIndex;
+			}
+
+			const int32 BlockOffset = ChunkOffset - BlockIndex * BlockNumBytes;
+			ChunkBytes = FMath::Min(BytesToCopy, DecodedBlock.Num() - BlockOffset);
+			FMemory::Memcpy(OutData + BytesCopied, DecodedBlock.GetData() + BlockOffset, ChunkBytes);
+		}
+		else
+		{
+			ChunkBytes = FMath::Min(BytesToCopy, Chunk->NumBytes - ChunkOffset);
+			FMemory::Memcpy(OutData + BytesCopied, Chunk->Data.GetData() + ChunkOffset, ChunkBytes);
+		}
+
+		BytesCopied += ChunkBytes;
+		BytesToCopy -= ChunkBytes;
+		Position += ChunkBytes;
+	}
+
+	return BytesCopied;
+}
+
+void FSpeechAudioReader::Seek(int64 ByteOffset)
+{
+	// Restart the chunk walk from the head on the next read
+	Chunk = nullptr;
+	Position = FMath::Max<int64>(ByteOffset, 0);
+}
+
+bool FSpeechAudioReader::IsStarving() const
+{
+	return Buffer && !Buffer->IsFinished() && Position >= Buffer->GetNumBytes();
+}
+
+bool FSpeechAudioReader::IsAtEnd() const
+{
+	return !Buffer || (Buffer->IsFinished() && Position >= Buffer->GetNumBytes());
+}
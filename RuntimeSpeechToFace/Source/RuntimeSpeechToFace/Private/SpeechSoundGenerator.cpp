@@ -0,0 +1,187 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#include "SpeechSoundGenerator.h"
+#include "DSP/FloatArrayMath.h"
+
+void FSpeechPlaybackState::PublishPlaybackFrame(uint64 VoiceId, uint32 Generation, int64 Frame, int32 BlockFrames, int32 SampleRate)
+{
+	const double Now = FPlatformTime::Seconds();
+	PlaybackPublishTime.store(Now, std::memory_order_relaxed);
+
+	uint64 ClockOwner = ClockVoiceId.load(std::memory_order_acquire);
+	if (ClockOwner != VoiceId && (ClockOwner != 0 || !ClockVoiceId.compare_exchange_strong(ClockOwner, VoiceId, std::memory_order_acq_rel)))
+	{
+		return;
+	}
+
+	const uint32 Sequence = ClockSequence.load(std::memory_order_relaxed);
+	ClockSequence.store(Sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	ClockGeneration.store(Generation, std::memory_order_relaxed);
+	ClockFrame.store(Frame, std::memory_order_relaxed);
+	ClockBlockFrames.store(BlockFrames, std::memory_order_relaxed);
+	ClockSampleRate.store(SampleRate, std::memory_order_relaxed);
+	ClockPublishTime.store(Now, std::memory_order_relaxed);
+	ClockSequence.store(Sequence + 2, std::memory_order_release);
+}
+
+void FSpeechPlaybackState::ReleasePlaybackClock(uint64 VoiceId)
+{
+	uint64 ClockOwner = VoiceId;
+	ClockVoiceId.compare_exchange_strong(ClockOwner, 0, std::memory_order_release, std::memory_order_relaxed);
+}
+
+bool FSpeechPlaybackState::GetPlaybackTime(double& OutSeconds) const
+{
+	// The clock voice writes once per callback, so a reader rarely has to retry more than once
+	for (int32 Attempt = 0; Attempt < 4; ++Attempt)
+	{
+		const uint32 Sequence = ClockSequence.load(std::memory_order_acquire);
+		if (Sequence & 1)
+		{
+			continue;
+		}
+		const uint32 Generation = ClockGeneration.load(std::memory_order_relaxed);
+		const int64 Frame = ClockFrame.load(std::memory_order_relaxed);
+		const int32 BlockFrames = ClockBlockFrames.load(std::memory_order_relaxed);
+		const int32 SampleRate = ClockSampleRate.load(std::memory_order_relaxed);
+		const double PublishTime = ClockPublishTime.load(std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (ClockSequence.load(std::memory_order_relaxed) != Sequence)
+		{
+			continue;
+		}
+
+		if (Frame == INDEX_NONE || SampleRate <= 0 || Generation != BufferGeneration.load(std::memory_order_relaxed))
+		{
+			return false;
+		}
+
+		const double BlockSeconds = static_cast<double>(BlockFrames) / SampleRate;
+		const double SincePublish = FPlatformTime::Seconds() - PublishTime;
+		OutSeconds = static_cast<double>(Frame) / SampleRate + FMath::Clamp(SincePublish, 0.0, BlockSeconds);
+		return true;
+	}
+	return false;
+}
+
+uint64 FSpeechPlaybackState::NewVoiceId()
+{
+	static std::atomic<uint64> NextVoiceId = 0;
+	return NextVoiceId.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
+FSpeechSoundGenerator::FSpeechSoundGenerator(const TSharedPtr<FSpeechAudioBuffer>& InBuffer, uint32 InBufferGeneration, const TSharedPtr<FSpeechPlaybackState>& InPlaybackState, const FSoundGeneratorInitParams& InParams, int32 InNumSamplesPerCallback, int32 InSampleRate, int32 InNumChannels)
+	: PlaybackState(InPlaybackState)
+	, NumSamplesPerCallback(InNumSamplesPerCallback)
+	, SampleRate(InSampleRate)
+	, NumChannels(FMath::Max(InNumChannels, 1))
+	, AudioComponentId(InParams.AudioComponentId)
+	, VoiceId(FSpeechPlaybackState::NewVoiceId())
+	, StartFrame(FMath::Max<int64>(FMath::FloorToInt64(static_cast<double>(InParams.StartTime) * InSampleRate), 0))
+{
+	ConversionBuffer.SetNumUninitialized(NumSamplesPerCallback);
+	if (InBuffer)
+	{
+		SetBuffer(InBuffer, InBufferGeneration);
+	}
+}
+
+FSpeechSoundGenerator::~FSpeechSoundGenerator()
+{
+	PlaybackState->ReleasePlaybackClock(VoiceId);
+}
+
+void FSpeechSoundGenerator::PushBuffer(const TSharedPtr<FSpeechAudioBuffer>& Buffer, uint32 Generation)
+{
+	PendingBuffers.Enqueue(MakeTuple(Buffer, Generation));
+}
+
+void FSpeechSoundGenerator::PushSeek(int64 Sample)
+{
+	PendingSeeks.Enqueue(Sample);
+}
+
+void FSpeechSoundGenerator::SetBuffer(const TSharedPtr<FSpeechAudioBuffer>& Buffer, uint32 Generation)
+{
+	Reader.SetBuffer(Buffer);
+	BufferGeneration = Generation;
+	if (Buffer)
+	{
+		SampleFormat = Buffer->GetSampleFormat();
+	}
+
+	// Play(StartTime) applies to the audio the voice starts with, audio set while it plays starts from the beginning
+	if (!bHasBuffer && StartFrame > 0)
+	{
+		Reader.Seek(StartFrame * GetSpeechSampleByteSize(SampleFormat) * NumChannels);
+	}
+	bHasBuffer = true;
+}
+
+int32 FSpeechSoundGenerator::OnGenerateAudio(float* OutAudio, int32 NumSamples)
+{
+	TPair<TSharedPtr<FSpeechAudioBuffer>, uint32> PendingBuffer;
+	while (PendingBuffers.Dequeue(PendingBuffer))
+	{
+		SetBuffer(PendingBuffer.Key, PendingBuffer.Value);
+	}
+
+	// Only the latest seek matters
+	int64 SeekSample = INDEX_NONE;
+	while (PendingSeeks.Dequeue(SeekSample))
+	{
+	}
+	if (SeekSample != INDEX_NONE)
+	{
+		Reader.Seek(SeekSample * GetSpeechSampleByteSize(SampleFormat));
+	}
+
+	// Nothing set on the wave yet, wait for SetAudio/AppendAudio the same way as for appended audio
+	if (!bHasBuffer)
+	{
+		PlaybackState->BufferUnderrunCount.Increment();
+		FMemory::Memzero(OutAudio, NumSamples * sizeof(float));
+		return NumSamples;
+	}
+
+	const int32 FrameSize = GetSpeechSampleByteSize(SampleFormat) * NumChannels;
+	PlaybackState->PublishPlaybackFrame(VoiceId, BufferGeneration, Reader.GetPosition() / FrameSize, NumSamples / NumChannels, SampleRate);
+
+	int32 SamplesRead = 0;
+	if (SampleFormat == ESpeechSampleFormat::Float32)
+	{
+		SamplesRead = Reader.Read(reinterpret_cast<uint8*>(OutAudio), NumSamples * sizeof(float)) / sizeof(float);
+	}
+	else
+	{
+		if (ConversionBuffer.Num() < NumSamples)
+		{
+			ConversionBuffer.SetNumUninitialized(NumSamples);
+		}
+		SamplesRead = Reader.Read(reinterpret_cast<uint8*>(ConversionBuffer.GetData()), NumSamples * sizeof(int16)) / sizeof(int16);
+		Audio::ArrayPcm16ToFloat(MakeArrayView(ConversionBuffer.GetData(), SamplesRead), MakeArrayView(OutAudio, SamplesRead));
+	}
+
+	if (SamplesRead < NumSamples)
+	{
+		if (Reader.IsStarving())
+		{
+			PlaybackState->BufferUnderrunCount.Increment();
+		}
+		FMemory::Memzero(OutAudio + SamplesRead, (NumSamples - SamplesRead) * sizeof(float));
+	}
+
+	// Another voice still playing the wave can take over the clock
+	if (Reader.IsAtEnd())
+	{
+		PlaybackState->ReleasePlaybackClock(VoiceId);
+	}
+
+	return NumSamples;
+}
+
+bool FSpeechSoundGenerator::IsFinished() const
+{
+	return bHasBuffer && Reader.IsAtEnd();
+}
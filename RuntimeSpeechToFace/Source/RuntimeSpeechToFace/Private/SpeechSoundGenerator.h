@@ -0,0 +1,113 @@
+// Per voice playback of a USpeechSoundWave
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Containers/Queue.h"
+#include "HAL/ThreadSafeCounter.h"
+#include "Sound/SoundGenerator.h"
+#include "SpeechAudioBuffer.h"
+#include <atomic>
+
+/** Playback state shared between a USpeechSoundWave and all of its active voices */
+struct FSpeechPlaybackState
+{
+	// Sample requested by the last Seek of every instance, picked up by GeneratePCMData. Voices get their seeks through
+	// FSpeechSoundGenerator::PushSeek so that a seek can be scoped to one audio component.
+	std::atomic<int64> SeekSample = 0;
+	std::atomic<uint32> SeekSerial = 0;
+
+	// Number of callbacks that had to pad with silence while waiting for appended audio
+	FThreadSafeCounter BufferUnderrunCount;
+
+	// Incremented every time the wave gets new audio, so the clock of the audio it had before is no longer reported
+	std::atomic<uint32> BufferGeneration = 0;
+
+	// Last time any voice of the wave rendered a block
+	std::atomic<double> PlaybackPublishTime = 0.0;
+
+	void RequestSeek(int64 Sample)
+	{
+		SeekSample.store(Sample, std::memory_order_relaxed);
+		SeekSerial.fetch_add(1, std::memory_order_release);
+	}
+
+	/**
+	 * Called from the audio render thread for every block a voice renders. Only one voice drives the clock at a time,
+	 * the first to render until it releases it, so the clock does not jump between voices playing the wave at once.
+	 */
+	void PublishPlaybackFrame(uint64 VoiceId, uint32 Generation, int64 Frame, int32 BlockFrames, int32 SampleRate);
+
+	/** Let the next voice to render drive the clock */
+	void ReleasePlaybackClock(uint64 VoiceId);
+
+	/**
+	 * Time in seconds of the audio being rendered right now. Advances smoothly between audio callbacks by
+	 * extrapolating with the wall clock for at most one block. Returns false if nothing has played yet.
+	 */
+	bool GetPlaybackTime(double& OutSeconds) const;
+
+	/** Unique id for a voice, never 0 */
+	static uint64 NewVoiceId();
+
+private:
+	std::atomic<uint64> ClockVoiceId = 0;
+
+	// Odd while the clock voice writes the fields below. Readers retry until they see the same even value before and after.
+	std::atomic<uint32> ClockSequence = 0;
+	std::atomic<uint32> ClockGeneration = 0;
+	std::atomic<int64> ClockFrame = INDEX_NONE;
+	std::atomic<int32> ClockBlockFrames = 0;
+	std::atomic<int32> ClockSampleRate = 0;
+	std::atomic<double> ClockPublishTime = 0.0;
+};
+
+/** A single playing instance of a USpeechSoundWave. Owns its own cursor over the shared audio buffer. */
+class FSpeechSoundGenerator : public ISoundGenerator
+{
+public:
+	FSpeechSoundGenerator(const TSharedPtr<FSpeechAudioBuffer>& InBuffer, uint32 InBufferGeneration, const TSharedPtr<FSpeechPlaybackState>& InPlaybackState, const FSoundGeneratorInitParams& InParams, int32 InNumSamplesPerCallback, int32 InSampleRate, int32 InNumChannels);
+	virtual ~FSpeechSoundGenerator();
+
+	/** Switch to audio set on the wave after this voice was created. Picked up at the start of the next callback. */
+	void PushBuffer(const TSharedPtr<FSpeechAudioBuffer>& Buffer, uint32 Generation);
+
+	/** Move this voice to an interleaved sample. Picked up at the start of the next callback. */
+	void PushSeek(int64 Sample);
+
+	uint64 GetAudioComponentId() const { return AudioComponentId; }
+
+	//~ Begin ISoundGenerator Interface
+	virtual int32 OnGenerateAudio(float* OutAudio, int32 NumSamples) override;
+	virtual int32 GetDesiredNumSamplesToRenderPerCallback() const override { return NumSamplesPerCallback; }
+	virtual bool IsFinished() const override;
+	//~ End ISoundGenerator Interface
+
+private:
+	void SetBuffer(const TSharedPtr<FSpeechAudioBuffer>& Buffer, uint32 Generation);
+
+	FSpeechAudioReader Reader;
+	TSharedPtr<FSpeechPlaybackState> PlaybackState;
+	ESpeechSampleFormat SampleFormat = ESpeechSampleFormat::Int16;
+	int32 NumSamplesPerCallback;
+	int32 SampleRate;
+	int32 NumChannels;
+	uint64 AudioComponentId;
+	uint64 VoiceId;
+
+	// BufferGeneration of the audio the reader is on
+	uint32 BufferGeneration = 0;
+
+	// Frame the voice was asked to start at, applied once it has audio to start in
+	int64 StartFrame;
+
+	// False while the wave has no audio set yet. The voice waits for it rather than finishing straight away.
+	bool bHasBuffer = false;
+
+	// Written by the game thread, read only by the audio render thread, so the callback never takes a lock
+	TQueue<TPair<TSharedPtr<FSpeechAudioBuffer>, uint32>, EQueueMode::Mpsc> PendingBuffers;
+	TQueue<int64, EQueueMode::Mpsc> PendingSeeks;
+
+	// Int16 data read from the buffer before conversion to the float output
+	TArray<int16> ConversionBuffer;
+};
@@ -3,30 +3,18 @@
 #include "SpeechSoundWave.h"
 
 #include "AudioDevice.h"
+#include "Components/AudioComponent.h"
 #include "Engine/Engine.h"
 #include "UObject/AssetRegistryTagsContext.h"
 #include "SoundFileIO/SoundFileIO.h"
 #include "Interfaces/IAudioFormat.h"
-#include "Decoders/VorbisAudioInfo.h"
 #include "RuntimeSpeechToFace.h"
+#include "RuntimeSpeechToFaceMemorySubsystem.h"
+#include "RuntimeSpeechToFaceSettings.h"
+#include "SpeechSoundGenerator.h"
+#include "SpeechToFacePipeline.h"
 #include UE_INLINE_GENERATED_CPP_BY_NAME(SpeechSoundWave)
 
-struct FSpeechSoundWaveInfo
-{
-    int32 SampleRate;
-    int32 NumChannels;
-    int32 NumSamples;
-    float Duration;
-    float TotalSamples;
-    TArray<uint8> PCMData;
-
-    FSpeechSoundWaveInfo() = default;
-    FSpeechSoundWaveInfo(const FSpeechSoundWaveInfo& Other) = default;
-    FSpeechSoundWaveInfo(FSpeechSoundWaveInfo&& Other) = default;
-    FSpeechSoundWaveInfo& operator=(const FSpeechSoundWaveInfo& Other) = default;
-    FSpeechSoundWaveInfo& operator=(FSpeechSoundWaveInfo&& Other) = default;
-};
-
 USpeechSoundWave::USpeechSoundWave(const FObjectInitializer& ObjectInitializer)
 	: Super(ObjectInitializer)
 {
@@ -41,6 +29,9 @@ USpeechSoundWave::USpeechSoundWave(const FObjectInitializer& ObjectInitializer)
 	// to ensure that we do not underrun.
 	
 	SampleByteSize = 2;
+
+	PlaybackState = MakeShared<FSpeechPlaybackState>();
+	RenderVoiceId = FSpeechPlaybackState::NewVoiceId();
 }
 
 USpeechSoundWave* USpeechSoundWave::MakeShallowCopy() const
@@ -50,81 +41,289 @@ USpeechSoundWave* USpeechSoundWave::MakeShallowCopy() const
 	NewSoundWave->SampleRate = SampleRate;
 	NewSoundWave->NumChannels = NumChannels;
 	NewSoundWave->TotalSamples = TotalSamples;
-	NewSoundWave->AudioBuffer = AudioBuffer;
+	NewSoundWave->SampleByteSize = SampleByteSize;
+	NewSoundWave->SampleFormat = SampleFormat;
+	// Copies play the same audio, so they drive the same playback clock
+	NewSoundWave->PlaybackState = PlaybackState;
+	{
+		FReadScopeLock ReadLock(AudioLock);
+		NewSoundWave->PublishAudioBuffer(AudioBuffer);
+	}
 	return NewSoundWave;
 }
 
-void USpeechSoundWave::SetAudio(const TSharedPtr<TArray<uint8>>& PCMData)
+void USpeechSoundWave::PublishAudioBuffer(const TSharedPtr<FSpeechAudioBuffer>& NewBuffer)
 {
-	Audio::EAudioMixerStreamDataFormat::Type Format = GetGeneratedPCMDataFormat();
-	SampleByteSize = (Format == Audio::EAudioMixerStreamDataFormat::Int16) ? 2 : 4;
+	uint32 Generation = 0;
+	{
+		FWriteScopeLock WriteLock(AudioLock);
+		AudioBuffer = NewBuffer;
+		Generation = PlaybackState->BufferGeneration.fetch_add(1, std::memory_order_relaxed) + 1;
+
+		// Voices already playing switch over, including those started before any audio was set
+		for (int32 VoiceIndex = Voices.Num() - 1; VoiceIndex >= 0; --VoiceIndex)
+		{
+			if (TSharedPtr<FSpeechSoundGenerator, ESPMode::ThreadSafe> Voice = Voices[VoiceIndex].Pin())
+			{
+				Voice->PushBuffer(NewBuffer, Generation);
+			}
+			else
+			{
+				Voices.RemoveAtSwap(VoiceIndex);
+			}
+		}
+	}
+	PendingRenderBuffers.Enqueue(MakeTuple(NewBuffer, Generation));
+}
 
-	auto BufferSize = PCMData->Num();
+Audio::EAudioMixerStreamDataFormat::Type USpeechSoundWave::GetGeneratedPCMDataFormat() const
+{
+	return SampleFormat == ESpeechSampleFormat::Float32 ? Audio::EAudioMixerStreamDataFormat::Float : Audio::EAudioMixerStreamDataFormat::Int16;
+}
+
+void USpeechSoundWave::SetAudio(const TSharedPtr<TArray<uint8>>& PCMData, ESpeechSampleFormat Format)
+{
+	if (PCMData)
+	{
+		SetAudio(TArray<uint8>(*PCMData), Format);
+	}
+}
+
+void USpeechSoundWave::SetAudio(TArray<uint8>&& PCMData, ESpeechSampleFormat Format)
+{
+	SampleFormat = Format;
+	SampleByteSize = GetSpeechSampleByteSize(Format);
+
+	auto BufferSize = PCMData.Num();
 	if (BufferSize == 0 || !ensure((BufferSize % SampleByteSize) == 0))
 	{
 		return;
 	}
 
+	TSharedPtr<FSpeechAudioBuffer> NewBuffer = MakeShared<FSpeechAudioBuffer>(Format, GetDefault<URuntimeSpeechToFaceSettings>()->SpeechAudioStorage, NumChannels);
+	NewBuffer->Append(MoveTemp(PCMData));
+	NewBuffer->Finish();
+	PublishAudioBuffer(NewBuffer);
+}
+
+void USpeechSoundWave::AppendAudio(TArray<uint8>&& PCMData, ESpeechSampleFormat Format)
+{
+	if (PCMData.Num() == 0 || !ensure((PCMData.Num() % GetSpeechSampleByteSize(Format)) == 0))
 	{
-		FWriteScopeLock WriteLock(AudioLock);
-		AudioBuffer = PCMData;
+		return;
+	}
+
+	TSharedPtr<FSpeechAudioBuffer> Buffer;
+	{
+		FReadScopeLock ReadLock(AudioLock);
+		Buffer = AudioBuffer;
+	}
+
+	if (!Buffer || Buffer->IsFinished() || !ensure(Buffer->GetSampleFormat() == Format))
+	{
+		SampleFormat = Format;
+		SampleByteSize = GetSpeechSampleByteSize(Format);
+		Buffer = MakeShared<FSpeechAudioBuffer>(Format, GetDefault<URuntimeSpeechToFaceSettings>()->SpeechAudioStorage, NumChannels);
+		PublishAudioBuffer(Buffer);
+	}
+
+	// The buffer is already visible to the audio thread, appending publishes the new samples lock free
+	Buffer->Append(MoveTemp(PCMData));
+
+	if (SampleRate > 0 && NumChannels > 0)
+	{
+		TotalSamples = Buffer->GetNumBytes() / (SampleByteSize * NumChannels);
+		Duration = TotalSamples / SampleRate;
+	}
+}
+
+void USpeechSoundWave::FinishAppending()
+{
+	FReadScopeLock ReadLock(AudioLock);
+	if (AudioBuffer)
+	{
+		AudioBuffer->Finish();
 	}
 }
 
 TArray<uint8> USpeechSoundWave::GetPCMData() const
+{
+	ESpeechSampleFormat Format;
+	return GetPCMData(Format);
+}
+
+TArray<uint8> USpeechSoundWave::GetPCMData(ESpeechSampleFormat& OutFormat) const
 {
 	FReadScopeLock ReadLock(AudioLock);
+	OutFormat = SampleFormat;
 	if (AudioBuffer)
 	{
-		return *AudioBuffer;
+		OutFormat = AudioBuffer->GetSampleFormat();
+		return AudioBuffer->CopyData();
 	}
 	return {};
 }
 
-int32 USpeechSoundWave::GeneratePCMData(uint8* PCMData, const int32 SamplesNeeded)
+TArray<uint8> USpeechSoundWave::GetPCMData(ESpeechSampleFormat& OutFormat, int64 FirstFrame, int64 NumFrames) const
 {
 	FReadScopeLock ReadLock(AudioLock);
+	OutFormat = SampleFormat;
+	TArray<uint8> Result;
 	if (AudioBuffer)
 	{
-		auto& AudioBufferRef = *AudioBuffer;
+		OutFormat = AudioBuffer->GetSampleFormat();
+		const int64 FrameByteSize = GetSpeechSampleByteSize(OutFormat) * FMath::Max<int32>(NumChannels, 1);
+		const int64 BufferBytes = AudioBuffer->GetNumBytes();
+		const int64 ByteOffset = FMath::Clamp<int64>(FirstFrame * FrameByteSize, 0, BufferBytes);
+		const int64 NumBytes = NumFrames == INDEX_NONE ? BufferBytes - ByteOffset : FMath::Clamp<int64>(NumFrames * FrameByteSize, 0, BufferBytes - ByteOffset);
+
+		// A reader of its own walks the chunks to the span without copying what comes before it
+		FSpeechAudioReader Reader;
+		Reader.SetBuffer(AudioBuffer);
+		Reader.Seek(ByteOffset);
+		Result.SetNumUninitialized(NumBytes);
+		Result.SetNum(Reader.Read(Result.GetData(), NumBytes), EAllowShrinking::No);
+	}
+	return Result;
+}
+
+int32 USpeechSoundWave::GeneratePCMData(uint8* PCMData, const int32 SamplesNeeded)
+{
+	// Pick up newly set audio without taking AudioLock on the audio render thread
+	TPair<TSharedPtr<FSpeechAudioBuffer>, uint32> PendingBuffer;
+	while (PendingRenderBuffers.Dequeue(PendingBuffer))
+	{
+		RenderReader.SetBuffer(PendingBuffer.Key);
+		RenderBufferGeneration = PendingBuffer.Value;
+	}
 
-		Audio::EAudioMixerStreamDataFormat::Type Format = GetGeneratedPCMDataFormat();
-		SampleByteSize = (Format == Audio::EAudioMixerStreamDataFormat::Int16) ? 2 : 4;
+	const uint32 SeekSerial = PlaybackState->SeekSerial.load(std::memory_order_acquire);
+	if (SeekSerial != RenderSeekSerial)
+	{
+		RenderSeekSerial = SeekSerial;
+		RenderReader.Seek(PlaybackState->SeekSample.load(std::memory_order_relaxed) * SampleByteSize);
+	}
 
-		int32 SamplesAvailable = AudioBufferRef.Num() / SampleByteSize - SampleIndex;
-		int32 BytesAvailable = SamplesAvailable * SampleByteSize;
-		int32 SamplesToGenerate = FMath::Min(NumSamplesToGeneratePerCallback, SamplesNeeded);
+	int32 SamplesToGenerate = FMath::Min(NumSamplesToGeneratePerCallback, SamplesNeeded);
 
-		check(SamplesToGenerate >= NumBufferUnderrunSamples);
+	check(SamplesToGenerate >= NumBufferUnderrunSamples);
 
-		// Wait until we have enough samples that are requested before starting.
-		if (SamplesAvailable > 0)
-		{
-			const int32 SamplesToCopy = FMath::Min<int32>(SamplesToGenerate, SamplesAvailable);
-			const int32 BytesToCopy = SamplesToCopy * SampleByteSize;
+	const int32 NumFrameChannels = FMath::Max<int32>(NumChannels, 1);
+	PlaybackState->PublishPlaybackFrame(RenderVoiceId, RenderBufferGeneration, RenderReader.GetPosition() / (SampleByteSize * NumFrameChannels), SamplesToGenerate / NumFrameChannels, SampleRate);
 
-			FMemory::Memcpy((void*)PCMData, &AudioBufferRef[SampleIndex * SampleByteSize], BytesToCopy);
-			SampleIndex += SamplesToCopy;
+	const int32 BytesCopied = RenderReader.Read(PCMData, SamplesToGenerate * SampleByteSize);
+	if (BytesCopied > 0)
+	{
+		return BytesCopied;
+	}
 
-			return BytesToCopy;
-		}
+	if (RenderReader.IsStarving())
+	{
+		PlaybackState->BufferUnderrunCount.Increment();
+	}
+	else if (RenderReader.IsAtEnd())
+	{
+		PlaybackState->ReleasePlaybackClock(RenderVoiceId);
 	}
 
 	// There wasn't enough data ready, write out zeros
-	const int32 BytesCopied = NumBufferUnderrunSamples * SampleByteSize;
-	FMemory::Memzero(PCMData, BytesCopied);
-	return BytesCopied;
+	const int32 BytesPadded = NumBufferUnderrunSamples * SampleByteSize;
+	FMemory::Memzero(PCMData, BytesPadded);
+	return BytesPadded;
 }
 
-void USpeechSoundWave::Seek(int Index)
+void USpeechSoundWave::Seek(int Index, UAudioComponent* AudioComponent)
 {
+	const uint64 AudioComponentId = AudioComponent ? AudioComponent->GetAudioComponentID() : 0;
+	{
+		FReadScopeLock ReadLock(AudioLock);
+		for (const TWeakPtr<FSpeechSoundGenerator, ESPMode::ThreadSafe>& WeakVoice : Voices)
+		{
+			TSharedPtr<FSpeechSoundGenerator, ESPMode::ThreadSafe> Voice = WeakVoice.Pin();
+			if (Voice && (!AudioComponent || Voice->GetAudioComponentId() == AudioComponentId))
+			{
+				Voice->PushSeek(Index);
+			}
+		}
+	}
+
+	if (!AudioComponent)
+	{
+		PlaybackState->RequestSeek(Index);
+	}
+}
+
+int32 USpeechSoundWave::GetBufferUnderrunCount() const
+{
+	return PlaybackState->BufferUnderrunCount.GetValue();
+}
+
+TSharedPtr<const FSpeechAudioBuffer> USpeechSoundWave::GetAudioBuffer() const
+{
+	FReadScopeLock ReadLock(AudioLock);
+	return AudioBuffer;
+}
+
+TSharedPtr<const FSpeechPlaybackState> USpeechSoundWave::GetPlaybackState() const
+{
+	return PlaybackState;
+}
+
+ISoundGeneratorPtr USpeechSoundWave::CreateSoundGenerator(const FSoundGeneratorInitParams& InParams, TArray<FAudioParameter>&& InDefaultParameters)
+{
+	// Every voice gets its own cursor over the shared buffer, so the same wave can play any number of times at once.
+	// It is registered under the same lock the buffer is read under, so it cannot miss audio set in between.
 	FWriteScopeLock WriteLock(AudioLock);
-	SampleIndex = Index;
+	TSharedPtr<FSpeechSoundGenerator, ESPMode::ThreadSafe> Voice = MakeShared<FSpeechSoundGenerator, ESPMode::ThreadSafe>(AudioBuffer, PlaybackState->BufferGeneration.load(std::memory_order_relaxed), PlaybackState, InParams, NumSamplesToGeneratePerCallback, SampleRate, NumChannels);
+	Voices.RemoveAllSwap([](const TWeakPtr<FSpeechSoundGenerator, ESPMode::ThreadSafe>& OldVoice) { return !OldVoice.IsValid(); });
+	Voices.Add(Voice);
+	return Voice;
 }
 
 int32 USpeechSoundWave::GetResourceSizeForFormat(FName Format)
 {
-	return 0;
+	// The PCM data is what gets played, whatever format is asked for
+	return static_cast<int32>(FMath::Min<int64>(GetAudioMemorySize(), MAX_int32));
+}
+
+void USpeechSoundWave::PostInitProperties()
+{
+	Super::PostInitProperties();
+	if (!HasAnyFlags(RF_ClassDefaultObject))
+	{
+		URuntimeSpeechToFaceMemorySubsystem::Track(this);
+	}
+}
+
+void USpeechSoundWave::GetResourceSizeEx(FResourceSizeEx& CumulativeResourceSize)
+{
+	Super::GetResourceSizeEx(CumulativeResourceSize);
+	CumulativeResourceSize.AddDedicatedSystemMemoryBytes(GetAudioMemorySize());
+}
+
+int64 USpeechSoundWave::GetAudioMemorySize() const
+{
+	FReadScopeLock ReadLock(AudioLock);
+	return AudioBuffer ? AudioBuffer->GetStoredBytes() : 0;
+}
+
+bool USpeechSoundWave::ReleaseAudio()
+{
+	{
+		FWriteScopeLock WriteLock(AudioLock);
+
+		// A paused voice does not render, so it looks idle but still needs its audio when it resumes
+		Voices.RemoveAllSwap([](const TWeakPtr<FSpeechSoundGenerator, ESPMode::ThreadSafe>& Voice) { return !Voice.IsValid(); });
+		if (Voices.Num() > 0)
+		{
+			return false;
+		}
+		AudioBuffer.Reset();
+	}
+
+	// Only the reference of the wave itself goes, the generation stays so the playback clock is untouched
+	PendingRenderBuffers.Enqueue(MakeTuple(TSharedPtr<FSpeechAudioBuffer>(), PlaybackState->BufferGeneration.load(std::memory_order_relaxed)));
+	return true;
 }
 
 void USpeechSoundWave::GetAssetRegistryTags(TArray<FAssetRegistryTag>& OutTags) const
@@ -182,100 +381,42 @@ bool USpeechSoundWave::InitAudioResource(FName Format)
 	return true;
 }
 
-static bool GetSoundWaveInfoFromWav(FSpeechSoundWaveInfo& Info, const TArray<uint8>& RawWaveData)
+// Create a sound wave playing decoded audio
+static USpeechSoundWave* CreateSpeechSoundWave(FSpeechAudioData&& Audio)
 {
-    FWaveModInfo WaveInfo;
-    FString ErrorMessage;
-    if (!WaveInfo.ReadWaveInfo(RawWaveData.GetData(), RawWaveData.Num(), &ErrorMessage))
-    {
-        UE_LOG(LogRuntimeSpeechToFace, Error, TEXT("Unable to read wave file - \"%s\""), *ErrorMessage);
-        return false;
-    }
-
-    int32 ChannelCount = (int32)*WaveInfo.pChannels;
-    check(ChannelCount > 0);
-    int32 SizeOfSample = (*WaveInfo.pBitsPerSample) / 8;
-    int32 NumSamples = WaveInfo.SampleDataSize / SizeOfSample;
-    int32 NumFrames = NumSamples / ChannelCount;
-
-	Info.SampleRate = *WaveInfo.pSamplesPerSec;
-    Info.Duration = (float)NumFrames / *WaveInfo.pSamplesPerSec;
-	Info.NumChannels = ChannelCount;
-	Info.TotalSamples = *WaveInfo.pSamplesPerSec * Info.Duration;
-    Info.PCMData.AddUninitialized(WaveInfo.SampleDataSize);
-    FMemory::Memcpy(Info.PCMData.GetData(), WaveInfo.SampleDataStart, WaveInfo.SampleDataSize);
-
-    return true;
-}
-
-static bool GetSoundWaveInfoFromOgg(FSpeechSoundWaveInfo& Info, const TArray<uint8>& OggData)
-{
-    FVorbisAudioInfo	AudioInfo;
-    FSoundQualityInfo	QualityInfo;
-    if (!AudioInfo.ReadCompressedInfo(OggData.GetData(), OggData.Num(), &QualityInfo))
-    {
-        return false;
-    }
-    TArray<uint8> PCMData;
-    PCMData.AddUninitialized(QualityInfo.SampleDataSize);
-    AudioInfo.ReadCompressedData(PCMData.GetData(), false, QualityInfo.SampleDataSize);
-
-    Info.SampleRate = QualityInfo.SampleRate;
-    Info.Duration = QualityInfo.Duration;
-    Info.NumChannels = QualityInfo.NumChannels;
-    Info.TotalSamples = QualityInfo.Duration * QualityInfo.Duration;
-    Info.PCMData = MoveTemp(PCMData);
-    return true;
+	const int64 NumFrames = Audio.GetNumBytes() / (GetSpeechSampleByteSize(Audio.SampleFormat) * FMath::Max<int32>(Audio.NumChannels, 1));
+	USpeechSoundWave* SoundWave = NewObject<USpeechSoundWave>();
+	SoundWave->NumChannels = Audio.NumChannels;
+	SoundWave->SetAudio(MoveTemp(Audio.PCMData), Audio.SampleFormat);
+	SoundWave->Duration = static_cast<float>(NumFrames) / Audio.SampleRate;
+	SoundWave->SetImportedSampleRate(Audio.SampleRate);
+	SoundWave->SetSampleRate(Audio.SampleRate);
+	SoundWave->TotalSamples = Audio.SampleRate * SoundWave->Duration;
+	return SoundWave;
 }
 
 void USpeechSoundWave::CreateSpeechSoundWaveFromFile(const FString& FilePath, const FOnSoundWaveDelegate& SoundWaveCallback)
 {
 	AsyncTask(ENamedThreads::AnyBackgroundHiPriTask, [FilePath, SoundWaveCallback]()
 		{
-            TArray<uint8> FileContent;
-            if (!FFileHelper::LoadFileToArray(FileContent, *FilePath))
-            {
-                UE_LOG(LogRuntimeSpeechToFace, Error, TEXT("Failed to load file at path: %s"), *FilePath);
-                return;
-            }
-            double LoadingStartTime = FPlatformTime::Seconds();
-            bool bSuccess = false;
-            FSpeechSoundWaveInfo SoundWaveInfo;
-            if (FilePath.ToLower().EndsWith(".wav"))
-            {
-				if (GetSoundWaveInfoFromWav(SoundWaveInfo, FileContent))
-				{
-					bSuccess = true;
-				}
-            }
-            else if (FilePath.ToLower().EndsWith(".ogg"))
-            {
-				if (GetSoundWaveInfoFromOgg(SoundWaveInfo, FileContent))
+			TArray<uint8> FileContent;
+			if (!FFileHelper::LoadFileToArray(FileContent, *FilePath))
+			{
+				UE_LOG(LogRuntimeSpeechToFace, Error, TEXT("Failed to load file at path: %s"), *FilePath);
+				return;
+			}
+			FSpeechAudioData Audio;
+			const bool bSuccess = SpeechToFacePipeline::DecodeAudioFile(FilePath, FileContent, Audio);
+			AsyncTask(ENamedThreads::GameThread, [SoundWaveCallback, bSuccess, Audio = MoveTemp(Audio), FilePath]() mutable
 				{
-					bSuccess = true;
-				}
-            }
-            else
-            {
-                // UE runtime only supports wav or ogg
-            }
-            AsyncTask(ENamedThreads::GameThread, [SoundWaveCallback, bSuccess, SoundWaveInfo, FilePath]() mutable
-                {
-                    if (!bSuccess)
-                    {
-                        UE_LOG(LogRuntimeSpeechToFace, Error, TEXT("Failed to create sound wave from file at path: %s"), *FilePath);
-                        SoundWaveCallback.ExecuteIfBound(nullptr);
-                        return;
-                    }
-					USpeechSoundWave* SoundWave = NewObject<USpeechSoundWave>();
-                    SoundWave->SetAudio(MakeShared<TArray<uint8>>(MoveTemp(SoundWaveInfo.PCMData)));
-                    SoundWave->Duration = SoundWaveInfo.Duration;
-                    SoundWave->SetImportedSampleRate(SoundWaveInfo.SampleRate);
-                    SoundWave->SetSampleRate(SoundWaveInfo.SampleRate);
-                    SoundWave->NumChannels = SoundWaveInfo.NumChannels;
-                    SoundWave->TotalSamples = SoundWaveInfo.TotalSamples;
-					SoundWaveCallback.ExecuteIfBound(SoundWave);
-                });
+					if (!bSuccess)
+					{
+						UE_LOG(LogRuntimeSpeechToFace, Error, TEXT("Failed to create sound wave from file at path: %s"), *FilePath);
+						SoundWaveCallback.ExecuteIfBound(nullptr);
+						return;
+					}
+					SoundWaveCallback.ExecuteIfBound(CreateSpeechSoundWave(MoveTemp(Audio)));
+				});
 		});
 }
 
@@ -283,15 +424,9 @@ void USpeechSoundWave::CreateSpeechSoundWaveFromContentString(const TArray<uint8
 {
 	AsyncTask(ENamedThreads::AnyBackgroundHiPriTask, [ContentString, SoundWaveCallback]()
 		{
-			double LoadingStartTime = FPlatformTime::Seconds();
-			bool bSuccess = false;
-			FSpeechSoundWaveInfo SoundWaveInfo;
-			if (GetSoundWaveInfoFromWav(SoundWaveInfo, ContentString))
-			{
-				bSuccess = true;
-			}
-			
-			AsyncTask(ENamedThreads::GameThread, [SoundWaveCallback, bSuccess, SoundWaveInfo]() mutable
+			FSpeechAudioData Audio;
+			const bool bSuccess = SpeechToFacePipeline::DecodeWav(ContentString, Audio);
+			AsyncTask(ENamedThreads::GameThread, [SoundWaveCallback, bSuccess, Audio = MoveTemp(Audio)]() mutable
 				{
 					if (!bSuccess)
 					{
@@ -299,14 +434,7 @@ void USpeechSoundWave::CreateSpeechSoundWaveFromContentString(const TArray<uint8
 						SoundWaveCallback.ExecuteIfBound(nullptr);
 						return;
 					}
-					USpeechSoundWave* SoundWave = NewObject<USpeechSoundWave>();
-					SoundWave->SetAudio(MakeShared<TArray<uint8>>(MoveTemp(SoundWaveInfo.PCMData)));
-					SoundWave->Duration = SoundWaveInfo.Duration;
-					SoundWave->SetImportedSampleRate(SoundWaveInfo.SampleRate);
-					SoundWave->SetSampleRate(SoundWaveInfo.SampleRate);
-					SoundWave->NumChannels = SoundWaveInfo.NumChannels;
-					SoundWave->TotalSamples = SoundWaveInfo.TotalSamples;
-					SoundWaveCallback.ExecuteIfBound(SoundWave);
+					SoundWaveCallback.ExecuteIfBound(CreateSpeechSoundWave(MoveTemp(Audio)));
 				});
 		});
 }
\ No newline at end of file
@@ -0,0 +1,206 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#include "SpeechToFaceBenchmark.h"
+
+#if !UE_BUILD_SHIPPING
+
+#include "AnimNode_RuntimeAnim.h"
+#include "Math/RandomStream.h"
+#include "RuntimeAnimation.h"
+#include "RuntimeSpeechToFaceSettings.h"
+#include "SpeechSoundGenerator.h"
+#include "SpeechSoundWave.h"
+#include "SpeechToFacePipeline.h"
+#include "UObject/Package.h"
+#include "UObject/StrongObjectPtr.h"
+
+// Roughly the number of raw controls the rig control conversion outputs
+static constexpr int32 BenchmarkNumCurves = 250;
+
+// Rate the anim graph evaluates at and the audio mixer renders blocks at
+static constexpr float BenchmarkTickRate = 60.0f;
+static constexpr int32 BenchmarkAudioBlockFrames = 1024;
+
+void SpeechToFaceBenchmark::Measure(const TCHAR* Kernel, const FString& Case, int32 Iterations, TFunctionRef<void()> Body, TArray<FSpeechToFaceBenchmarkResult>& OutResults)
+{
+	Iterations = FMath::Max(Iterations, 1);
+
+	// The first run pays for scratch buffer growth and cold caches
+	Body();
+
+	TArray<double> Times;
+	Times.Reserve(Iterations);
+	for (int32 Iteration = 0; Iteration < Iterations; ++Iteration)
+	{
+		const uint64 StartCycles = FPlatformTime::Cycles64();
+		Body();
+		Times.Add(FPlatformTime::ToMilliseconds64(FPlatformTime::Cycles64() - StartCycles));
+	}
+	Times.Sort();
+
+	FSpeechToFaceBenchmarkResult& Result = OutResults.AddDefaulted_GetRef();
+	Result.Kernel = Kernel;
+	Result.Case = Case;
+	Result.Iterations = Iterations;
+	Result.MinMs = Times[0];
+	Result.MedianMs = Times[Iterations / 2];
+	double TotalMs = 0.0;
+	for (const double Time : Times)
+	{
+		TotalMs += Time;
+	}
+	Result.MeanMs = TotalMs / Iterations;
+}
+
+void SpeechToFaceBenchmark::MakeSyntheticAudio(float Duration, uint32 SampleRate, uint16 NumChannels, TArray<uint8>& OutPCMData)
+{
+	FRandomStream Random(0x5EED);
+	const int32 NumFrames = FMath::RoundToInt32(Duration * SampleRate);
+	OutPCMData.SetNumUninitialized(NumFrames * NumChannels * sizeof(int16));
+	int16* Samples = reinterpret_cast<int16*>(OutPCMData.GetData());
+
+	float Phase = 0.0f;
+	for (int32 FrameIndex = 0; FrameIndex < NumFrames; ++FrameIndex)
+	{
+		const float Time = static_cast<float>(FrameIndex) / SampleRate;
+		const float Pitch = 120.0f + 40.0f * FMath::Sin(2.0f * PI * 0.5f * Time);
+		Phase = FMath::Fmod(Phase + 2.0f * PI * Pitch / SampleRate, 2.0f * PI);
+		const float Envelope = 0.5f + 0.5f * FMath::Sin(2.0f * PI * 4.0f * Time);
+		for (uint16 Channel = 0; Channel < NumChannels; ++Channel)
+		{
+			const float Value = Envelope * (0.4f * FMath::Sin(Phase + Channel) + 0.05f * Random.FRandRange(-1.0f, 1.0f));
+			Samples[FrameIndex * NumChannels + Channel] = static_cast<int16>(FMath::Clamp(Value, -1.0f, 1.0f) * MAX_int16);
+		}
+	}
+}
+
+// Smooth curves of the length of a generated animation, so compression reduces them as it would real ones
+static URuntimeAnimation* MakeSyntheticAnimation(float Duration, FRandomStream& Random)
+{
+	FSpeechToFaceAnimationData AnimationData;
+	AnimationData.FrameRate = 30.0f;
+	for (int32 CurveIndex = 0; CurveIndex < BenchmarkNumCurves; ++CurveIndex)
+	{
+		AnimationData.CurveNames.Add(*FString::Printf(TEXT("BenchmarkCurve_%d"), CurveIndex));
+	}
+
+	TArray<float> Frequencies;
+	for (int32 CurveIndex = 0; CurveIndex < BenchmarkNumCurves; ++CurveIndex)
+	{
+		Frequencies.Add(Random.FRandRange(0.2f, 4.0f));
+	}
+	const int32 NumFrames = FMath::FloorToInt32(Duration * AnimationData.FrameRate);
+	AnimationData.Values.SetNumUninitialized(NumFrames * BenchmarkNumCurves);
+	for (int32 FrameIndex = 0; FrameIndex < NumFrames; ++FrameIndex)
+	{
+		const float Time = FrameIndex / AnimationData.FrameRate;
+		for (int32 CurveIndex = 0; CurveIndex < BenchmarkNumCurves; ++CurveIndex)
+		{
+			AnimationData.Values[FrameIndex * BenchmarkNumCurves + CurveIndex] = 0.5f + 0.5f * FMath::Sin(2.0f * PI * Frequencies[CurveIndex] * Time);
+		}
+	}
+
+	URuntimeAnimation* Animation = NewObject<URuntimeAnimation>(GetTransientPackage());
+	Animation->Duration = Duration;
+	AnimationData.BuildCurves(Animation->FloatCurves);
+	Animation->BuildLODCurveSets();
+	return Animation;
+}
+
+void SpeechToFaceBenchmark::RunAll(int32 Iterations, TArray<FSpeechToFaceBenchmarkResult>& OutResults)
+{
+	SpeechToFacePipeline::BenchmarkKernels(Iterations, OutResults);
+
+	FRandomStream Random(0x5EED);
+	const float Durations[] = { 2.0f, 10.0f, 30.0f };
+	for (const float Duration : Durations)
+	{
+		const FString Case = FString::Printf(TEXT("%gs"), Duration);
+
+		// Every anim graph tick of the whole clip, at full LOD and without the evaluation batch
+		TStrongObjectPtr<URuntimeAnimation> Animation(MakeSyntheticAnimation(Duration, Random));
+		FAnimNode_RuntimeAnim Node;
+		Node.RuntimeAnimation = Animation.Get();
+		Node.bSyncToAudioClock = false;
+		Node.bUseBatchedEvaluation = false;
+		Node.DeltaTime = 1.0f / BenchmarkTickRate;
+		auto PlayClip = [&Animation, &Node]()
+			{
+				Animation->CurTime = 0.0f;
+				while (Animation->CurTime < Animation->Duration)
+				{
+					FBlendedCurve Curve;
+					Node.EvaluateRuntimeCurves(Curve);
+				}
+			};
+		Measure(TEXT("AnimNodeEvaluate"), Case, Iterations, PlayClip, OutResults);
+
+		Animation->Compress(GetDefault<URuntimeSpeechToFaceSettings>()->CompressionSettings);
+		Measure(TEXT("AnimNodeEvaluate_Compressed"), Case, Iterations, PlayClip, OutResults);
+
+		// Every block the audio render thread pulls for the whole clip
+		constexpr uint32 SampleRate = 48000;
+		constexpr uint16 NumChannels = 2;
+		TArray<uint8> PCMData;
+		MakeSyntheticAudio(Duration, SampleRate, NumChannels, PCMData);
+		const int64 NumPCMBytes = PCMData.Num();
+
+		TSharedPtr<FSpeechAudioBuffer> PCMBuffer = MakeShared<FSpeechAudioBuffer>(ESpeechSampleFormat::Int16, ESpeechAudioStorage::PCM, NumChannels);
+		PCMBuffer->Append(TArray<uint8>(PCMData));
+		PCMBuffer->Finish();
+
+		// The same blocks read back from ADPCM storage, decoded as they are read
+		TSharedPtr<FSpeechAudioBuffer> EncodedBuffer = MakeShared<FSpeechAudioBuffer>(ESpeechSampleFormat::Int16, ESpeechAudioStorage::ADPCM, NumChannels);
+		EncodedBuffer->Append(TArray<uint8>(PCMData));
+		EncodedBuffer->Finish();
+
+		TStrongObjectPtr<USpeechSoundWave> SoundWave(NewObject<USpeechSoundWave>(GetTransientPackage()));
+		SoundWave->NumChannels = NumChannels;
+		SoundWave->SetAudio(MoveTemp(PCMData));
+		SoundWave->Duration = Duration;
+		SoundWave->SetSampleRate(SampleRate);
+
+		TArray<uint8> Block;
+		Block.SetNumUninitialized(BenchmarkAudioBlockFrames * NumChannels * sizeof(int16));
+		Measure(TEXT("GeneratePCMData"), Case + TEXT("_2ch"), Iterations, [&SoundWave, &Block, NumPCMBytes]()
+			{
+				// Each call returns at most NumSamplesToGeneratePerCallback samples, which can be less than a block
+				SoundWave->Seek(0);
+				for (int64 NumBytesLeft = NumPCMBytes; NumBytesLeft > 0;)
+				{
+					NumBytesLeft -= SoundWave->GeneratePCMData(Block.GetData(), BenchmarkAudioBlockFrames * NumChannels);
+				}
+			}, OutResults);
+
+		// Voices are what the audio mixer plays speech sound waves through
+		TArray<float> FloatBlock;
+		FloatBlock.SetNumUninitialized(BenchmarkAudioBlockFrames * NumChannels);
+		auto MeasureVoice = [&](const TCHAR* Kernel, const TSharedPtr<FSpeechAudioBuffer>& Buffer)
+			{
+				FSpeechSoundGenerator Voice(Buffer, 0, MakeShared<FSpeechPlaybackState>(), FSoundGeneratorInitParams(), FloatBlock.Num(), SampleRate, NumChannels);
+				Measure(Kernel, Case + TEXT("_2ch"), Iterations, [&Voice, &FloatBlock]()
+					{
+						Voice.PushSeek(0);
+						do
+						{
+							Voice.OnGenerateAudio(FloatBlock.GetData(), FloatBlock.Num());
+						}
+						while (!Voice.IsFinished());
+					}, OutResults);
+			};
+		MeasureVoice(TEXT("SoundGenerator_OnGenerateAudio"), PCMBuffer);
+		MeasureVoice(TEXT("SoundGenerator_OnGenerateAudio_ADPCM"), EncodedBuffer);
+
+		FSpeechAudioReader EncodedReader;
+		EncodedReader.SetBuffer(EncodedBuffer);
+		Measure(TEXT("SpeechAudioReader_ADPCM"), Case + TEXT("_2ch"), Iterations, [&EncodedReader, &Block]()
+			{
+				EncodedReader.Seek(0);
+				while (EncodedReader.Read(Block.GetData(), Block.Num()) > 0)
+				{
+				}
+			}, OutResults);
+	}
+}
+
+#endif
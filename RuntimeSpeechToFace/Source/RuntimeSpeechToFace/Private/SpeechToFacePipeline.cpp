@@ -0,0 +1,1597 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#include "SpeechToFacePipeline.h"
+#include "RuntimeSpeechToFace.h"
+#include "Audio.h"
+#include "AudioDecompress.h"
+#include "Interfaces/IAudioFormat.h"
+#include "Decoders/VorbisAudioInfo.h"
+#include "NNEModelData.h"
+#include "NNE.h"
+#include "AudioResampler.h"
+#include "SampleBuffer.h"
+#include "DataDefs.h"
+#include "GuiToRawControlsUtils.h"
+#include "RuntimeSpeechToFaceSettings.h"
+#include "SpeechSoundWave.h"
+#include "SpeechToFaceBenchmark.h"
+#include "Containers/Ticker.h"
+#include "Misc/Paths.h"
+#include "Misc/QueuedThreadPool.h"
+#include "Containers/LruCache.h"
+#include "Hash/xxhash.h"
+#include "Math/RandomStream.h"
+
+using FloatSamples = Audio::VectorOps::FAlignedFloatBuffer;
+
+static const FName RootBoneName = TEXT("root");
+
+static constexpr uint32 AudioEncoderSampleRateHz = 16000;
+static constexpr float RigLogicPredictorOutputFps = 50.0f;
+static constexpr float RigLogicPredictorMaxAudioSamples = AudioEncoderSampleRateHz * 30;
+static constexpr float RigLogicPredictorFrameDuration = 1.f / RigLogicPredictorOutputFps;
+static constexpr float SamplesPerFrame = AudioEncoderSampleRateHz * RigLogicPredictorFrameDuration;
+static constexpr float AnimationOutputFps = 30.0f;
+
+static constexpr int32 StreamBufferSize = 19200;
+
+static FQueuedThreadPool* InferenceThreadPool = nullptr;
+
+/** Buffers of one set of model instances, reused by every request run on them so steady state requests barely allocate */
+struct FSpeechToFaceScratch
+{
+	// Mono samples at the source rate, only used when resampling
+	FloatSamples SourceSamples;
+
+	// Mono samples at the encoder rate
+	FloatSamples Samples;
+
+	// Encoder or predictor input padded to its shape bucket
+	TArray<float> PaddedInput;
+
+	TBitArray<> VoicedFrames;
+	TArray<TPair<int32, int32>> VoicedRanges;
+
+	// Features of requests that do not go through the feature cache
+	FSpeechAudioFeatures Features;
+
+	// Predictor output of the whole clip, frame major
+	TArray<float> RigLogicValues;
+	TArray<float> RigLogicBlinkValues;
+	TArray<float> RigLogicHeadValues;
+
+	// Predictor output resampled to the animation rate, frame major
+	TArray<float> ResampledValues;
+	TArray<float> ResampledBlinkValues;
+	TArray<int32> BlinkControlIndices;
+
+	TMap<FString, float> GuiFrame;
+};
+
+static TSharedPtr<UE::NNE::IModelCPU> TryLoadModel(const FSoftObjectPath& InModelAssetPath, const URuntimeSpeechToFaceSettings* Settings)
+{
+	const FSoftObjectPtr ModelAsset(InModelAssetPath);
+	UNNEModelData* ModelData = Cast<UNNEModelData>(ModelAsset.LoadSynchronous());
+
+	if (!IsValid(ModelData))
+	{
+		check(false);
+		UE_LOG(LogTemp, Error, TEXT("Failed to load model, it is invalid (nullptr)"));
+		return nullptr;
+	}
+
+	if (!Settings->RuntimeModuleName.IsEmpty() && !FModuleManager::Get().LoadModule(*Settings->RuntimeModuleName))
+	{
+		UE_LOG(LogTemp, Error, TEXT("Failed to load model, could not load NNE Runtime module (%s): %s"), *Settings->RuntimeModuleName, *ModelData->GetPathName());
+		return nullptr;
+	}
+
+	const TWeakInterfacePtr<INNERuntimeCPU> NNERuntimeCPU = UE::NNE::GetRuntime<INNERuntimeCPU>(Settings->RuntimeName);
+
+	if (!NNERuntimeCPU.IsValid())
+	{
+		UE_LOG(LogTemp, Error, TEXT("Failed to load model, could not load NNE Runtime (%s): %s"), *Settings->RuntimeName, *ModelData->GetPathName());
+		return nullptr;
+	}
+
+	TSharedPtr<UE::NNE::IModelCPU> ModelCpu = NNERuntimeCPU->CreateModelCPU(ModelData);
+
+	if (!ModelCpu.IsValid())
+	{
+		UE_LOG(LogTemp, Error, TEXT("Failed to load model, could not create model CPU: %s"), *ModelData->GetPathName());
+		return nullptr;
+	}
+
+	UE_LOG(LogTemp, Display, TEXT("Loaded model: %s"), *ModelData->GetPathName());
+
+	return ModelCpu;
+}
+
+TSharedPtr<FSpeechToFaceModels> FSpeechToFaceModels::Load(FName QualityTier)
+{
+	const URuntimeSpeechToFaceSettings* Settings = GetDefault<URuntimeSpeechToFaceSettings>();
+
+	FSoftObjectPath AudioEncoderPath;
+	FSoftObjectPath AnimationDecoderPath;
+	if (!Settings->GetQualityTierModels(QualityTier, AudioEncoderPath, AnimationDecoderPath))
+	{
+		UE_LOG(LogTemp, Error, TEXT("Failed to load models, there is no quality tier %s"), *QualityTier.ToString());
+		return nullptr;
+	}
+
+	TSharedPtr<FSpeechToFaceModels> Models = MakeShared<FSpeechToFaceModels>();
+	Models->AudioEncoder = TryLoadModel(AudioEncoderPath, Settings);
+	Models->AnimationDecoder = TryLoadModel(AnimationDecoderPath, Settings);
+
+	if (!(Models->AudioEncoder.IsValid() && Models->AnimationDecoder.IsValid()))
+	{
+		return nullptr;
+	}
+	return Models;
+}
+
+FSpeechToFaceModelInstances FSpeechToFaceModels::CreateInstances() const
+{
+	FSpeechToFaceModelInstances Instances;
+	Instances.AudioExtractor = AudioEncoder->CreateModelInstanceCPU();
+	Instances.RigLogicPredictor = AnimationDecoder->CreateModelInstanceCPU();
+	Instances.Scratch = MakeShared<FSpeechToFaceScratch>();
+
+	// One pinned pair of instances per shape bucket, longest bucket last
+	TArray<float> BucketDurations = GetDefault<URuntimeSpeechToFaceSettings>()->ShapeBucketDurations;
+	BucketDurations.Sort();
+	for (const float BucketDuration : BucketDurations)
+	{
+		// Whole predictor frames, never longer than an encoder chunk
+		const int32 NumFrames = FMath::CeilToInt32(FMath::Min(BucketDuration, RigLogicPredictorMaxAudioSamples / AudioEncoderSampleRateHz) * RigLogicPredictorOutputFps);
+		const int32 NumSamples = static_cast<int32>(NumFrames * SamplesPerFrame);
+		if (NumFrames <= 0 || (Instances.ShapeBuckets.Num() > 0 && Instances.ShapeBuckets.Last().NumSamples >= NumSamples))
+		{
+			continue;
+		}
+
+		FSpeechToFaceShapeBucket& Bucket = Instances.ShapeBuckets.AddDefaulted_GetRef();
+		Bucket.NumSamples = NumSamples;
+		Bucket.AudioExtractor = AudioEncoder->CreateModelInstanceCPU();
+		Bucket.RigLogicPredictor = AnimationDecoder->CreateModelInstanceCPU();
+		if (!Bucket.AudioExtractor.IsValid() || !Bucket.RigLogicPredictor.IsValid())
+		{
+			UE_LOG(LogTemp, Error, TEXT("Failed to create speech to face model instances for the %.1f s shape bucket"), BucketDuration);
+			Instances.ShapeBuckets.Pop();
+		}
+	}
+
+	if (!Instances.IsValid())
+	{
+		UE_LOG(LogTemp, Error, TEXT("Failed to create speech to face model instances"));
+	}
+	return Instances;
+}
+
+static EThreadPriority ToThreadPriority(ERuntimeSpeechToFaceThreadPriority Priority)
+{
+	switch (Priority)
+	{
+	case ERuntimeSpeechToFaceThreadPriority::Lowest:
+		return TPri_Lowest;
+	case ERuntimeSpeechToFaceThreadPriority::BelowNormal:
+		return TPri_BelowNormal;
+	case ERuntimeSpeechToFaceThreadPriority::AboveNormal:
+		return TPri_AboveNormal;
+	default:
+		return TPri_Normal;
+	}
+}
+
+// Inference time the governor lets build up while idle, in frames of budget
+static constexpr double GovernorMaxBurstFrames = 30.0;
+
+// The smoothed frame time lags behind, so the budget is cut at most this often
+static constexpr double GovernorScaleDownInterval = 0.5;
+static constexpr double GovernorMinScale = 0.1;
+
+/** Work for the inference threads, with what to do instead if it never gets to run */
+struct FSpeechToFaceInferenceWork
+{
+	TUniqueFunction<void()> Work;
+	TUniqueFunction<void()> OnAbandoned;
+};
+
+/** Inference work queued on the thread pool. The pool abandons what it has not started when it is destroyed. */
+class FSpeechToFaceQueuedInference final : public IQueuedWork
+{
+public:
+	explicit FSpeechToFaceQueuedInference(FSpeechToFaceInferenceWork&& InWork)
+		: Work(MoveTemp(InWork))
+	{
+	}
+
+	virtual void DoThreadedWork() override
+	{
+		Work.Work();
+		delete this;
+	}
+
+	virtual void Abandon() override
+	{
+		Work.OnAbandoned();
+		delete this;
+	}
+
+private:
+	FSpeechToFaceInferenceWork Work;
+};
+
+/**
+ * Keeps inference within the CPU budget set in URuntimeSpeechToFaceSettings. Work waits while as many requests
+ * run as the budget allows, or while the inference time spent recently is over the per-frame budget. While the game
+ * misses its target frame time, the budget shrinks. It grows back once the frame time has headroom again.
+ */
+class FSpeechToFaceInferenceGovernor
+{
+public:
+	void Launch(FSpeechToFaceInferenceWork&& Work)
+	{
+		{
+			FScopeLock Lock(&CriticalSection);
+			if (!bShutDown)
+			{
+				Enqueue(MoveTemp(Work));
+				return;
+			}
+		}
+
+		// Work launched after shutdown would bring the pool back, so it fails right away instead
+		Work.OnAbandoned();
+	}
+
+	void Shutdown()
+	{
+		TArray<FSpeechToFaceInferenceWork> Abandoned;
+		FQueuedThreadPool* ThreadPool = nullptr;
+		{
+			FScopeLock Lock(&CriticalSection);
+			bShutDown = true;
+			if (TickerHandle.IsValid())
+			{
+				FTSTicker::GetCoreTicker().RemoveTicker(TickerHandle);
+				TickerHandle.Reset();
+			}
+			Abandoned = MoveTemp(Deferred);
+			DeferredSince = 0.0;
+			ThreadPool = InferenceThreadPool;
+			InferenceThreadPool = nullptr;
+		}
+
+		// Waits for the running work, and abandons the work still queued on the pool. Runs outside the lock, as the
+		// abandoned work may launch more work or read the stats.
+		if (ThreadPool)
+		{
+			ThreadPool->Destroy();
+			delete ThreadPool;
+		}
+
+		// Dropped work still fails the way it would have, so whatever waits on it is released
+		for (FSpeechToFaceInferenceWork& Work : Abandoned)
+		{
+			Work.OnAbandoned();
+		}
+	}
+
+	FSpeechToFaceGovernorStats GetStats()
+	{
+		FScopeLock Lock(&CriticalSection);
+		FSpeechToFaceGovernorStats Stats;
+		Stats.NumRunning = NumRunning.load();
+		Stats.NumDeferred = Deferred.Num();
+		Stats.TotalDeferred = TotalDeferred;
+		Stats.MaxRunning = MaxRunning;
+		Stats.BudgetScale = static_cast<float>(Scale);
+		Stats.FrameTimeMs = static_cast<float>(SmoothedFrameMs);
+		return Stats;
+	}
+
+private:
+	void Enqueue(FSpeechToFaceInferenceWork&& Work)
+	{
+		const URuntimeSpeechToFaceSettings* Settings = GetDefault<URuntimeSpeechToFaceSettings>();
+		if (!IsEnabled(Settings))
+		{
+			Run(MoveTemp(Work), Settings);
+			return;
+		}
+
+		if (!TickerHandle.IsValid())
+		{
+			LastTickTime = FPlatformTime::Seconds();
+			MaxRunning = GetMaxRunning(Settings);
+			TickerHandle = FTSTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateRaw(this, &FSpeechToFaceInferenceGovernor::Tick));
+		}
+
+		// Work starts in the order it was launched, so earlier requests are never overtaken
+		Deferred.Add(MoveTemp(Work));
+		Dispatch(Settings);
+		if (Deferred.Num() > 0)
+		{
+			++TotalDeferred;
+			if (DeferredSince == 0.0)
+			{
+				DeferredSince = FPlatformTime::Seconds();
+				UE_LOG(LogRuntimeSpeechToFace, Log, TEXT("Deferring speech to face inference: %d of %d requests running, %.1f ms of inference time available, frame time %.1f ms, budget at %.0f%%"),
+					NumRunning.load(), MaxRunning, Tokens, SmoothedFrameMs, Scale * 100.0);
+			}
+		}
+	}
+
+	static bool IsEnabled(const URuntimeSpeechToFaceSettings* Settings)
+	{
+		return Settings->InferenceCoreShare > 0.0f || Settings->InferenceBudgetPerFrame > 0.0f || Settings->TargetFrameTime > 0.0f;
+	}
+
+	int32 GetMaxRunning(const URuntimeSpeechToFaceSettings* Settings) const
+	{
+		int32 Limit = FMath::Max(Settings->InferenceThreadCount, 1);
+		if (Settings->InferenceCoreShare > 0.0f)
+		{
+			Limit = FMath::Min(Limit, FMath::FloorToInt32(Settings->InferenceCoreShare * FPlatformMisc::NumberOfCoresIncludingHyperthreads()));
+		}
+		return FMath::Max(FMath::FloorToInt32(Limit * Scale), 1);
+	}
+
+	bool Tick(float DeltaTime)
+	{
+		FScopeLock Lock(&CriticalSection);
+		const URuntimeSpeechToFaceSettings* Settings = GetDefault<URuntimeSpeechToFaceSettings>();
+		const double Now = FPlatformTime::Seconds();
+		const double FrameMs = (Now - LastTickTime) * 1000.0;
+		LastTickTime = Now;
+		SmoothedFrameMs = SmoothedFrameMs > 0.0 ? FMath::Lerp(SmoothedFrameMs, FrameMs, 0.1) : FrameMs;
+
+		// Cut the budget quickly while frames run long, grow it back slowly while they have headroom
+		if (Settings->TargetFrameTime > 0.0f)
+		{
+			if (SmoothedFrameMs > Settings->TargetFrameTime * 1.05 && Now - LastScaleDownTime > GovernorScaleDownInterval)
+			{
+				Scale = FMath::Max(Scale * 0.75, GovernorMinScale);
+				LastScaleDownTime = Now;
+			}
+			else if (SmoothedFrameMs < Settings->TargetFrameTime * 0.9)
+			{
+				Scale = FMath::Min(Scale + 0.02, 1.0);
+			}
+		}
+		else
+		{
+			Scale = 1.0;
+		}
+		MaxRunning = GetMaxRunning(Settings);
+
+		// Without a set budget every running request may use its whole thread, so only the adapted scale limits them
+		const double BudgetMs = (Settings->InferenceBudgetPerFrame > 0.0f ? Settings->InferenceBudgetPerFrame : FrameMs * MaxRunning) * Scale;
+		const double SpentMs = CompletedMicroseconds.exchange(0) / 1000.0;
+		Tokens = FMath::Min(Tokens + BudgetMs - SpentMs, BudgetMs * GovernorMaxBurstFrames);
+
+		Dispatch(Settings);
+		return true;
+	}
+
+	void Dispatch(const URuntimeSpeechToFaceSettings* Settings)
+	{
+		const bool bEnabled = IsEnabled(Settings);
+		while (Deferred.Num() > 0 && (!bEnabled || (NumRunning.load() < MaxRunning && Tokens >= 0.0)))
+		{
+			FSpeechToFaceInferenceWork Work = MoveTemp(Deferred[0]);
+			Deferred.RemoveAt(0, 1, EAllowShrinking::No);
+			Run(MoveTemp(Work), Settings);
+		}
+
+		if (Deferred.Num() == 0 && DeferredSince > 0.0)
+		{
+			UE_LOG(LogRuntimeSpeechToFace, Log, TEXT("Deferred speech to face inference caught up after %.2f s"), FPlatformTime::Seconds() - DeferredSince);
+			DeferredSince = 0.0;
+		}
+	}
+
+	void Run(FSpeechToFaceInferenceWork&& Work, const URuntimeSpeechToFaceSettings* Settings)
+	{
+		if (!InferenceThreadPool)
+		{
+			InferenceThreadPool = FQueuedThreadPool::Allocate();
+			verify(InferenceThreadPool->Create(FMath::Max(Settings->InferenceThreadCount, 1), 128 * 1024, ToThreadPriority(Settings->InferenceThreadPriority), TEXT("SpeechToFaceInference")));
+		}
+
+		NumRunning.fetch_add(1);
+		const uint64 AffinityMask = static_cast<uint64>(Settings->InferenceThreadAffinityMask);
+		FSpeechToFaceInferenceWork QueuedWork;
+		QueuedWork.Work = [this, AffinityMask, Work = MoveTemp(Work.Work)]()
+			{
+				// Pool threads only ever run inference, so the mask can stay set between tasks
+				if (AffinityMask != 0)
+				{
+					FPlatformProcess::SetThreadAffinityMask(AffinityMask);
+				}
+				const uint64 StartCycles = FPlatformTime::Cycles64();
+				Work();
+				CompletedMicroseconds.fetch_add(static_cast<int64>(FPlatformTime::ToMilliseconds64(FPlatformTime::Cycles64() - StartCycles) * 1000.0));
+				NumRunning.fetch_sub(1);
+			};
+		QueuedWork.OnAbandoned = [this, OnAbandoned = MoveTemp(Work.OnAbandoned)]()
+			{
+				OnAbandoned();
+				NumRunning.fetch_sub(1);
+			};
+		InferenceThreadPool->AddQueuedWork(new FSpeechToFaceQueuedInference(MoveTemp(QueuedWork)));
+	}
+
+	// Guards everything but the counters updated by the inference threads
+	FCriticalSection CriticalSection;
+
+	TArray<FSpeechToFaceInferenceWork> Deferred;
+	std::atomic<int32> NumRunning = 0;
+	std::atomic<int64> CompletedMicroseconds = 0;
+
+	// Inference time in milliseconds that may still be spent, work starts while it is not negative
+	double Tokens = 0.0;
+	double Scale = 1.0;
+	int32 MaxRunning = 1;
+
+	double SmoothedFrameMs = 0.0;
+	double LastTickTime = 0.0;
+	double LastScaleDownTime = 0.0;
+	double DeferredSince = 0.0;
+	int64 TotalDeferred = 0;
+
+	FTSTicker::FDelegateHandle TickerHandle;
+
+	// Set by Shutdown, no work runs after it
+	bool bShutDown = false;
+};
+
+static FSpeechToFaceInferenceGovernor InferenceGovernor;
+
+void SpeechToFacePipeline::LaunchInference(TUniqueFunction<void()>&& Work, TUniqueFunction<void()>&& OnAbandoned)
+{
+	InferenceGovernor.Launch(FSpeechToFaceInferenceWork{ MoveTemp(Work), MoveTemp(OnAbandoned) });
+}
+
+void SpeechToFacePipeline::ShutdownInferenceThreadPool()
+{
+	InferenceGovernor.Shutdown();
+}
+
+FSpeechToFaceGovernorStats SpeechToFacePipeline::GetInferenceGovernorStats()
+{
+	return InferenceGovernor.GetStats();
+}
+
+void FSpeechToFaceAnimationData::BuildCurves(TArray<FFloatCurve>& OutCurves) const
+{
+	const int32 NumFrames = GetNumFrames();
+
+	OutCurves.Reset(CurveNames.Num());
+	for (const FName& CurveName : CurveNames)
+	{
+		FFloatCurve& Curve = OutCurves.Add_GetRef(FFloatCurve(CurveName, 0));
+		Curve.FloatCurve.Keys.Reserve(NumFrames);
+	}
+
+	for (int32 FrameIndex = 0; FrameIndex < NumFrames; ++FrameIndex)
+	{
+		const float FrameTime = FrameIndex / FrameRate;
+		for (int32 CurveIndex = 0; CurveIndex < CurveNames.Num(); ++CurveIndex)
+		{
+			OutCurves[CurveIndex].FloatCurve.AddKey(FrameTime, Values[FrameIndex * CurveNames.Num() + CurveIndex]);
+		}
+	}
+}
+
+void FSpeechToFaceAnimationData::TrimToRange(float StartTime, float Duration)
+{
+	const int32 NumCurves = CurveNames.Num();
+	const int32 NumFrames = GetNumFrames();
+	const int32 FirstFrame = FMath::Clamp(FMath::RoundToInt32(StartTime * FrameRate), 0, NumFrames);
+	const int32 NumKeptFrames = FMath::Clamp(FMath::CeilToInt32(Duration * FrameRate) + 1, 0, NumFrames - FirstFrame);
+	if (FirstFrame > 0)
+	{
+		Values.RemoveAt(0, FirstFrame * NumCurves, EAllowShrinking::No);
+	}
+	Values.SetNum(NumKeptFrames * NumCurves, EAllowShrinking::No);
+}
+
+static bool GetImportedSoundWaveData(USoundWave* SoundWave, float StartTime, float EndTime, TArray<uint8>& OutRawPCMData, uint32& OutSampleRate, uint16& OutNumChannels, ESpeechSampleFormat& OutSampleFormat)
+{
+	if (!SoundWave)
+	{
+		return false;
+	}
+	OutSampleRate = SoundWave->GetSampleRateForCurrentPlatform();
+	OutNumChannels = SoundWave->NumChannels;
+	OutSampleFormat = ESpeechSampleFormat::Int16;
+
+	StartTime = FMath::Max(StartTime, 0.0f);
+	const bool bHasEndTime = EndTime > StartTime;
+
+	// Procedural waves other than USpeechSoundWave are rendered by the audio thread, pulling from them here would race it and take its audio.
+	// Their audio reaches the pipeline through a submix instead.
+	if (SoundWave->bProcedural)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Cannot read audio from procedural sound wave %s, capture the submix it plays on with URuntimeSpeechToFaceLiveSession instead"), *SoundWave->GetName());
+		return false;
+	}
+
+	const float SpanEndTime = bHasEndTime ? FMath::Min(EndTime, SoundWave->Duration) : SoundWave->Duration;
+	const int32 FrameByteSize = GetSpeechSampleByteSize(OutSampleFormat) * OutNumChannels;
+	const int32 SkipLen = FMath::FloorToInt(StartTime * OutSampleRate) * FrameByteSize;
+	int BufferLen = FMath::CeilToInt(SpanEndTime * OutSampleRate) * FrameByteSize - SkipLen;
+	if (BufferLen <= 0)
+	{
+		return false;
+	}
+	OutRawPCMData.Reserve(BufferLen);
+
+	FName RuntimeFormat = SoundWave->GetRuntimeFormat();
+	TArray<uint8> RawPCMData;
+
+	FByteBulkData* BulkData = SoundWave->GetCompressedData(RuntimeFormat);
+	if (!BulkData || BulkData->GetBulkDataSize() <= 0)
+	{
+		return false;
+	}
+
+	const void* CompressedData = BulkData->LockReadOnly();
+	int32 CompressedDataSize = BulkData->GetBulkDataSize();
+
+	ICompressedAudioInfo* AudioInfo = IAudioInfoFactoryRegistry::Get().Create(SoundWave->GetRuntimeFormat());
+
+	if (!AudioInfo)
+	{
+		BulkData->Unlock();
+		return false;
+	}
+
+	FSoundQualityInfo QualityInfo = { 0 };
+
+	// Get the header information of our compressed format
+	if (!AudioInfo->StreamCompressedInfo(SoundWave, &QualityInfo))
+	{
+		BulkData->Unlock();
+		return false;
+	}
+
+	// Decoding starts at the span instead of decoding and dropping everything before it
+	if (StartTime > 0.0f)
+	{
+		AudioInfo->SeekToTime(StartTime);
+	}
+
+	// Stream read
+	while (OutRawPCMData.Num() < BufferLen)
+	{
+		int32 NumBytesStreamed = FMath::Min(StreamBufferSize, BufferLen - OutRawPCMData.Num());
+		int OldSize = OutRawPCMData.Num();
+		OutRawPCMData.AddZeroed(NumBytesStreamed);
+		AudioInfo->StreamCompressedData(OutRawPCMData.GetData() + OldSize, false, NumBytesStreamed, NumBytesStreamed);
+	}
+
+	delete AudioInfo;
+	BulkData->Unlock();
+	
+	return true;
+}
+
+// Point the audio at the span of the stored audio of a speech sound wave, which is read as the pipeline goes through it
+static void GetSpeechSoundWaveAudio(USpeechSoundWave* SoundWave, float StartTime, float EndTime, FSpeechAudioData& OutAudio)
+{
+	OutAudio.Buffer = SoundWave->GetAudioBuffer();
+	OutAudio.SampleFormat = OutAudio.Buffer ? OutAudio.Buffer->GetSampleFormat() : SoundWave->GetSampleFormat();
+	OutAudio.SampleRate = SoundWave->GetSampleRateForCurrentPlatform();
+	OutAudio.NumChannels = SoundWave->NumChannels;
+	OutAudio.Name = SoundWave->GetName();
+	if (!OutAudio.Buffer)
+	{
+		return;
+	}
+
+	StartTime = FMath::Max(StartTime, 0.0f);
+	const int64 FrameByteSize = GetSpeechSampleByteSize(OutAudio.SampleFormat) * FMath::Max<int32>(OutAudio.NumChannels, 1);
+	const int64 BufferFrames = OutAudio.Buffer->GetNumBytes() / FrameByteSize;
+	const int64 FirstFrame = FMath::Clamp<int64>(FMath::FloorToInt64(StartTime * OutAudio.SampleRate), 0, BufferFrames);
+	const int64 EndFrame = EndTime > StartTime ? FMath::Clamp<int64>(FMath::CeilToInt64(EndTime * OutAudio.SampleRate), FirstFrame, BufferFrames) : BufferFrames;
+	OutAudio.BufferOffset = FirstFrame * FrameByteSize;
+	OutAudio.BufferNumBytes = (EndFrame - FirstFrame) * FrameByteSize;
+}
+
+bool SpeechToFacePipeline::GetSoundWaveAudio(USoundWave* SoundWave, FSpeechAudioData& OutAudio, float StartTime, float EndTime)
+{
+	if (USpeechSoundWave* SpeechSoundWave = Cast<USpeechSoundWave>(SoundWave))
+	{
+		GetSpeechSoundWaveAudio(SpeechSoundWave, StartTime, EndTime, OutAudio);
+		return true;
+	}
+
+	uint32 SampleRate = 0;
+	uint16 NumChannels = 0;
+	if (!GetImportedSoundWaveData(SoundWave, StartTime, EndTime, OutAudio.PCMData, SampleRate, NumChannels, OutAudio.SampleFormat))
+	{
+		return false;
+	}
+	OutAudio.SampleRate = SampleRate;
+	OutAudio.NumChannels = NumChannels;
+	OutAudio.Name = SoundWave->GetName();
+	return true;
+}
+
+// Converts WAV sample data to one of the formats speech audio is kept in. 16 bit and float data is kept as is,
+// every other bit depth is converted to float once here so playback and inference never have to.
+static bool ConvertWavSampleData(const FWaveModInfo& WaveInfo, FSpeechAudioData& OutAudio)
+{
+	const uint16 FormatTag = *WaveInfo.pFormatTag;
+	const uint16 BitsPerSample = *WaveInfo.pBitsPerSample;
+	const uint8* SampleData = WaveInfo.SampleDataStart;
+	const int32 SampleDataSize = WaveInfo.SampleDataSize;
+
+	// WAVE_FORMAT_IEEE_FLOAT, or WAVE_FORMAT_EXTENSIBLE which is used by most tools for 32 bit float files
+	const bool bIsFloat = FormatTag == 3 || (FormatTag == 0xFFFE && BitsPerSample == 32);
+
+	if (BitsPerSample == 16 && !bIsFloat)
+	{
+		OutAudio.SampleFormat = ESpeechSampleFormat::Int16;
+		OutAudio.PCMData.SetNumUninitialized(SampleDataSize);
+		FMemory::Memcpy(OutAudio.PCMData.GetData(), SampleData, SampleDataSize);
+		return true;
+	}
+
+	if (BitsPerSample == 32 && bIsFloat)
+	{
+		OutAudio.SampleFormat = ESpeechSampleFormat::Float32;
+		OutAudio.PCMData.SetNumUninitialized(SampleDataSize);
+		FMemory::Memcpy(OutAudio.PCMData.GetData(), SampleData, SampleDataSize);
+		return true;
+	}
+
+	const int32 NumSamples = SampleDataSize / (BitsPerSample / 8);
+	OutAudio.SampleFormat = ESpeechSampleFormat::Float32;
+	OutAudio.PCMData.SetNumUninitialized(NumSamples * sizeof(float));
+	float* OutSamples = reinterpret_cast<float*>(OutAudio.PCMData.GetData());
+
+	switch (BitsPerSample)
+	{
+	case 8:
+		for (int32 SampleIndex = 0; SampleIndex < NumSamples; ++SampleIndex)
+		{
+			OutSamples[SampleIndex] = (SampleData[SampleIndex] - 128) / 128.0f;
+		}
+		return true;
+	case 24:
+		for (int32 SampleIndex = 0; SampleIndex < NumSamples; ++SampleIndex)
+		{
+			const uint8* Sample = SampleData + SampleIndex * 3;
+			// Place the little endian 24 bit value in the top bytes of an int32 to sign extend it
+			const int32 Value = (Sample[0] << 8) | (Sample[1] << 16) | (Sample[2] << 24);
+			OutSamples[SampleIndex] = Value / 2147483648.0f;
+		}
+		return true;
+	case 32:
+		for (int32 SampleIndex = 0; SampleIndex < NumSamples; ++SampleIndex)
+		{
+			int32 Value;
+			FMemory::Memcpy(&Value, SampleData + SampleIndex * sizeof(int32), sizeof(int32));
+			OutSamples[SampleIndex] = Value / 2147483648.0f;
+		}
+		return true;
+	default:
+		UE_LOG(LogRuntimeSpeechToFace, Error, TEXT("Unsupported wave format %d with %d bits per sample"), FormatTag, BitsPerSample);
+		OutAudio.PCMData.Reset();
+		return false;
+	}
+}
+
+bool SpeechToFacePipeline::DecodeWav(const TArray<uint8>& WavData, FSpeechAudioData& OutAudio)
+{
+	FWaveModInfo WaveInfo;
+	FString ErrorMessage;
+	if (!WaveInfo.ReadWaveInfo(WavData.GetData(), WavData.Num(), &ErrorMessage))
+	{
+		UE_LOG(LogRuntimeSpeechToFace, Error, TEXT("Unable to read wave file - \"%s\""), *ErrorMessage);
+		return false;
+	}
+
+	const int32 ChannelCount = *WaveInfo.pChannels;
+	if (ChannelCount <= 0 || *WaveInfo.pBitsPerSample / 8 <= 0)
+	{
+		UE_LOG(LogRuntimeSpeechToFace, Error, TEXT("Unsupported wave file with %d channels and %d bits per sample"), ChannelCount, *WaveInfo.pBitsPerSample);
+		return false;
+	}
+	OutAudio.SampleRate = *WaveInfo.pSamplesPerSec;
+	OutAudio.NumChannels = ChannelCount;
+	return ConvertWavSampleData(WaveInfo, OutAudio);
+}
+
+static bool DecodeOgg(const TArray<uint8>& OggData, FSpeechAudioData& OutAudio)
+{
+	FVorbisAudioInfo AudioInfo;
+	FSoundQualityInfo QualityInfo;
+	if (!AudioInfo.ReadCompressedInfo(OggData.GetData(), OggData.Num(), &QualityInfo))
+	{
+		return false;
+	}
+	OutAudio.PCMData.SetNumUninitialized(QualityInfo.SampleDataSize);
+	AudioInfo.ReadCompressedData(OutAudio.PCMData.GetData(), false, QualityInfo.SampleDataSize);
+	OutAudio.SampleFormat = ESpeechSampleFormat::Int16;
+	OutAudio.SampleRate = QualityInfo.SampleRate;
+	OutAudio.NumChannels = QualityInfo.NumChannels;
+	return true;
+}
+
+bool SpeechToFacePipeline::DecodeAudioFile(const FString& FilePath, const TArray<uint8>& FileContent, FSpeechAudioData& OutAudio)
+{
+	bool bSuccess = false;
+	if (FilePath.ToLower().EndsWith(".wav"))
+	{
+		bSuccess = DecodeWav(FileContent, OutAudio);
+	}
+	else if (FilePath.ToLower().EndsWith(".ogg"))
+	{
+		bSuccess = DecodeOgg(FileContent, OutAudio);
+	}
+	if (!bSuccess)
+	{
+		return false;
+	}
+
+	OutAudio.Name = FPaths::GetBaseFilename(FilePath);
+	return true;
+}
+
+static bool ResampleAudio(FloatSamples& InSamples, int32 InSampleRate, int32 InResampleRate, FloatSamples& OutResampledSamples)
+{
+	const Audio::FResamplingParameters Params = {
+		Audio::EResamplingMethod::Linear,
+		1, // NumChannels
+		static_cast<float>(InSampleRate),
+		static_cast<float>(InResampleRate),
+		InSamples
+	};
+
+	const int32 ExpectedSampleCount = GetOutputBufferSize(Params);
+	OutResampledSamples.SetNumUninitialized(ExpectedSampleCount, EAllowShrinking::No);
+
+	Audio::FResamplerResults Result;
+	Result.OutBuffer = &OutResampledSamples;
+
+	const bool bIsSuccess = Audio::Resample(Params, Result);
+	if (!bIsSuccess)
+	{
+		return false;
+	}
+
+	if (Result.OutputFramesGenerated != ExpectedSampleCount)
+	{
+		OutResampledSamples.SetNum(Result.OutputFramesGenerated, EAllowShrinking::No);
+	}
+
+	return true;
+}
+
+// Frames of streamed audio decoded at a time
+static constexpr int32 StreamBlockFrames = 4096;
+
+void FSpeechAudioData::ForEachBlock(TFunctionRef<void(const uint8* Data, int32 NumBytes)> Visitor) const
+{
+	if (!Buffer)
+	{
+		if (PCMData.Num() > 0)
+		{
+			Visitor(PCMData.GetData(), PCMData.Num());
+		}
+		return;
+	}
+
+	// Blocks hold whole frames, so visitors never see a frame split across two of them
+	TArray<uint8> Block;
+	Block.SetNumUninitialized(StreamBlockFrames * GetSpeechSampleByteSize(SampleFormat) * FMath::Max<int32>(NumChannels, 1));
+
+	FSpeechAudioReader Reader;
+	Reader.SetBuffer(Buffer);
+	Reader.Seek(BufferOffset);
+	int64 NumBytesLeft = BufferNumBytes;
+	while (NumBytesLeft > 0)
+	{
+		const int32 NumBytesRead = Reader.Read(Block.GetData(), static_cast<int32>(FMath::Min<int64>(NumBytesLeft, Block.Num())));
+		if (NumBytesRead <= 0)
+		{
+			break;
+		}
+		Visitor(Block.GetData(), NumBytesRead);
+		NumBytesLeft -= NumBytesRead;
+	}
+}
+
+static float ReadPcmSample(const uint8* SampleData, bool bIsFloat)
+{
+	if (bIsFloat)
+	{
+		float Sample;
+		FMemory::Memcpy(&Sample, SampleData, sizeof(Sample));
+		return Sample;
+	}
+
+	int16 Sample;
+	FMemory::Memcpy(&Sample, SampleData, sizeof(Sample));
+	// Convert to range [-1.0, 1.0)
+	return Sample / 32768.0f;
+}
+
+// Convert the audio to mono float samples at the encoder rate, into OutSamples. SourceSamples holds the samples at the source rate when they need resampling.
+static bool GetFloatSamples(const FSpeechAudioData& Audio, bool bDownmixChannels, uint32 ChannelToUse, float SecondsToSkip, FloatSamples& SourceSamples, FloatSamples& OutSamples)
+{
+	const ESpeechSampleFormat SampleFormat = Audio.SampleFormat;
+	const uint32 SampleRate = Audio.SampleRate;
+	const bool bIsFloat = SampleFormat == ESpeechSampleFormat::Float32;
+	const uint32 SampleSize = GetSpeechSampleByteSize(SampleFormat);
+	const uint32 FrameSize = SampleSize * Audio.NumChannels;
+	const uint32 TotalSampleCount = Audio.GetNumBytes() / SampleSize;
+	const uint32 TotalSamplesToSkip = SecondsToSkip * SampleRate * Audio.NumChannels;
+	if (TotalSamplesToSkip >= TotalSampleCount)
+	{
+		UE_LOG(LogTemp, Error, TEXT("Could not get float samples with %d skipped samples from %d samples for SoundWave %s"), TotalSamplesToSkip, TotalSampleCount, *Audio.Name);
+		return false;
+	}
+
+	const uint32 SamplesToSkipPerChannel = SecondsToSkip * SampleRate;
+	const uint32 SampleCountPerChannel = Audio.GetNumBytes() / FrameSize - SamplesToSkipPerChannel;
+
+	// Audio already at the encoder rate is converted straight into the encoder input
+	const bool bNeedsResampling = SampleRate != AudioEncoderSampleRateHz;
+	FloatSamples& ConvertedSamples = bNeedsResampling ? SourceSamples : OutSamples;
+	ConvertedSamples.SetNumUninitialized(SampleCountPerChannel, EAllowShrinking::No);
+
+	// Audio data is stored as 16 bit signed or float samples with channels interleaved so that must be taken into account.
+	// It arrives a block of whole frames at a time, decoded as it goes for audio streamed from a speech sound wave.
+	const bool bDownmix = bDownmixChannels && Audio.NumChannels > 1;
+	int64 BytesToSkip = static_cast<int64>(SamplesToSkipPerChannel) * FrameSize;
+	uint32 NumSamplesDone = 0;
+	Audio.ForEachBlock([&](const uint8* BlockData, int32 BlockNumBytes)
+		{
+			if (BytesToSkip >= BlockNumBytes)
+			{
+				BytesToSkip -= BlockNumBytes;
+				return;
+			}
+			const uint8* PcmDataPtr = BlockData + BytesToSkip;
+			const uint32 NumSamples = FMath::Min<uint32>((BlockNumBytes - BytesToSkip) / FrameSize, SampleCountPerChannel - NumSamplesDone);
+			BytesToSkip = 0;
+			float* OutData = ConvertedSamples.GetData() + NumSamplesDone;
+			NumSamplesDone += NumSamples;
+
+			if (bDownmix)
+			{
+				// Average the channels, in place of mixing through a temporary sample buffer
+				const float ChannelGain = 1.0f / Audio.NumChannels;
+				for (uint32 SampleIndex = 0; SampleIndex < NumSamples; SampleIndex++)
+				{
+					float MixedSample = 0.0f;
+					for (uint32 ChannelIndex = 0; ChannelIndex < Audio.NumChannels; ChannelIndex++)
+					{
+						MixedSample += ReadPcmSample(PcmDataPtr, bIsFloat);
+						PcmDataPtr += SampleSize;
+					}
+					OutData[SampleIndex] = MixedSample * ChannelGain;
+				}
+			}
+			else if (bIsFloat && Audio.NumChannels == 1)
+			{
+				// Float mono data is already what the encoder consumes
+				FMemory::Memcpy(OutData, PcmDataPtr, NumSamples * sizeof(float));
+			}
+			else
+			{
+				for (uint32 SampleIndex = 0; SampleIndex < NumSamples; SampleIndex++)
+				{
+					// Position ourselves at the sample of appropriate channel, taking into account the channel layout
+					OutData[SampleIndex] = ReadPcmSample(PcmDataPtr + ChannelToUse * SampleSize, bIsFloat);
+					PcmDataPtr += FrameSize;
+				}
+			}
+		});
+	ConvertedSamples.SetNum(NumSamplesDone, EAllowShrinking::No);
+
+	if (bDownmix)
+	{
+		const float MaxValue = Audio::ArrayMaxAbsValue(ConvertedSamples);
+		if (MaxValue > 1.f)
+		{
+			Audio::ArrayMultiplyByConstantInPlace(ConvertedSamples, 1.f / MaxValue);
+		}
+	}
+
+	if (bNeedsResampling)
+	{
+		if (!ResampleAudio(SourceSamples, SampleRate, AudioEncoderSampleRateHz, OutSamples))
+		{
+			UE_LOG(LogTemp, Error, TEXT("Could not resample audio from %d to %d for SoundWave %s"), SampleRate, AudioEncoderSampleRateHz, *Audio.Name);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// Smallest shape bucket that fits NumSamples, null when the input is longer than every bucket
+static const FSpeechToFaceShapeBucket* FindShapeBucket(const FSpeechToFaceModelInstances& Models, int32 NumSamples)
+{
+	for (const FSpeechToFaceShapeBucket& Bucket : Models.ShapeBuckets)
+	{
+		if (Bucket.NumSamples >= NumSamples)
+		{
+			return &Bucket;
+		}
+	}
+	return nullptr;
+}
+
+// Copy Data into Padded and fill the rest of its NumPadded values with zeros
+static const float* PadInput(TArrayView<const float> Data, int32 NumPadded, TArray<float>& Padded)
+{
+	Padded.SetNumUninitialized(NumPadded, EAllowShrinking::No);
+	FMemory::Memcpy(Padded.GetData(), Data.GetData(), Data.Num() * sizeof(float));
+	FMemory::Memzero(Padded.GetData() + Data.Num(), (NumPadded - Data.Num()) * sizeof(float));
+	return Padded.GetData();
+}
+
+static bool ExtractAudioFeatures(TArrayView<const float> Samples, const FSpeechToFaceModelInstances& Models, TArray<float>& OutAudioData)
+{
+	using namespace UE::NNE;
+
+	FSpeechToFaceScratch& Scratch = *Models.Scratch;
+
+	// Todo: last frame of the last chunk will not be complete (if not multiple of SamplesPerFrame). Should we ceil/pad/0-fill? 
+	uint32 TotalNumFrames = 0;
+	uint32 PaddedNumFrames = 0;
+	for (int32 SampleIndex = 0; SampleIndex < Samples.Num(); SampleIndex += RigLogicPredictorMaxAudioSamples)
+	{
+		const uint32 SamplesCount = FMath::Clamp(Samples.Num() - SampleIndex, 0, RigLogicPredictorMaxAudioSamples);
+		const FSpeechToFaceShapeBucket* Bucket = FindShapeBucket(Models, static_cast<int32>(SamplesCount));
+		PaddedNumFrames = TotalNumFrames + static_cast<uint32>((Bucket ? Bucket->NumSamples : SamplesCount) / SamplesPerFrame);
+		TotalNumFrames += static_cast<uint32>(SamplesCount / SamplesPerFrame);
+	}
+
+	// Every chunk writes straight into its slice of the output. The last chunk may be padded to its bucket,
+	// its extra frames are written past the end and trimmed afterwards.
+	OutAudioData.SetNumUninitialized(PaddedNumFrames * 512, EAllowShrinking::No);
+	uint32 FrameOffset = 0;
+
+	// Restrict extracting of audio features to 30 second chunks as the model does not support more
+	for (int32 SampleIndex = 0; SampleIndex < Samples.Num(); SampleIndex += RigLogicPredictorMaxAudioSamples)
+	{
+		const uint32 SamplesCount = FMath::Clamp(Samples.Num() - SampleIndex, 0, RigLogicPredictorMaxAudioSamples);
+
+		// Run on the instance pinned to the bucket, so its input shape is the same on every run
+		const FSpeechToFaceShapeBucket* Bucket = FindShapeBucket(Models, static_cast<int32>(SamplesCount));
+		const TSharedPtr<IModelInstanceCPU>& AudioExtractor = Bucket ? Bucket->AudioExtractor : Models.AudioExtractor;
+		const uint32 RunSamplesCount = Bucket ? Bucket->NumSamples : SamplesCount;
+		const float* InputData = Samples.GetData() + SampleIndex;
+		if (RunSamplesCount != SamplesCount)
+		{
+			InputData = PadInput(MakeArrayView(InputData, SamplesCount), RunSamplesCount, Scratch.PaddedInput);
+		}
+
+		TArray<uint32, TInlineAllocator<2>> ExtractorInputShapesData = { 1, RunSamplesCount };
+		TArray<FTensorShape, TInlineAllocator<1>> ExtractorInputShapes = { FTensorShape::Make(ExtractorInputShapesData) };
+		if (AudioExtractor->SetInputTensorShapes(ExtractorInputShapes) != IModelInstanceCPU::ESetInputTensorShapesStatus::Ok)
+		{
+			UE_LOG(LogTemp, Error, TEXT("Could not set the audio extractor input tensor shapes"));
+			return false;
+		}
+
+		const uint32 NumFrames = static_cast<uint32>(SamplesCount / SamplesPerFrame);
+		const uint32 RunNumFrames = static_cast<uint32>(RunSamplesCount / SamplesPerFrame);
+		float* ExtractorOutputData = OutAudioData.GetData() + FrameOffset * 512;
+
+		TArray<FTensorBindingCPU, TInlineAllocator<1>> ExtractorInputBindings = { {(void*)InputData, RunSamplesCount * sizeof(float)} };
+		TArray<FTensorBindingCPU, TInlineAllocator<1>> ExtractorOutputBindings = { {(void*)ExtractorOutputData, RunNumFrames * 512 * sizeof(float)} };
+		if (AudioExtractor->RunSync(ExtractorInputBindings, ExtractorOutputBindings) != IModelInstanceCPU::ESetInputTensorShapesStatus::Ok)
+		{
+			UE_LOG(LogTemp, Error, TEXT("The audio extractor NNE model failed to execute"));
+			return false;
+		}
+
+		FrameOffset += NumFrames;
+	}
+
+	OutAudioData.SetNum(TotalNumFrames * 512, EAllowShrinking::No);
+	return true;
+}
+
+// Outputs are bound directly, so the predicted values land in the views without an intermediate copy
+static bool RunPredictor(
+	const TSharedPtr<UE::NNE::IModelInstanceCPU>& RigLogicPredictor,
+	const uint32 InFaceControlNum,
+	const uint32 InBlinkControlNum,
+	const uint32 InSamplesNum,
+	TArrayView<const float> InAudioData,
+	const EAudioDrivenAnimationMood& Mood,
+	const float DesiredMoodIntensity,
+	TArrayView<float> OutRigLogicValues,
+	TArrayView<float> OutRigLogicBlinkValues,
+	TArrayView<float> OutRigLogicHeadValues
+)
+{
+	using namespace UE::NNE;
+
+	const uint32 NumFrames = static_cast<uint32>(InSamplesNum / SamplesPerFrame);
+	TArray<uint32, TInlineAllocator<3>> AudioShapeData = { 1, NumFrames, 512 };
+
+	int32 MoodIndex = Mood == EAudioDrivenAnimationMood::AutoDetect ? -1 : static_cast<int32>(Mood);
+	const TArray<int32, TInlineAllocator<1>> MoodIndexArray = { MoodIndex, };
+	TArray<uint32, TInlineAllocator<1>> MoodIndexShapeData = { 1, };
+
+	const TArray<float, TInlineAllocator<1>> MoodIntensityArray = { DesiredMoodIntensity, };
+	TArray<uint32, TInlineAllocator<1>> MoodIntensityShapeData = { 1, };
+
+	TArray<FTensorShape, TInlineAllocator<3>> InputTensorShapes = {
+		FTensorShape::Make(AudioShapeData),
+		FTensorShape::Make(MoodIndexShapeData),
+		FTensorShape::Make(MoodIntensityShapeData)
+	};
+
+	check(RigLogicPredictor);
+
+	if (RigLogicPredictor->SetInputTensorShapes(InputTensorShapes) != IModelInstanceCPU::ESetInputTensorShapesStatus::Ok)
+	{
+		return false;
+	}
+
+	// Bind the inputs
+
+	// Tensor binding requires non-const void* - we're trusting it not to mutate the input data.
+	void* AudioDataPtr = const_cast<void*>(static_cast<const void*>(InAudioData.GetData()));
+	void* MoodIndexDataPtr = const_cast<void*>(static_cast<const void*>(MoodIndexArray.GetData()));
+	void* MoodIntensityDataPtr = const_cast<void*>(static_cast<const void*>(MoodIntensityArray.GetData()));
+
+	TArray<FTensorBindingCPU, TInlineAllocator<3>> InputBindings = {
+		{AudioDataPtr, InAudioData.Num() * sizeof(float)},
+		{MoodIndexDataPtr, MoodIndexArray.Num() * sizeof(float)},
+		{MoodIntensityDataPtr, MoodIntensityArray.Num() * sizeof(float)}
+	};
+
+	// Bind the outputs
+	const uint32 NumOutputHeadControls = static_cast<uint32>(ModelHeadControls.Num());
+	check(OutRigLogicValues.Num() == NumFrames * InFaceControlNum);
+	check(OutRigLogicBlinkValues.Num() == NumFrames * InBlinkControlNum);
+	check(OutRigLogicHeadValues.Num() == NumFrames * NumOutputHeadControls);
+
+	TArray<FTensorBindingCPU, TInlineAllocator<3>> OutputBindings = {
+		{OutRigLogicValues.GetData(), OutRigLogicValues.Num() * sizeof(float)},
+		{OutRigLogicBlinkValues.GetData(), OutRigLogicBlinkValues.Num() * sizeof(float)},
+		{OutRigLogicHeadValues.GetData(), OutRigLogicHeadValues.Num() * sizeof(float) }
+	};
+
+	if (RigLogicPredictor->RunSync(InputBindings, OutputBindings) != IModelInstanceCPU::ESetInputTensorShapesStatus::Ok)
+	{
+		UE_LOG(LogTemp, Error, TEXT("The rig logic model failed to execute"));
+		return false;
+	}
+
+	return true;
+}
+
+// Resample frame major predictor output to the output rate
+static void ResampleAnimation(TArrayView<const float> InRawAnimation, uint32 ControlNum, float InOutputFps, TArray<float>& OutResampledAnimation)
+{
+	const uint32 RawFrameCount = ControlNum > 0 ? InRawAnimation.Num() / ControlNum : 0;
+	const float AnimationLengthSec = RawFrameCount * RigLogicPredictorFrameDuration;
+	const uint32 ResampledFrameCount = RawFrameCount > 0 ? FMath::FloorToInt32(AnimationLengthSec * InOutputFps) : 0;
+
+	// Resample using linear interpolation
+	OutResampledAnimation.SetNumUninitialized(ResampledFrameCount * ControlNum, EAllowShrinking::No);
+
+	for (uint32 ResampledFrameIndex = 0; ResampledFrameIndex < ResampledFrameCount; ++ResampledFrameIndex)
+	{
+		// Get corresponding raw frame time
+		const float FrameStartSec = ResampledFrameIndex / InOutputFps;
+		const float RawFrameIndex = FMath::Clamp(FrameStartSec * RigLogicPredictorOutputFps, 0, RawFrameCount - 1);
+
+		// Get nearest full frames and distance between the two
+		const uint32 PrevRawFrameIndex = FMath::FloorToInt32(RawFrameIndex);
+		const uint32 NextRawFrameIndex = FMath::CeilToInt32(RawFrameIndex);
+		const float RawFramesDelta = RawFrameIndex - PrevRawFrameIndex;
+
+		// Add interpolated control values for the given frames
+		for (uint32 ControlIndex = 0; ControlIndex < ControlNum; ++ControlIndex)
+		{
+			const float PrevRawControlValue = InRawAnimation[PrevRawFrameIndex * ControlNum + ControlIndex];
+			const float NextRawControlValue = InRawAnimation[NextRawFrameIndex * ControlNum + ControlIndex];
+			OutResampledAnimation[ResampledFrameIndex * ControlNum + ControlIndex] = FMath::Lerp(PrevRawControlValue, NextRawControlValue, RawFramesDelta);
+		}
+	}
+}
+
+class FAudioFeatureCache
+{
+public:
+	TSharedPtr<const FSpeechAudioFeatures> Find(uint64 AudioHash)
+	{
+		FScopeLock Lock(&CriticalSection);
+		const TSharedPtr<const FSpeechAudioFeatures>* Features = Cache.FindAndTouch(AudioHash);
+		return Features ? *Features : nullptr;
+	}
+
+	void Add(uint64 AudioHash, const TSharedPtr<const FSpeechAudioFeatures>& Features, int32 MaxEntries)
+	{
+		FScopeLock Lock(&CriticalSection);
+		if (MaxEntries <= 0)
+		{
+			Cache.Empty();
+			return;
+		}
+		if (Cache.Max() != MaxEntries)
+		{
+			Cache.Empty(MaxEntries);
+		}
+		Cache.Add(AudioHash, Features);
+	}
+
+private:
+	FCriticalSection CriticalSection;
+	TLruCache<uint64, TSharedPtr<const FSpeechAudioFeatures>> Cache;
+};
+
+static FAudioFeatureCache AudioFeatureCache;
+
+// Find the voiced frame ranges [Start, End) of the samples. Short pauses stay inside a range and every range keeps
+// some context around the speech, so onsets and releases are predicted from the real audio.
+static void FindVoicedFrames(TArrayView<const float> Samples, const URuntimeSpeechToFaceSettings* Settings, TBitArray<>& VoicedFrames, TArray<TPair<int32, int32>>& OutRanges)
+{
+	OutRanges.Reset();
+
+	const int32 FrameSamples = static_cast<int32>(SamplesPerFrame);
+	const int32 NumFrames = Samples.Num() / FrameSamples;
+	if (!Settings->bSkipSilence)
+	{
+		if (NumFrames > 0)
+		{
+			OutRanges.Emplace(0, NumFrames);
+		}
+		return;
+	}
+
+	const float ThresholdSquared = FMath::Square(FMath::Pow(10.0f, Settings->SilenceThresholdDb / 20.0f));
+	VoicedFrames.Init(false, NumFrames);
+	for (int32 FrameIndex = 0; FrameIndex < NumFrames; ++FrameIndex)
+	{
+		float SumSquared = 0.0f;
+		for (const float Sample : Samples.Slice(FrameIndex * FrameSamples, FrameSamples))
+		{
+			SumSquared += Sample * Sample;
+		}
+		VoicedFrames[FrameIndex] = SumSquared / FrameSamples >= ThresholdSquared;
+	}
+
+	const int32 MinSilenceFrames = FMath::CeilToInt32(Settings->MinSilenceDuration * RigLogicPredictorOutputFps);
+	const int32 ContextFrames = FMath::CeilToInt32(Settings->SilenceContextDuration * RigLogicPredictorOutputFps);
+	int32 FrameIndex = 0;
+	while (FrameIndex < NumFrames)
+	{
+		if (!VoicedFrames[FrameIndex])
+		{
+			++FrameIndex;
+			continue;
+		}
+
+		// Extend the range over pauses shorter than the minimum silence
+		const int32 VoiceStart = FrameIndex;
+		int32 VoiceEnd = FrameIndex + 1;
+		for (FrameIndex = VoiceEnd; FrameIndex < NumFrames && FrameIndex - VoiceEnd < MinSilenceFrames; ++FrameIndex)
+		{
+			if (VoicedFrames[FrameIndex])
+			{
+				VoiceEnd = FrameIndex + 1;
+			}
+		}
+
+		const int32 RangeStart = FMath::Max(VoiceStart - ContextFrames, 0);
+		const int32 RangeEnd = FMath::Min(VoiceEnd + ContextFrames, NumFrames);
+		if (OutRanges.Num() > 0 && OutRanges.Last().Value >= RangeStart)
+		{
+			OutRanges.Last().Value = RangeEnd;
+		}
+		else
+		{
+			OutRanges.Emplace(RangeStart, RangeEnd);
+		}
+	}
+}
+
+// Convert one channel of the audio, or all channels mixed down with INDEX_NONE, to samples at the encoder rate
+static bool GetChannelSamples(const FSpeechAudioData& Audio, int32 Channel, FloatSamples& SourceSamples, FloatSamples& OutSamples, FString& OutError)
+{
+	if (Channel >= Audio.NumChannels)
+	{
+		OutError = FString::Printf(TEXT("RuntimeSpeechToFaceAsync: Channel %d is not in the %d channel audio."), Channel, Audio.NumChannels);
+		return false;
+	}
+	if (!GetFloatSamples(Audio, Channel == INDEX_NONE, FMath::Max(Channel, 0), 0, SourceSamples, OutSamples))
+	{
+		OutError = TEXT("RuntimeSpeechToFaceAsync: GetFloatSamples.");
+		return false;
+	}
+	return true;
+}
+
+// Extract the features of mono samples at the encoder rate
+static bool ExtractFeatures(const FSpeechToFaceModelInstances& Models, TConstArrayView<float> Samples, const FString& Name, FSpeechAudioFeatures& OutFeatures, FString& OutError)
+{
+	FSpeechToFaceScratch& Scratch = *Models.Scratch;
+	OutFeatures.NumSamples = Samples.Num();
+
+	// Step 2a: find the silence that does not need inference
+	FindVoicedFrames(Samples, GetDefault<URuntimeSpeechToFaceSettings>(), Scratch.VoicedFrames, Scratch.VoicedRanges);
+
+	// Step 2b: extract audio features of the voiced ranges. Reused features keep the buffers of their segments.
+	int32 NumVoicedFrames = 0;
+	OutFeatures.Segments.SetNum(Scratch.VoicedRanges.Num(), EAllowShrinking::No);
+	for (int32 SegmentIndex = 0; SegmentIndex < Scratch.VoicedRanges.Num(); ++SegmentIndex)
+	{
+		const TPair<int32, int32>& Range = Scratch.VoicedRanges[SegmentIndex];
+		FSpeechAudioFeatures::FSegment& Segment = OutFeatures.Segments[SegmentIndex];
+		Segment.StartFrame = Range.Key;
+		Segment.NumFrames = Range.Value - Range.Key;
+		NumVoicedFrames += Segment.NumFrames;
+
+		const int32 FrameSamples = static_cast<int32>(SamplesPerFrame);
+		TArrayView<const float> SegmentSamples = MakeArrayView(Samples.GetData() + Segment.StartFrame * FrameSamples, Segment.NumFrames * FrameSamples);
+		if (!ExtractAudioFeatures(SegmentSamples, Models, Segment.Values))
+		{
+			OutError = TEXT("RuntimeSpeechToFaceAsync: ExtractAudioFeatures.");
+			return false;
+		}
+	}
+
+	UE_LOG(LogRuntimeSpeechToFace, Verbose, TEXT("%s: running inference on %d of %d frames in %d segments"),
+		*Name, NumVoicedFrames, static_cast<int32>(Samples.Num() / SamplesPerFrame), OutFeatures.Segments.Num());
+	return true;
+}
+
+// Extract the features of one channel of the audio, or of all channels mixed down with INDEX_NONE
+static bool ExtractFeatures(const FSpeechToFaceModelInstances& Models, const FSpeechAudioData& Audio, int32 Channel, FSpeechAudioFeatures& OutFeatures, FString& OutError)
+{
+	FSpeechToFaceScratch& Scratch = *Models.Scratch;
+	if (!GetChannelSamples(Audio, Channel, Scratch.SourceSamples, Scratch.Samples, OutError))
+	{
+		return false;
+	}
+	return ExtractFeatures(Models, Scratch.Samples, Audio.Name, OutFeatures, OutError);
+}
+
+// Let the pose of silent frames decay towards neutral from the last predicted frame
+static void DecaySilentFrames(TArray<float>& Values, int32 NumControls, TConstArrayView<FSpeechAudioFeatures::FSegment> Segments, float DecayPerFrame)
+{
+	const int32 NumFrames = NumControls > 0 ? Values.Num() / NumControls : 0;
+	int32 SegmentIndex = 0;
+	for (int32 FrameIndex = 1; FrameIndex < NumFrames; ++FrameIndex)
+	{
+		while (SegmentIndex < Segments.Num() && Segments[SegmentIndex].StartFrame + Segments[SegmentIndex].NumFrames <= FrameIndex)
+		{
+			++SegmentIndex;
+		}
+		if (SegmentIndex < Segments.Num() && Segments[SegmentIndex].StartFrame <= FrameIndex)
+		{
+			continue;
+		}
+
+		for (int32 ControlIndex = 0; ControlIndex < NumControls; ++ControlIndex)
+		{
+			Values[FrameIndex * NumControls + ControlIndex] = Values[(FrameIndex - 1) * NumControls + ControlIndex] * DecayPerFrame;
+		}
+	}
+}
+
+static void ResetToNeutral(TArray<float>& Values, int32 NumValues)
+{
+	Values.SetNumUninitialized(NumValues, EAllowShrinking::No);
+	FMemory::Memzero(Values.GetData(), NumValues * sizeof(float));
+}
+
+// Run the predictor into Scratch.RigLogicValues, Scratch.RigLogicBlinkValues and Scratch.RigLogicHeadValues
+static bool RunPredictorOnSegments(const FSpeechToFaceModelInstances& Models, const FSpeechAudioFeatures& Features, const FSpeechToFaceParams& Params)
+{
+	FSpeechToFaceScratch& Scratch = *Models.Scratch;
+	const int32 NumFaceControls = RigControlNames.Num();
+	const int32 NumBlinkControls = BlinkRigControlNames.Num();
+	const int32 NumHeadControls = ModelHeadControls.Num();
+
+	// Segments padded to their bucket predict frames past their end, leave room for them after the clip
+	const int32 NumFrames = static_cast<int32>(Features.NumSamples / SamplesPerFrame);
+	int32 PaddedNumFrames = NumFrames;
+	for (const FSpeechAudioFeatures::FSegment& Segment : Features.Segments)
+	{
+		if (const FSpeechToFaceShapeBucket* Bucket = FindShapeBucket(Models, static_cast<int32>(Segment.NumFrames * SamplesPerFrame)))
+		{
+			PaddedNumFrames = FMath::Max(PaddedNumFrames, Segment.StartFrame + static_cast<int32>(Bucket->NumSamples / SamplesPerFrame));
+		}
+	}
+
+	// Silent frames start from the neutral pose
+	ResetToNeutral(Scratch.RigLogicValues, PaddedNumFrames * NumFaceControls);
+	ResetToNeutral(Scratch.RigLogicBlinkValues, PaddedNumFrames * NumBlinkControls);
+	ResetToNeutral(Scratch.RigLogicHeadValues, PaddedNumFrames * NumHeadControls);
+
+	// Each segment is predicted straight into its slice of the clip. Frames predicted for padding spill into the
+	// following frames, which later segments or the silence decay overwrite.
+	for (const FSpeechAudioFeatures::FSegment& Segment : Features.Segments)
+	{
+		const FSpeechToFaceShapeBucket* Bucket = FindShapeBucket(Models, static_cast<int32>(Segment.NumFrames * SamplesPerFrame));
+		const TSharedPtr<UE::NNE::IModelInstanceCPU>& RigLogicPredictor = Bucket ? Bucket->RigLogicPredictor : Models.RigLogicPredictor;
+		const int32 RunNumFrames = Bucket ? static_cast<int32>(Bucket->NumSamples / SamplesPerFrame) : Segment.NumFrames;
+
+		TArrayView<const float> AudioData = Segment.Values;
+		if (RunNumFrames != Segment.NumFrames)
+		{
+			AudioData = MakeArrayView(PadInput(Segment.Values, RunNumFrames * 512, Scratch.PaddedInput), RunNumFrames * 512);
+		}
+
+		const uint32 RunSamples = static_cast<uint32>(RunNumFrames * SamplesPerFrame);
+		if (!RunPredictor(RigLogicPredictor, NumFaceControls, NumBlinkControls, RunSamples, AudioData, Params.Mood, Params.MoodIntensity,
+			MakeArrayView(Scratch.RigLogicValues).Slice(Segment.StartFrame * NumFaceControls, RunNumFrames * NumFaceControls),
+			MakeArrayView(Scratch.RigLogicBlinkValues).Slice(Segment.StartFrame * NumBlinkControls, RunNumFrames * NumBlinkControls),
+			MakeArrayView(Scratch.RigLogicHeadValues).Slice(Segment.StartFrame * NumHeadControls, RunNumFrames * NumHeadControls)))
+		{
+			return false;
+		}
+	}
+
+	Scratch.RigLogicValues.SetNum(NumFrames * NumFaceControls, EAllowShrinking::No);
+	Scratch.RigLogicBlinkValues.SetNum(NumFrames * NumBlinkControls, EAllowShrinking::No);
+	Scratch.RigLogicHeadValues.SetNum(NumFrames * NumHeadControls, EAllowShrinking::No);
+
+	const float DecayTime = GetDefault<URuntimeSpeechToFaceSettings>()->SilenceDecayTime;
+	const float DecayPerFrame = DecayTime > 0.0f ? FMath::Exp(-RigLogicPredictorFrameDuration / DecayTime) : 0.0f;
+	DecaySilentFrames(Scratch.RigLogicValues, NumFaceControls, Features.Segments, DecayPerFrame);
+	DecaySilentFrames(Scratch.RigLogicBlinkValues, NumBlinkControls, Features.Segments, DecayPerFrame);
+	DecaySilentFrames(Scratch.RigLogicHeadValues, NumHeadControls, Features.Segments, DecayPerFrame);
+	return true;
+}
+
+uint64 SpeechToFacePipeline::HashAudio(const FSpeechAudioData& Audio, FName QualityTier)
+{
+	const uint32 QualityTierHash = GetTypeHash(QualityTier);
+	FXxHash64Builder Builder;
+	Audio.ForEachBlock([&Builder](const uint8* Data, int32 NumBytes) { Builder.Update(Data, NumBytes); });
+	Builder.Update(&Audio.SampleFormat, sizeof(Audio.SampleFormat));
+	Builder.Update(&Audio.SampleRate, sizeof(Audio.SampleRate));
+	Builder.Update(&Audio.NumChannels, sizeof(Audio.NumChannels));
+	Builder.Update(&QualityTierHash, sizeof(QualityTierHash));
+
+	// Features depend on the silence skipped and on the padding of the encoder input as well, the same as baked animations
+	const URuntimeSpeechToFaceSettings* Settings = GetDefault<URuntimeSpeechToFaceSettings>();
+	const float SilenceSettings[] = { Settings->bSkipSilence ? 1.0f : 0.0f, Settings->SilenceThresholdDb, Settings->MinSilenceDuration, Settings->SilenceContextDuration };
+	Builder.Update(SilenceSettings, sizeof(SilenceSettings));
+	TArray<float> BucketDurations = Settings->ShapeBucketDurations;
+	BucketDurations.Sort();
+	Builder.Update(BucketDurations.GetData(), BucketDurations.Num() * sizeof(float));
+	return Builder.Finalize().Hash;
+}
+
+uint64 SpeechToFacePipeline::HashAudioChannel(uint64 AudioHash, int32 Channel)
+{
+	if (Channel == INDEX_NONE)
+	{
+		return AudioHash;
+	}
+	FXxHash64Builder Builder;
+	Builder.Update(&AudioHash, sizeof(AudioHash));
+	Builder.Update(&Channel, sizeof(Channel));
+	return Builder.Finalize().Hash;
+}
+
+bool SpeechToFacePipeline::GetEncoderSamples(const FSpeechAudioData& Audio, int32 Channel, TArray<float>& OutSamples, FString& OutError)
+{
+	FloatSamples SourceSamples;
+	FloatSamples Samples;
+	if (!GetChannelSamples(Audio, Channel, SourceSamples, Samples, OutError))
+	{
+		return false;
+	}
+	OutSamples.Reset(Samples.Num());
+	OutSamples.Append(Samples.GetData(), Samples.Num());
+	return true;
+}
+
+// Keep features just extracted in the cache
+static TSharedPtr<const FSpeechAudioFeatures> CacheAudioFeatures(uint64 AudioHash, const TSharedPtr<FSpeechAudioFeatures>& Features)
+{
+	// Drop the room left for bucket padding before keeping the features
+	for (FSpeechAudioFeatures::FSegment& Segment : Features->Segments)
+	{
+		Segment.Values.Shrink();
+	}
+
+	AudioFeatureCache.Add(AudioHash, Features, GetDefault<URuntimeSpeechToFaceSettings>()->AudioFeatureCacheSize);
+	return Features;
+}
+
+TSharedPtr<const FSpeechAudioFeatures> SpeechToFacePipeline::GetAudioFeatures(const FSpeechToFaceModelInstances& Models, const FSpeechAudioData& Audio, uint64 AudioHash, FString& OutError, int32 Channel)
+{
+	if (TSharedPtr<const FSpeechAudioFeatures> CachedFeatures = AudioFeatureCache.Find(AudioHash))
+	{
+		return CachedFeatures;
+	}
+
+	TSharedPtr<FSpeechAudioFeatures> Features = MakeShared<FSpeechAudioFeatures>();
+	if (!ExtractFeatures(Models, Audio, Channel, *Features, OutError))
+	{
+		return nullptr;
+	}
+	return CacheAudioFeatures(AudioHash, Features);
+}
+
+TSharedPtr<const FSpeechAudioFeatures> SpeechToFacePipeline::GetAudioFeatures(const FSpeechToFaceModelInstances& Models, TConstArrayView<float> Samples, uint64 AudioHash, const FString& Name, FString& OutError)
+{
+	if (TSharedPtr<const FSpeechAudioFeatures> CachedFeatures = AudioFeatureCache.Find(AudioHash))
+	{
+		return CachedFeatures;
+	}
+
+	TSharedPtr<FSpeechAudioFeatures> Features = MakeShared<FSpeechAudioFeatures>();
+	if (!ExtractFeatures(Models, Samples, Name, *Features, OutError))
+	{
+		return nullptr;
+	}
+	return CacheAudioFeatures(AudioHash, Features);
+}
+
+TSharedPtr<const FSpeechAudioFeatures> SpeechToFacePipeline::FindCachedAudioFeatures(uint64 AudioHash)
+{
+	return AudioFeatureCache.Find(AudioHash);
+}
+
+bool SpeechToFacePipeline::GenerateAnimation(const FSpeechToFaceModelInstances& Models, const FSpeechAudioData& Audio, const FSpeechToFaceParams& Params, FSpeechToFaceAnimationData& OutAnimation, FString& OutError)
+{
+	// Uncached features live in the scratch too, so their buffers are reused by the next request
+	FSpeechAudioFeatures& Features = Models.Scratch->Features;
+	if (!ExtractFeatures(Models, Audio, INDEX_NONE, Features, OutError))
+	{
+		return false;
+	}
+	return GenerateAnimation(Models, Features, Params, OutAnimation, OutError);
+}
+
+// Convert the resampled GUI controls in Scratch.ResampledValues to raw rig control curves
+static void ConvertToRawControls(FSpeechToFaceScratch& Scratch, int32 NumFrames, FSpeechToFaceAnimationData& OutAnimation)
+{
+	const int32 NumFaceControls = RigControlNames.Num();
+	OutAnimation.CurveNames.Reset();
+	OutAnimation.Values.Reset();
+	OutAnimation.FrameRate = AnimationOutputFps;
+	for (int32 FrameIndex = 0; FrameIndex < NumFrames; ++FrameIndex)
+	{
+		// The frame map keeps its keys between frames and requests, only the values change
+		for (int32 ControlIndex = 0; ControlIndex < NumFaceControls; ++ControlIndex)
+		{
+			Scratch.GuiFrame.FindOrAdd(RigControlNames[ControlIndex]) = Scratch.ResampledValues[FrameIndex * NumFaceControls + ControlIndex];
+		}
+
+		TMap<FString, float> AnimationFrame = GuiToRawControlsUtils::ConvertGuiToRawControls(Scratch.GuiFrame);
+		if (FrameIndex == 0)
+		{
+			OutAnimation.CurveNames.Reserve(AnimationFrame.Num());
+			OutAnimation.Values.Reserve(AnimationFrame.Num() * NumFrames);
+			for (const auto& Sample : AnimationFrame)
+			{
+				OutAnimation.CurveNames.Add(*Sample.Key);
+			}
+		}
+
+		for (const TPair<FString, float>& Sample : AnimationFrame)
+		{
+			OutAnimation.Values.Add(Sample.Value);
+		}
+	}
+}
+
+bool SpeechToFacePipeline::GenerateAnimation(const FSpeechToFaceModelInstances& Models, const FSpeechAudioFeatures& Features, const FSpeechToFaceParams& Params, FSpeechToFaceAnimationData& OutAnimation, FString& OutError)
+{
+	FSpeechToFaceScratch& Scratch = *Models.Scratch;
+
+	// Step 3: run rig logic predictor to get animation data
+	if (!RunPredictorOnSegments(Models, Features, Params))
+	{
+		OutError = TEXT("RuntimeSpeechToFaceAsync: RunPredictor.");
+		return false;
+	}
+
+	// Step 4: resample animation
+	const int32 NumFaceControls = RigControlNames.Num();
+	ResampleAnimation(Scratch.RigLogicValues, NumFaceControls, AnimationOutputFps, Scratch.ResampledValues);
+	const int32 NumFrames = NumFaceControls > 0 ? Scratch.ResampledValues.Num() / NumFaceControls : 0;
+	if (Params.bGenerateBlinks)
+	{
+		const int32 NumBlinkControls = BlinkRigControlNames.Num();
+		ResampleAnimation(Scratch.RigLogicBlinkValues, NumBlinkControls, AnimationOutputFps, Scratch.ResampledBlinkValues);
+
+		Scratch.BlinkControlIndices.Reset();
+		for (const FString& BlinkControlName : BlinkRigControlNames)
+		{
+			const int32 ControlIndex = RigControlNames.IndexOfByKey(BlinkControlName);
+			check(ControlIndex != INDEX_NONE);
+			Scratch.BlinkControlIndices.Add(ControlIndex);
+		}
+
+		const int32 NumBlinkFrames = FMath::Min(NumFrames, NumBlinkControls > 0 ? Scratch.ResampledBlinkValues.Num() / NumBlinkControls : 0);
+		for (int32 FrameIndex = 0; FrameIndex < NumBlinkFrames; FrameIndex++)
+		{
+			for (int32 BlinkIndex = 0; BlinkIndex < NumBlinkControls; BlinkIndex++)
+			{
+				Scratch.ResampledValues[FrameIndex * NumFaceControls + Scratch.BlinkControlIndices[BlinkIndex]] += Scratch.ResampledBlinkValues[FrameIndex * NumBlinkControls + BlinkIndex];
+			}
+		}
+	}
+
+	// Step 5: convert to raw controls
+	ConvertToRawControls(Scratch, NumFrames, OutAnimation);
+
+	return true;
+}
+
+#if !UE_BUILD_SHIPPING
+void SpeechToFacePipeline::BenchmarkKernels(int32 Iterations, TArray<FSpeechToFaceBenchmarkResult>& OutResults)
+{
+	using SpeechToFaceBenchmark::Measure;
+
+	FSpeechToFaceScratch Scratch;
+	FRandomStream Random(0x5EED);
+	const float Durations[] = { 2.0f, 10.0f, 30.0f };
+	const uint16 ChannelCounts[] = { 1, 2, 6 };
+
+	for (const float Duration : Durations)
+	{
+		for (const uint16 NumChannels : ChannelCounts)
+		{
+			// At the encoder rate, so only the conversion is timed and not the resampling
+			FSpeechAudioData Audio;
+			Audio.SampleRate = AudioEncoderSampleRateHz;
+			Audio.NumChannels = NumChannels;
+			Audio.Name = TEXT("Benchmark");
+			SpeechToFaceBenchmark::MakeSyntheticAudio(Duration, Audio.SampleRate, NumChannels, Audio.PCMData);
+
+			const FString Case = FString::Printf(TEXT("%gs_%dch"), Duration, NumChannels);
+			Measure(TEXT("GetFloatSamples_Mono"), Case, Iterations, [&Audio, &Scratch]() { GetFloatSamples(Audio, false, 0, 0.0f, Scratch.SourceSamples, Scratch.Samples); }, OutResults);
+			if (NumChannels > 1)
+			{
+				Measure(TEXT("GetFloatSamples_Downmix"), Case, Iterations, [&Audio, &Scratch]() { GetFloatSamples(Audio, true, 0, 0.0f, Scratch.SourceSamples, Scratch.Samples); }, OutResults);
+			}
+		}
+
+		const FString Case = FString::Printf(TEXT("%gs"), Duration);
+
+		// 48 kHz is the most common rate that has to be brought down to the encoder rate
+		constexpr int32 SourceSampleRate = 48000;
+		FloatSamples SourceSamples;
+		SourceSamples.SetNumUninitialized(FMath::RoundToInt32(Duration * SourceSampleRate));
+		for (int32 SampleIndex = 0; SampleIndex < SourceSamples.Num(); ++SampleIndex)
+		{
+			SourceSamples[SampleIndex] = 0.5f * FMath::Sin(2.0f * PI * 220.0f * SampleIndex / SourceSampleRate) + 0.05f * Random.FRandRange(-1.0f, 1.0f);
+		}
+		Measure(TEXT("ResampleAudio"), Case, Iterations, [&SourceSamples, &Scratch]() { ResampleAudio(SourceSamples, SourceSampleRate, AudioEncoderSampleRateHz, Scratch.Samples); }, OutResults);
+
+		// Predictor output of the clip
+		const int32 NumControls = RigControlNames.Num();
+		TArray<float> RawAnimation;
+		RawAnimation.SetNumUninitialized(FMath::FloorToInt32(Duration * RigLogicPredictorOutputFps) * NumControls);
+		for (float& Value : RawAnimation)
+		{
+			Value = Random.FRand();
+		}
+		Measure(TEXT("ResampleAnimation"), Case, Iterations, [&RawAnimation, NumControls, &Scratch]() { ResampleAnimation(RawAnimation, NumControls, AnimationOutputFps, Scratch.ResampledValues); }, OutResults);
+
+		ResampleAnimation(RawAnimation, NumControls, AnimationOutputFps, Scratch.ResampledValues);
+		const int32 NumFrames = NumControls > 0 ? Scratch.ResampledValues.Num() / NumControls : 0;
+		FSpeechToFaceAnimationData AnimationData;
+		Measure(TEXT("GuiToRawControls"), Case, Iterations, [&Scratch, NumFrames, &AnimationData]() { ConvertToRawControls(Scratch, NumFrames, AnimationData); }, OutResults);
+
+		TArray<FFloatCurve> Curves;
+		Measure(TEXT("BuildCurves"), Case, Iterations, [&AnimationData, &Curves]() { AnimationData.BuildCurves(Curves); }, OutResults);
+	}
+}
+#endif
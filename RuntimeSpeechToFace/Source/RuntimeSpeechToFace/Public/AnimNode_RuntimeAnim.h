@@ -7,6 +7,16 @@
 
 #define UE_API RUNTIMESPEECHTOFACE_API
 
+/** How much of a runtime face animation is evaluated */
+UENUM(BlueprintType)
+enum class ERuntimeAnimLOD : uint8
+{
+    Full,
+    MouthOnly,
+    JawOnly,
+    Off,
+};
+
 USTRUCT(BlueprintInternalUseOnly)
 struct FAnimNode_RuntimeAnim : public FAnimNode_Base
 {
@@ -16,11 +26,65 @@ public:
     UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = settings, meta = (AlwaysAsPin))
     TObjectPtr<class URuntimeAnimation> RuntimeAnimation;
 
+    /**
+     * Sample the curves at the playback position of the animation's audio clock instead of advancing by DeltaTime.
+     * Until the audio has started playing the animation still advances by DeltaTime.
+     */
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = settings)
+    bool bSyncToAudioClock = true;
+
+    /** Seconds subtracted from the audio clock to compensate for audio output latency */
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = settings, meta = (ClampMin = "0.0", EditCondition = "bSyncToAudioClock"))
+    float AudioLatencyCompensation = 0.0f;
+
+    /** Copy out curve values evaluated by URuntimeAnimEvaluationSubsystem together with the other faces in the world */
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = settings)
+    bool bUseBatchedEvaluation = true;
+
+    /** Mesh LOD from which only the mouth curves are evaluated, -1 to never reduce */
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = LOD)
+    int32 MouthOnlyLODThreshold = -1;
+
+    /** Mesh LOD from which only the jaw curves are evaluated, -1 to never reduce */
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = LOD)
+    int32 JawOnlyLODThreshold = -1;
+
+    /** Mesh LOD from which no curves are evaluated, -1 to never turn off */
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = LOD)
+    int32 OffLODThreshold = -1;
+
+    /** Times per second curves are sampled at each LOD, interpolating in between. 0 samples every frame. */
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = LOD, meta = (ClampMin = "0.0"))
+    float FullEvaluationRate = 0.0f;
+
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = LOD, meta = (ClampMin = "0.0"))
+    float MouthOnlyEvaluationRate = 15.0f;
+
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = LOD, meta = (ClampMin = "0.0"))
+    float JawOnlyEvaluationRate = 10.0f;
+
     UE_API void Update_AnyThread(const FAnimationUpdateContext& Context) override;
 
     UE_API void Evaluate_AnyThread(FPoseContext& Output) override;
 
+    /** Add the animation curves at the current time to OutCurve and advance the time, what Evaluate_AnyThread does without a pose */
+    UE_API void EvaluateRuntimeCurves(FBlendedCurve& OutCurve);
+
     float DeltaTime = 0.0f;
+
+private:
+    void EvaluateCurves(const TArray<int32>* CurveIndices, float Time, TArray<float>& OutValues) const;
+
+    float GetEvaluationRate(ERuntimeAnimLOD LOD) const;
+
+    ERuntimeAnimLOD CurrentLOD = ERuntimeAnimLOD::Full;
+
+    // Samples bracketing the current time when evaluating below the frame rate
+    TArray<float> PrevSampleValues;
+    TArray<float> NextSampleValues;
+    int64 CachedSampleIndex = INDEX_NONE;
+    ERuntimeAnimLOD CachedLOD = ERuntimeAnimLOD::Full;
+    const URuntimeAnimation* CachedAnimation = nullptr;
 };
 
 #undef UE_API
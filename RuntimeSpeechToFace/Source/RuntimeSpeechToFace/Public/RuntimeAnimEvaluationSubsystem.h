@@ -0,0 +1,38 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+
+#include "RuntimeAnimEvaluationSubsystem.generated.h"
+
+class URuntimeAnimation;
+
+/**
+ * Evaluates every runtime face animation played in the world in one pass before actors tick.
+ * FAnimNode_RuntimeAnim then copies the results out instead of evaluating its curves on its own anim task.
+ */
+UCLASS(MinimalAPI)
+class URuntimeAnimEvaluationSubsystem : public UWorldSubsystem
+{
+    GENERATED_BODY()
+
+public:
+    virtual bool ShouldCreateSubsystem(UObject* Outer) const override;
+
+    virtual void Initialize(FSubsystemCollectionBase& Collection) override;
+
+    virtual void Deinitialize() override;
+
+    /** Evaluate Animation with the batch from the next frame on. Thread safe, called from anim worker threads. */
+    void Register(URuntimeAnimation* Animation);
+
+private:
+    void OnWorldPreActorTick(UWorld* InWorld, ELevelTick TickType, float DeltaSeconds);
+
+    FDelegateHandle PreActorTickHandle;
+
+    FCriticalSection PendingLock;
+    TArray<TWeakObjectPtr<URuntimeAnimation>> PendingAnimations;
+
+    TArray<TWeakObjectPtr<URuntimeAnimation>> Animations;
+};
@@ -4,6 +4,61 @@
 #include "Animation/AnimCurveTypes.h"
 #include "RuntimeAnimation.generated.h"
 
+#define UE_API RUNTIMESPEECHTOFACE_API
+
+UENUM()
+enum class ERuntimeAnimTrackFormat : uint8
+{
+    // A single value for the whole clip
+    Constant,
+    // Linearly interpolated keys left after key reduction
+    Keys,
+    // Uniformly sampled values quantized to 8 or 16 bits within the track range
+    Quantized8,
+    Quantized16,
+};
+
+USTRUCT(BlueprintType)
+struct FRuntimeAnimCompressionSettings
+{
+    GENERATED_BODY()
+
+    /** Maximum error allowed when dropping keys or quantizing a curve */
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Compression", meta = (ClampMin = "0.0"))
+    float Tolerance = 0.001f;
+
+    /** Store curves as 8/16 bit quantized samples when that is smaller than the reduced keys */
+    UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Compression")
+    bool bAllowQuantization = true;
+};
+
+/** A compressed curve of a URuntimeAnimation */
+struct FRuntimeAnimTrack
+{
+    FName CurveName;
+
+    ERuntimeAnimTrackFormat Format = ERuntimeAnimTrackFormat::Constant;
+
+    // Value of constant tracks, or the minimum of quantized tracks
+    float RangeMin = 0.0f;
+
+    // Range covered by quantized values
+    float RangeExtent = 0.0f;
+
+    // Rate of quantized samples, the first sample is at time 0
+    float SampleRate = 0.0f;
+
+    TArray<float> KeyTimes;
+    TArray<float> KeyValues;
+    TArray<uint8> QuantizedData;
+
+    float Evaluate(float Time) const;
+
+    SIZE_T GetAllocatedSize() const;
+
+    void Serialize(FArchive& Ar);
+};
+
 UCLASS(BlueprintType, MinimalAPI)
 class URuntimeAnimation : public UObject
 {
@@ -12,7 +67,103 @@ class URuntimeAnimation : public UObject
 public:
     TArray<FFloatCurve> FloatCurves;;
 
+    /** Compressed replacement for FloatCurves, filled by Compress */
+    TArray<FRuntimeAnimTrack> CompressedTracks;
+
     float Duration = 0.0f;
 
     float CurTime = 0.0f;
+
+    /** Drive this animation from the playback position of SoundWave when played by FAnimNode_RuntimeAnim */
+    UFUNCTION(BlueprintCallable, Category = "RuntimeSpeechToFace")
+    void SetAudioClock(class USpeechSoundWave* SoundWave);
+
+    /** Playback clock published by the audio render thread, readable from any thread */
+    TSharedPtr<const struct FSpeechPlaybackState> AudioClock;
+
+    /** Playback time of the audio clock at which this animation starts, for animations of a span of the audio */
+    float AudioStartTime = 0.0f;
+
+    /** Hash of the audio this animation was generated from, used to regenerate it from cached encoder features */
+    uint64 AudioFeaturesHash = 0;
+
+    /** Quality tier of the models that generated this animation */
+    FName QualityTier;
+
+    /**
+     * Replace FloatCurves with compressed tracks. Constant curves keep a single value, keys are reduced within
+     * the tolerance and curves are optionally quantized. Curve order and indices are preserved.
+     * Only call on the game thread before the animation is handed to an anim node, or once no anim node has played
+     * it for a few frames. Returns false without compressing while it may still be evaluated.
+     */
+    UE_API bool Compress(const FRuntimeAnimCompressionSettings& Settings);
+
+    bool IsCompressed() const { return CompressedTracks.Num() > 0; }
+
+    /** Compress curves without an animation object, e.g. on worker threads */
+    UE_API static void CompressCurves(TConstArrayView<FFloatCurve> Curves, const FRuntimeAnimCompressionSettings& Settings, TArray<FRuntimeAnimTrack>& OutTracks);
+
+    /** Write compressed tracks to a baked animation file, tagged with the hash of the inputs they were generated from */
+    UE_API static bool SaveBakedAnimation(const FString& FilePath, const FString& SourceHash, float InDuration, TArray<FRuntimeAnimTrack>& Tracks);
+
+    /** Read the source hash of a baked animation file without loading its tracks */
+    UE_API static bool ReadBakedAnimationHash(const FString& FilePath, FString& OutSourceHash);
+
+    /** Load an animation baked by the RuntimeSpeechToFaceBake commandlet. Plays without running inference. */
+    UFUNCTION(BlueprintCallable, Category = "RuntimeSpeechToFace")
+    UE_API static URuntimeAnimation* LoadBakedAnimation(const FString& FilePath);
+
+    int32 GetNumCurves() const { return IsCompressed() ? CompressedTracks.Num() : FloatCurves.Num(); }
+
+    FName GetCurveName(int32 CurveIndex) const { return IsCompressed() ? CompressedTracks[CurveIndex].CurveName : FloatCurves[CurveIndex].GetName(); }
+
+    float EvaluateCurve(int32 CurveIndex, float Time) const { return IsCompressed() ? CompressedTracks[CurveIndex].Evaluate(Time) : FloatCurves[CurveIndex].Evaluate(Time); }
+
+    /** Evaluate every curve at Time into OutValues, sharing the sampling math between curves */
+    UE_API void EvaluateAllCurves(float Time, TArrayView<float> OutValues) const;
+
+    /** Bytes taken by the curves, compressed tracks and evaluation buffers */
+    UE_API SIZE_T GetCurveMemorySize() const;
+
+    /** Free the curves, leaving an empty animation that anim nodes skip. Only call while no anim node evaluates it. */
+    UE_API void ReleaseCurves();
+
+    //~ Begin UObject Interface
+    virtual void GetResourceSizeEx(FResourceSizeEx& CumulativeResourceSize) override;
+    //~ End UObject Interface
+
+    /** Build the curve subsets used by the reduced LODs of FAnimNode_RuntimeAnim. Call once the curves are final. */
+    UE_API void BuildLODCurveSets();
+
+    /** Indices of the curves driving the mouth, evaluated at the mouth only LOD */
+    TArray<int32> MouthCurveIndices;
+
+    /** Indices of the curves driving the jaw, evaluated at the jaw only LOD */
+    TArray<int32> JawCurveIndices;
+
+    /** Values of the curves of BatchedLOD at BatchedTime, indexed by curve, filled by URuntimeAnimEvaluationSubsystem before actors tick */
+    TArray<float> BatchedValues;
+
+    /** Time BatchedValues were evaluated at, negative while they are not valid */
+    float BatchedTime = -1.0f;
+
+    /** ERuntimeAnimLOD and audio clock settings BatchedValues were evaluated with, anim nodes with other settings evaluate on their own */
+    uint8 BatchedLOD = 0;
+    bool bBatchedSyncToAudioClock = false;
+    float BatchedLatencyCompensation = 0.0f;
+
+    /** What the anim nodes playing this animation need from the next batch, written from anim worker threads */
+    std::atomic<uint8> BatchRequestLOD{ MAX_uint8 };
+    std::atomic<bool> bBatchRequestSyncToAudioClock{ false };
+    std::atomic<float> BatchRequestLatencyCompensation{ 0.0f };
+
+    /** Frame an anim node last played this animation, the evaluation subsystem drops animations that are no longer played */
+    std::atomic<uint64> LastUsedFrame{ 0 };
+
+    std::atomic<bool> bInEvaluationBatch{ false };
+
+    /** Frame an anim node last played this animation at any LOD, the memory subsystem releases the least recently played first */
+    std::atomic<uint64> LastPlayedFrame{ 0 };
 };
+
+#undef UE_API
@@ -9,10 +9,12 @@
 #include "AudioDrivenAnimationMood.h"
 #include "Animation/Skeleton.h"
 #include "RuntimeAnimation.h"
-#include "NNERuntimeCPU.h"
+#include "SpeechToFacePipeline.h"
 #include "RuntimeSpeechToFaceAsyncTask.generated.h"
 
 DECLARE_DYNAMIC_MULTICAST_DELEGATE_TwoParams(FRuntimeSpeechToFaceAsyncDelegate, URuntimeAnimation*, Anim, FString, Reason);
+DECLARE_DYNAMIC_MULTICAST_DELEGATE_TwoParams(FRuntimeSpeechToFaceAsyncChannelsDelegate, const TArray<URuntimeAnimation*>&, Anims, FString, Reason);
+DECLARE_DELEGATE_TwoParams(FRuntimeSpeechToFaceAsyncNativeDelegate, URuntimeAnimation*, const FString&);
 
 UCLASS()
 class URuntimeSpeechToFaceAsync : public UBlueprintAsyncActionBase
@@ -26,30 +28,77 @@ public:
 	UPROPERTY(BlueprintAssignable)
 	FRuntimeSpeechToFaceAsyncDelegate OnFailed;
 
+	/** Called after OnCompleted with every animation of the request, one per channel in the order they were selected */
+	UPROPERTY(BlueprintAssignable)
+	FRuntimeSpeechToFaceAsyncChannelsDelegate OnChannelsCompleted;
+
+	/** Called before the other delegates with the animation, or null and the reason on failure. For native code tracking many requests. */
+	FRuntimeSpeechToFaceAsyncNativeDelegate OnFinishedNative;
+
+	/**
+	 * Generate a face animation for SoundWave. With EndTime after StartTime only that span of the audio, plus a short
+	 * margin around it for context, is decoded and run through the models. The animation then starts at StartTime.
+	 */
 	UFUNCTION(BlueprintCallable, meta = (BlueprintInternalUseOnly = "true", DisplayName = "Speech To Face Anim"), Category = "RuntimeSpeechToFace")
-	static URuntimeSpeechToFaceAsync* SpeechToFaceAnim(UObject* WorldContextObject, USoundWave* SoundWave, USkeleton* Skeleton, EAudioDrivenAnimationMood Mood = EAudioDrivenAnimationMood::AutoDetect, float MoodIntensity = 1.0f, bool bGenerateBlinks = false, bool bGenerateHeadAnimation = false);
+	static URuntimeSpeechToFaceAsync* SpeechToFaceAnim(UObject* WorldContextObject, USoundWave* SoundWave, USkeleton* Skeleton, EAudioDrivenAnimationMood Mood = EAudioDrivenAnimationMood::AutoDetect, float MoodIntensity = 1.0f, bool bGenerateBlinks = false, bool bGenerateHeadAnimation = false, FName QualityTier = NAME_None, bool bAllowQualityFallback = true, float StartTime = 0.0f, float EndTime = 0.0f);
 
-	void Activate() override;
+	/**
+	 * Generate one face animation per selected channel of SoundWave, e.g. for conversations recorded with each speaker on
+	 * their own channel. The audio is decoded once and all channels run through the models in one inference task.
+	 */
+	UFUNCTION(BlueprintCallable, meta = (BlueprintInternalUseOnly = "true", DisplayName = "Speech To Face Anim Per Channel"), Category = "RuntimeSpeechToFace")
+	static URuntimeSpeechToFaceAsync* SpeechToFaceAnimPerChannel(UObject* WorldContextObject, USoundWave* SoundWave, USkeleton* Skeleton, const TArray<int32>& Channels, EAudioDrivenAnimationMood Mood = EAudioDrivenAnimationMood::AutoDetect, float MoodIntensity = 1.0f, bool bGenerateBlinks = false, bool bGenerateHeadAnimation = false, FName QualityTier = NAME_None);
+
+	/**
+	 * Generate the animation again with other mood settings. Reuses the audio encoder features cached when Animation
+	 * was generated, so only the decoder runs. Fails if the features have been evicted from the cache.
+	 */
+	UFUNCTION(BlueprintCallable, meta = (BlueprintInternalUseOnly = "true", DisplayName = "Regenerate Speech To Face Anim"), Category = "RuntimeSpeechToFace")
+	static URuntimeSpeechToFaceAsync* RegenerateSpeechToFaceAnim(UObject* WorldContextObject, URuntimeAnimation* Animation, EAudioDrivenAnimationMood Mood = EAudioDrivenAnimationMood::AutoDetect, float MoodIntensity = 1.0f, bool bGenerateBlinks = false, bool bGenerateHeadAnimation = false);
+
+	/**
+	 * Load the models of a quality tier and create a set of model instances for them in the background, so the first
+	 * request on the tier does not have to wait for the runtime to set them up.
+	 */
+	UFUNCTION(BlueprintCallable, Category = "RuntimeSpeechToFace")
+	static void PrewarmModels(FName QualityTier = NAME_None);
 
-	void BeginDestroy() override;
+	void Activate() override;
 
 private:
-	void FailWithReason(const FString& Reason);
+	void Complete(struct FSpeechToFaceRequest& Request);
+
+	void Fail(const FString& Reason);
+
+	static void ReleaseIdleModelInstances();
+
+	void UpdateAverageLatency();
 
 private:
-	bool bIsProcessing = false;
 	TObjectPtr<USoundWave> SoundWave;
 	TObjectPtr<USkeleton> Skeleton;
 	EAudioDrivenAnimationMood Mood = EAudioDrivenAnimationMood::AutoDetect;
 	float MoodIntensity = 1.0f;
 	bool bGenerateBlinks = false;
 	bool bGenerateHeadAnimation = false;
+	FName QualityTier;
+	bool bAllowQualityFallback = true;
+	float SpanStartTime = 0.0f;
+	float SpanEndTime = 0.0f;
+
+	// Channels to generate an animation for each, all channels mixed down into one animation if empty
+	TArray<int32> Channels;
+	double StartTime = 0.0;
 
 	TObjectPtr<URuntimeAnimation> Anim;
 
+	// Animation to regenerate from cached features instead of SoundWave
+	TObjectPtr<URuntimeAnimation> SourceAnim;
+
 private:
-	static bool bHasProcessingInstance;
+	// Requests activated and not completed yet, model instances are only released once there are none
+	static int32 NumActiveRequests;
 
-	static TSharedPtr<UE::NNE::IModelInstanceCPU> AudioExtractor;
-	static TSharedPtr<UE::NNE::IModelInstanceCPU> RigLogicPredictor;
+	// Moving average of the time from activation to completion, drives the fallback quality tier
+	static double AverageLatency;
 };
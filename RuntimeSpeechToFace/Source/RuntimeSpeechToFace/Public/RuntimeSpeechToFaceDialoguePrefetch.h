@@ -0,0 +1,135 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "AudioDrivenAnimationMood.h"
+#include "Engine/StreamableManager.h"
+#include "UObject/Object.h"
+
+#include "RuntimeSpeechToFaceDialoguePrefetch.generated.h"
+
+class URuntimeAnimation;
+class URuntimeSpeechToFaceAsync;
+class USoundWave;
+
+DECLARE_DYNAMIC_MULTICAST_DELEGATE_TwoParams(FRuntimeSpeechToFaceLineReadyDelegate, USoundWave*, SoundWave, URuntimeAnimation*, Anim);
+DECLARE_DYNAMIC_MULTICAST_DELEGATE_TwoParams(FRuntimeSpeechToFaceLineFailedDelegate, USoundWave*, SoundWave, FString, Reason);
+
+/** A line of dialogue to generate face animation for before it plays */
+USTRUCT(BlueprintType)
+struct FRuntimeSpeechToFaceDialogueLine
+{
+	GENERATED_BODY()
+
+	/** Loaded in the background if it is not loaded yet */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RuntimeSpeechToFace")
+	TSoftObjectPtr<USoundWave> SoundWave;
+
+	/** Seconds from when the line is added until it plays. Lines are loaded and generated in the order of their deadlines. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RuntimeSpeechToFace", meta = (Units = "Seconds"))
+	float Deadline = 0.0f;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RuntimeSpeechToFace")
+	EAudioDrivenAnimationMood Mood = EAudioDrivenAnimationMood::AutoDetect;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RuntimeSpeechToFace")
+	float MoodIntensity = 1.0f;
+};
+
+/** Progress of one line of a dialogue prefetch. Its sound wave and animation are pinned in the memory subsystem while it is held. */
+USTRUCT()
+struct FRuntimeSpeechToFacePrefetchEntry
+{
+	GENERATED_BODY()
+
+	FSoftObjectPath SoundWavePath;
+	double Deadline = 0.0;
+	EAudioDrivenAnimationMood Mood = EAudioDrivenAnimationMood::AutoDetect;
+	float MoodIntensity = 1.0f;
+
+	// Tells a request completing for a removed line apart from one for the same sound wave added again
+	uint32 Serial = 0;
+
+	UPROPERTY()
+	TObjectPtr<USoundWave> SoundWave;
+
+	UPROPERTY()
+	TObjectPtr<URuntimeSpeechToFaceAsync> Request;
+
+	UPROPERTY()
+	TObjectPtr<URuntimeAnimation> Animation;
+
+	TSharedPtr<FStreamableHandle> LoadHandle;
+	bool bFailed = false;
+};
+
+/**
+ * Generates face animation for the upcoming lines of a conversation ahead of time, so each line has its animation
+ * ready when it starts to play. Lines are loaded, decoded and run through the models in the background in the order
+ * of their deadlines, at most URuntimeSpeechToFaceSettings::PrefetchMaxConcurrentLines at a time, and their animations
+ * are held until the line is removed.
+ */
+UCLASS(BlueprintType, MinimalAPI)
+class URuntimeSpeechToFaceDialoguePrefetch : public UObject
+{
+	GENERATED_BODY()
+
+public:
+	/** Called on the game thread when the animation of a line is ready */
+	UPROPERTY(BlueprintAssignable)
+	FRuntimeSpeechToFaceLineReadyDelegate OnLineReady;
+
+	/** Called on the game thread when a line could not be loaded or generated, with no sound wave if it did not load */
+	UPROPERTY(BlueprintAssignable)
+	FRuntimeSpeechToFaceLineFailedDelegate OnLineFailed;
+
+	/** Start generating animation for the lines of a playlist. Generation settings other than the mood apply to every line. */
+	UFUNCTION(BlueprintCallable, meta = (WorldContext = "WorldContextObject"), Category = "RuntimeSpeechToFace")
+	static RUNTIMESPEECHTOFACE_API URuntimeSpeechToFaceDialoguePrefetch* StartDialoguePrefetch(UObject* WorldContextObject, const TArray<FRuntimeSpeechToFaceDialogueLine>& Playlist, bool bGenerateBlinks = false, bool bGenerateHeadAnimation = false, FName QualityTier = NAME_None);
+
+	/** Add lines as the conversation goes on. A line already added gets the new deadline, and the new mood if it has not started generating. */
+	UFUNCTION(BlueprintCallable, Category = "RuntimeSpeechToFace")
+	RUNTIMESPEECHTOFACE_API void AddLines(const TArray<FRuntimeSpeechToFaceDialogueLine>& Lines);
+
+	/** Animation of a line, null until it is ready */
+	UFUNCTION(BlueprintCallable, Category = "RuntimeSpeechToFace")
+	RUNTIMESPEECHTOFACE_API URuntimeAnimation* GetAnimation(USoundWave* SoundWave) const;
+
+	/** Drop a line whether it is waiting, generating or ready, e.g. once it has played. Its animation is no longer held. */
+	UFUNCTION(BlueprintCallable, Category = "RuntimeSpeechToFace")
+	RUNTIMESPEECHTOFACE_API void RemoveLine(TSoftObjectPtr<USoundWave> SoundWave);
+
+	/** Drop every line, e.g. when the conversation is interrupted */
+	UFUNCTION(BlueprintCallable, Category = "RuntimeSpeechToFace")
+	RUNTIMESPEECHTOFACE_API void Clear();
+
+	/** Lines added and not ready yet */
+	UFUNCTION(BlueprintPure, Category = "RuntimeSpeechToFace")
+	RUNTIMESPEECHTOFACE_API int32 GetNumPendingLines() const;
+
+	virtual void BeginDestroy() override;
+
+private:
+	void OnLineLoaded(FSoftObjectPath SoundWavePath, uint32 Serial);
+
+	void OnLineGenerated(URuntimeAnimation* Anim, const FString& Reason, FSoftObjectPath SoundWavePath, uint32 Serial);
+
+	// Start the earliest lines that are loaded, up to the concurrency limit
+	void LaunchNext();
+
+	FRuntimeSpeechToFacePrefetchEntry* FindLine(const FSoftObjectPath& SoundWavePath, uint32 Serial);
+
+	// Sorted by deadline
+	UPROPERTY(Transient)
+	TArray<FRuntimeSpeechToFacePrefetchEntry> Lines;
+
+	TWeakObjectPtr<UObject> WorldContext;
+	bool bGenerateBlinks = false;
+	bool bGenerateHeadAnimation = false;
+	FName QualityTier;
+
+	FStreamableManager StreamableManager;
+	uint32 NextSerial = 0;
+	bool bLaunching = false;
+};
@@ -0,0 +1,78 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "AudioDrivenAnimationMood.h"
+#include "Containers/Ticker.h"
+#include "UObject/Object.h"
+
+#include "RuntimeSpeechToFaceLiveSession.generated.h"
+
+class URuntimeAnimation;
+class USoundSubmix;
+
+DECLARE_DYNAMIC_MULTICAST_DELEGATE_OneParam(FRuntimeSpeechToFaceLiveDelegate, URuntimeAnimation*, Anim);
+
+/**
+ * Generates face animation continuously from audio that never becomes a sound wave, such as voice chat or any sound
+ * sent to a submix. Captured audio goes through a lock-free queue to the game thread, which runs inference on each
+ * new chunk together with the audio before it for context. Every chunk becomes a short animation that replaces the
+ * previous one, so the face trails the audio by about one chunk plus the inference time.
+ */
+UCLASS(BlueprintType, MinimalAPI)
+class URuntimeSpeechToFaceLiveSession : public UObject
+{
+	GENERATED_BODY()
+
+public:
+	/** Called on the game thread with the animation of every new chunk, play it from the start in place of the previous one */
+	UPROPERTY(BlueprintAssignable)
+	FRuntimeSpeechToFaceLiveDelegate OnAnimationUpdated;
+
+	/**
+	 * Start generating animation from the audio of a submix, the main submix if none is given. Without an audio device,
+	 * or to feed the session from code, pass bCaptureSubmix = false and call PushAudio instead.
+	 */
+	UFUNCTION(BlueprintCallable, meta = (WorldContext = "WorldContextObject"), Category = "RuntimeSpeechToFace")
+	static RUNTIMESPEECHTOFACE_API URuntimeSpeechToFaceLiveSession* StartLiveSession(UObject* WorldContextObject, USoundSubmix* Submix = nullptr, bool bCaptureSubmix = true, EAudioDrivenAnimationMood Mood = EAudioDrivenAnimationMood::AutoDetect, float MoodIntensity = 1.0f, FName QualityTier = NAME_None);
+
+	/** Stop capturing. The last animation keeps playing to its end. */
+	UFUNCTION(BlueprintCallable, Category = "RuntimeSpeechToFace")
+	RUNTIMESPEECHTOFACE_API void Stop();
+
+	/** Animation of the latest chunk, for binding to the RuntimeAnimation pin of the anim node */
+	UFUNCTION(BlueprintPure, Category = "RuntimeSpeechToFace")
+	URuntimeAnimation* GetAnimation() const { return Animation; }
+
+	/** Queue interleaved float samples. Only for sessions not capturing a submix, from one thread at a time. */
+	RUNTIMESPEECHTOFACE_API void PushAudio(const float* Samples, int32 NumFrames, int32 NumChannels, int32 SampleRate);
+
+	virtual void BeginDestroy() override;
+
+private:
+	bool Tick(float DeltaTime);
+
+	void LaunchChunk();
+
+	void CompleteChunk(struct FSpeechToFaceLiveChunk& Chunk);
+
+	UPROPERTY(Transient)
+	TObjectPtr<URuntimeAnimation> Animation;
+
+	// Audio queue, models and generation parameters, shared with the submix listener and the running chunk
+	TSharedPtr<struct FSpeechToFaceLiveState, ESPMode::ThreadSafe> State;
+
+	// Registered with the audio device of the world the session was started in
+	TSharedPtr<class FSpeechToFaceSubmixListener, ESPMode::ThreadSafe> Listener;
+	TWeakObjectPtr<USoundSubmix> CapturedSubmix;
+	uint32 AudioDeviceId = INDEX_NONE;
+
+	// Mono audio popped from the queue, the last samples of it are the chunk not processed yet
+	TArray<float> History;
+	int32 HistorySampleRate = 0;
+	int32 NumNewSamples = 0;
+	bool bChunkRunning = false;
+
+	FTSTicker::FDelegateHandle TickerHandle;
+};
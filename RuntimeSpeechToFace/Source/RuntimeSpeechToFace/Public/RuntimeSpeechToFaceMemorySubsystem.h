@@ -0,0 +1,63 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Containers/Ticker.h"
+#include "Subsystems/EngineSubsystem.h"
+
+#include "RuntimeSpeechToFaceMemorySubsystem.generated.h"
+
+DECLARE_DYNAMIC_MULTICAST_DELEGATE_OneParam(FRuntimeSpeechToFaceReleasedDelegate, UObject*, Object);
+
+/**
+ * Keeps the memory taken by speech sound waves and face animations within URuntimeSpeechToFaceSettings::MemoryBudget.
+ * Over budget, the least recently played animations are compressed, then the least recently played idle waves and
+ * animations have their data released, unless they are pinned.
+ */
+UCLASS(MinimalAPI)
+class URuntimeSpeechToFaceMemorySubsystem : public UEngineSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	/** Called after a sound wave or animation had its data released, so it can be generated again when needed */
+	UPROPERTY(BlueprintAssignable)
+	FRuntimeSpeechToFaceReleasedDelegate OnReleased;
+
+	virtual bool ShouldCreateSubsystem(UObject* Outer) const override;
+
+	virtual void Initialize(FSubsystemCollectionBase& Collection) override;
+
+	virtual void Deinitialize() override;
+
+	/** Start tracking a speech sound wave or a runtime animation whose curves are final. Thread safe. */
+	static void Track(UObject* Object);
+
+	/**
+	 * Keep the data of a sound wave or animation from being released until it is unpinned, e.g. an animation generated
+	 * ahead of the line it plays with, which has never played yet. Pins are counted. Game thread only.
+	 */
+	static void Pin(UObject* Object);
+
+	static void Unpin(UObject* Object);
+
+	/** Memory currently taken by the stored audio of speech sound waves and by the curves of face animations */
+	UFUNCTION(BlueprintCallable, Category = "RuntimeSpeechToFace")
+	void GetMemoryUsage(int64& OutAudioBytes, int64& OutAnimationBytes) const;
+
+private:
+	bool EnforceBudget(float DeltaTime);
+
+	struct FTrackedObject
+	{
+		TWeakObjectPtr<UObject> Object;
+		uint64 LastPlayedFrame = 0;
+		double LastPlayedTime = 0.0;
+		int64 Size = 0;
+	};
+
+	TArray<FTrackedObject> TrackedObjects;
+
+	FTSTicker::FDelegateHandle TickerHandle;
+};
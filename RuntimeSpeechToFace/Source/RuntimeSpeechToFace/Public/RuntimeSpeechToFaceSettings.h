@@ -3,9 +3,36 @@
 #pragma once
 
 #include "UObject/Object.h"
+#include "RuntimeAnimation.h"
+#include "SpeechAudioBuffer.h"
 
 #include "RuntimeSpeechToFaceSettings.generated.h"
 
+/** Encoder and decoder pair that requests can pick by name */
+USTRUCT()
+struct FRuntimeSpeechToFaceQualityTier
+{
+	GENERATED_BODY()
+
+	UPROPERTY(EditAnywhere, Config, Category = "Quality Tier")
+	FName Name;
+
+	UPROPERTY(EditAnywhere, Config, Category = "Quality Tier", meta = (AllowedClasses = "/Script/NNE.NNEModelData"))
+	FSoftObjectPath AudioEncoder;
+
+	UPROPERTY(EditAnywhere, Config, Category = "Quality Tier", meta = (AllowedClasses = "/Script/NNE.NNEModelData"))
+	FSoftObjectPath AnimationDecoder;
+};
+
+UENUM()
+enum class ERuntimeSpeechToFaceThreadPriority : uint8
+{
+	Lowest,
+	BelowNormal,
+	Normal,
+	AboveNormal,
+};
+
 /**
  * Project Settings for the MetaHuman SDK
  */
@@ -23,4 +50,160 @@ public:
 
 	UPROPERTY(EditAnywhere, Config, Category = "NNE Models", meta = (ContentDir, DisplayName = "Animation Decoder", AllowedClasses = "/Script/NNE.NNEModelData"))
 	FSoftObjectPath AnimationDecoder;
+
+	/** Additional model pairs, e.g. smaller models for background characters. Requests without a tier use the models above. */
+	UPROPERTY(EditAnywhere, Config, Category = "NNE Models")
+	TArray<FRuntimeSpeechToFaceQualityTier> QualityTiers;
+
+	/** Tier used instead of the requested one while the average request latency is above TargetLatency */
+	UPROPERTY(EditAnywhere, Config, Category = "NNE Models")
+	FName FallbackQualityTier;
+
+	/** Request latency the fallback tier keeps inference under, 0 to never fall back */
+	UPROPERTY(EditAnywhere, Config, Category = "NNE Models", meta = (ClampMin = "0.0", Units = "Seconds"))
+	float TargetLatency = 0.0f;
+
+	/** Get the models of a quality tier, None for the default models. False if there is no such tier. */
+	RUNTIMESPEECHTOFACE_API bool GetQualityTierModels(FName QualityTier, FSoftObjectPath& OutAudioEncoder, FSoftObjectPath& OutAnimationDecoder) const;
+
+	/** NNE CPU runtime that runs the models */
+	UPROPERTY(EditAnywhere, Config, Category = "NNE Runtime")
+	FString RuntimeName = TEXT("NNERuntimeORTCpu");
+
+	/** Module to load before looking up the runtime */
+	UPROPERTY(EditAnywhere, Config, Category = "NNE Runtime")
+	FString RuntimeModuleName = TEXT("NNERuntimeORT");
+
+	/** Threads running inference. Each thread runs one request at a time, so this bounds how much CPU speech to face takes from the game. */
+	UPROPERTY(EditAnywhere, Config, Category = "NNE Runtime", meta = (ClampMin = "1", UIMin = "1", UIMax = "16"))
+	int32 InferenceThreadCount = 1;
+
+	UPROPERTY(EditAnywhere, Config, Category = "NNE Runtime")
+	ERuntimeSpeechToFaceThreadPriority InferenceThreadPriority = ERuntimeSpeechToFaceThreadPriority::BelowNormal;
+
+	/** Cores the inference threads may run on, 0 for any. Keeps inference off the cores of the game and render threads. */
+	UPROPERTY(EditAnywhere, Config, Category = "NNE Runtime")
+	int64 InferenceThreadAffinityMask = 0;
+
+	/** Share of the CPU cores inference may keep busy, one per running request. 0 leaves InferenceThreadCount as the only limit. */
+	UPROPERTY(EditAnywhere, Config, Category = "CPU Budget", meta = (ClampMin = "0.0", ClampMax = "1.0"))
+	float InferenceCoreShare = 0.0f;
+
+	/** Inference time allowed per game frame on average, summed over the inference threads. Requests over it wait. 0 for no limit. */
+	UPROPERTY(EditAnywhere, Config, Category = "CPU Budget", meta = (ClampMin = "0.0", Units = "Milliseconds"))
+	float InferenceBudgetPerFrame = 0.0f;
+
+	/**
+	 * Frame time the game should keep. While frames take longer, the core share and inference time allowed shrink until
+	 * it recovers, and they grow back once frames have headroom again. 0 disables adapting.
+	 */
+	UPROPERTY(EditAnywhere, Config, Category = "CPU Budget", meta = (ClampMin = "0.0", Units = "Milliseconds"))
+	float TargetFrameTime = 0.0f;
+
+	/**
+	 * Input lengths in seconds that inference is padded up to, each served by its own model instances so the runtime
+	 * can reuse its allocation plans. Inputs longer than every bucket run at their exact length. Empty disables padding.
+	 * The padding is silence the models see, so it changes their output near the end of each input, e.g. 2, 5, 10 and 30
+	 * once the animations they produce have been checked.
+	 */
+	UPROPERTY(EditAnywhere, Config, Category = "NNE Runtime", meta = (ClampMin = "0.1", ClampMax = "30.0", Units = "Seconds"))
+	TArray<float> ShapeBucketDurations;
+
+	/** Quality tiers whose models are loaded and prewarmed once the engine has started, NAME_None for the default tier */
+	UPROPERTY(EditAnywhere, Config, Category = "NNE Runtime")
+	TArray<FName> PrewarmQualityTiers;
+
+	/** Release the model instances and their working memory after each request instead of keeping them for the next one */
+	UPROPERTY(EditAnywhere, Config, Category = "NNE Runtime")
+	bool bReleaseModelInstancesWhenIdle = false;
+
+	/** Compress generated animations, so lines that stay loaded take less memory */
+	UPROPERTY(EditAnywhere, Config, Category = "Compression")
+	bool bCompressAnimations = true;
+
+	UPROPERTY(EditAnywhere, Config, Category = "Compression", meta = (EditCondition = "bCompressAnimations"))
+	FRuntimeAnimCompressionSettings CompressionSettings;
+
+	/** Evaluate the curves of all playing face animations in one batched pass per world, instead of per anim node */
+	UPROPERTY(EditAnywhere, Config, Category = "Evaluation")
+	bool bBatchCurveEvaluation = true;
+
+	/** Skip inference on silent parts of the audio and let the face relax to its neutral pose there */
+	UPROPERTY(EditAnywhere, Config, Category = "Silence")
+	bool bSkipSilence = true;
+
+	/** Level under which a 20 ms frame counts as silent */
+	UPROPERTY(EditAnywhere, Config, Category = "Silence", meta = (EditCondition = "bSkipSilence", Units = "Decibels", UIMin = "-80", UIMax = "0"))
+	float SilenceThresholdDb = -45.0f;
+
+	/** Pauses shorter than this are run through inference like speech */
+	UPROPERTY(EditAnywhere, Config, Category = "Silence", meta = (EditCondition = "bSkipSilence", ClampMin = "0.0", Units = "Seconds"))
+	float MinSilenceDuration = 0.3f;
+
+	/** Silence kept around speech, so onsets and releases are animated from the real audio */
+	UPROPERTY(EditAnywhere, Config, Category = "Silence", meta = (EditCondition = "bSkipSilence", ClampMin = "0.0", Units = "Seconds"))
+	float SilenceContextDuration = 0.2f;
+
+	/** Time constant of the decay towards the neutral pose in skipped silence */
+	UPROPERTY(EditAnywhere, Config, Category = "Silence", meta = (EditCondition = "bSkipSilence", ClampMin = "0.0", Units = "Seconds"))
+	float SilenceDecayTime = 0.1f;
+
+	/** Number of clips whose audio encoder features are kept, so regenerating a line with another mood only runs the decoder. 0 disables the cache. */
+	UPROPERTY(EditAnywhere, Config, Category = "Caching", meta = (ClampMin = "0"))
+	int32 AudioFeatureCacheSize = 8;
+
+	/**
+	 * Memory that speech sound waves and face animations may take in total, in megabytes. Over budget, the least
+	 * recently played animations are compressed first, then the least recently played waves and animations are released.
+	 * 0 disables the budget.
+	 */
+	UPROPERTY(EditAnywhere, Config, Category = "Memory", meta = (ClampMin = "0", Units = "Megabytes"))
+	int32 MemoryBudget = 0;
+
+	/** Time a sound wave or animation must not have played before it may be released to stay within the budget */
+	UPROPERTY(EditAnywhere, Config, Category = "Memory", meta = (ClampMin = "0.0", Units = "Seconds"))
+	float MinIdleTimeBeforeRelease = 30.0f;
+
+	/**
+	 * How speech sound waves keep the audio set or appended to them. ADPCM takes a quarter of the memory of 16 bit
+	 * audio and an eighth of float audio, at a small loss of quality, and is decoded a block at a time while it plays
+	 * or goes through inference.
+	 */
+	UPROPERTY(EditAnywhere, Config, Category = "Memory")
+	ESpeechAudioStorage SpeechAudioStorage = ESpeechAudioStorage::PCM;
+
+	/** Frames per second of animations streamed by URuntimeSpeechToFaceStreamComponent, receivers interpolate in between */
+	UPROPERTY(EditAnywhere, Config, Category = "Replication", meta = (ClampMin = "1.0", ClampMax = "60.0"))
+	float StreamFrameRate = 20.0f;
+
+	/** How far ahead of playback streamed frames are sent, covering network latency and jitter */
+	UPROPERTY(EditAnywhere, Config, Category = "Replication", meta = (ClampMin = "0.0", Units = "Seconds"))
+	float StreamLeadTime = 0.5f;
+
+	/** Frames sent together in one RPC, fewer RPCs at the cost of a longer lead time */
+	UPROPERTY(EditAnywhere, Config, Category = "Replication", meta = (ClampMin = "1"))
+	int32 StreamFramesPerChunk = 5;
+
+	/** Longest animation that can be streamed. Streams claiming to be longer are rejected so a client cannot make every machine allocate for them. */
+	UPROPERTY(EditAnywhere, Config, Category = "Replication", meta = (ClampMin = "1.0", Units = "Seconds"))
+	float StreamMaxDuration = 600.0f;
+
+	/** Audio a live session collects before generating the next animation chunk, the face trails the voice by about this much plus inference */
+	UPROPERTY(EditAnywhere, Config, Category = "Live", meta = (ClampMin = "0.05", Units = "Seconds"))
+	float LiveChunkDuration = 0.4f;
+
+	/** Audio before each live chunk that inference also runs on, so the start of the chunk is animated in context */
+	UPROPERTY(EditAnywhere, Config, Category = "Live", meta = (ClampMin = "0.0", Units = "Seconds"))
+	float LiveContextDuration = 1.6f;
+
+	/** Most audio a live session lets wait for inference. When inference falls behind, older audio is skipped. */
+	UPROPERTY(EditAnywhere, Config, Category = "Live", meta = (ClampMin = "0.05", Units = "Seconds"))
+	float LiveMaxLatency = 1.0f;
+
+	/**
+	 * Lines of a dialogue prefetch generated at the same time. With more than one, later lines decode while earlier
+	 * ones run inference, but they also share the inference threads with them.
+	 */
+	UPROPERTY(EditAnywhere, Config, Category = "Prefetch", meta = (ClampMin = "1", UIMax = "8"))
+	int32 PrefetchMaxConcurrentLines = 2;
 };
@@ -0,0 +1,126 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Components/ActorComponent.h"
+
+#include "RuntimeSpeechToFaceStreamComponent.generated.h"
+
+class URuntimeAnimation;
+
+DECLARE_DYNAMIC_MULTICAST_DELEGATE_OneParam(FRuntimeSpeechToFaceStreamDelegate, URuntimeAnimation*, Anim);
+
+/** Start of a streamed animation */
+USTRUCT()
+struct FRuntimeSpeechToFaceStreamHeader
+{
+	GENERATED_BODY()
+
+	UPROPERTY()
+	uint16 StreamId = 0;
+
+	UPROPERTY()
+	float Duration = 0.0f;
+
+	UPROPERTY()
+	float FrameRate = 0.0f;
+
+	UPROPERTY()
+	int32 NumFrames = 0;
+
+	/** Curve names and quantization ranges, zlib compressed since the names share long prefixes */
+	UPROPERTY()
+	TArray<uint8> CurveData;
+
+	UPROPERTY()
+	int32 CurveDataSize = 0;
+};
+
+/** Consecutive frames of a streamed animation, each holding the curves that changed since the frame before */
+USTRUCT()
+struct FRuntimeSpeechToFaceStreamChunk
+{
+	GENERATED_BODY()
+
+	UPROPERTY()
+	uint16 StreamId = 0;
+
+	UPROPERTY()
+	int32 FirstFrame = 0;
+
+	UPROPERTY()
+	int32 NumFrames = 0;
+
+	UPROPERTY()
+	TArray<uint8> Data;
+};
+
+/**
+ * Replicates an animation generated on one machine as 8 bit quantized curve frames, delta coded against the
+ * previous frame and sent a little ahead of playback. Other machines rebuild it into a URuntimeAnimation that
+ * FAnimNode_RuntimeAnim plays, so only the machine generating the animation runs inference.
+ */
+UCLASS(ClassGroup = (RuntimeSpeechToFace), meta = (BlueprintSpawnableComponent), MinimalAPI)
+class URuntimeSpeechToFaceStreamComponent : public UActorComponent
+{
+	GENERATED_BODY()
+
+public:
+	URuntimeSpeechToFaceStreamComponent();
+
+	/** Called on receiving machines when a stream starts, with the animation its frames are written into as they arrive */
+	UPROPERTY(BlueprintAssignable)
+	FRuntimeSpeechToFaceStreamDelegate OnStreamStarted;
+
+	/** Stream Animation to the other machines. Call on the server or on the owning client, which keep playing Animation itself. */
+	UFUNCTION(BlueprintCallable, Category = "RuntimeSpeechToFace")
+	void StreamAnimation(URuntimeAnimation* InAnimation);
+
+	/** The streamed animation on the sending machine, the one rebuilt from the stream everywhere else */
+	UFUNCTION(BlueprintPure, Category = "RuntimeSpeechToFace")
+	URuntimeAnimation* GetAnimation() const { return Animation; }
+
+	virtual void TickComponent(float DeltaTime, ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction) override;
+
+private:
+	UFUNCTION(Server, Reliable, WithValidation)
+	void ServerBeginStream(const FRuntimeSpeechToFaceStreamHeader& Header);
+
+	UFUNCTION(Server, Reliable, WithValidation)
+	void ServerStreamFrames(const FRuntimeSpeechToFaceStreamChunk& Chunk);
+
+	UFUNCTION(NetMulticast, Reliable)
+	void MulticastBeginStream(const FRuntimeSpeechToFaceStreamHeader& Header);
+
+	UFUNCTION(NetMulticast, Reliable)
+	void MulticastStreamFrames(const FRuntimeSpeechToFaceStreamChunk& Chunk);
+
+	void SendFrames(int32 NumFrames);
+
+	// Sizes in a header or chunk are checked before anything is allocated for them, they may come from a client
+	static bool IsValidHeader(const FRuntimeSpeechToFaceStreamHeader& Header);
+	static bool IsValidChunk(const FRuntimeSpeechToFaceStreamChunk& Chunk);
+
+	UPROPERTY(Transient)
+	TObjectPtr<URuntimeAnimation> Animation;
+
+	int32 NumCurves = 0;
+
+	// Sending side: quantized values of every frame, frame major, and the values receivers hold after the frames sent so far
+	// Stream ids are odd when the owning client sends and even when the server does, so the two never collide
+	bool bIsSource = false;
+	uint16 NextStreamId = 0;
+	uint16 SourceStreamId = 0;
+	float SourceFrameRate = 0.0f;
+	TArray<uint8> SourceFrames;
+	TArray<uint8> SentValues;
+	int32 NumSentFrames = 0;
+	double SourceStartTime = 0.0;
+
+	// Receiving side
+	uint16 ReceivedStreamId = 0;
+	int32 NumStreamFrames = 0;
+	TArray<uint8> ReceivedValues;
+	int32 NumReceivedFrames = 0;
+};
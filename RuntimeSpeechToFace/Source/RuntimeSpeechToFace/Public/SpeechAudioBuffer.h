@@ -0,0 +1,148 @@
+// Append-only audio storage shared between a producer and any number of lock-free readers
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include <atomic>
+#include "SpeechAudioBuffer.generated.h"
+
+/** Sample format of stored PCM data. Other bit depths are converted to Float32 when imported. */
+UENUM(BlueprintType)
+enum class ESpeechSampleFormat : uint8
+{
+	Int16,
+	Float32,
+};
+
+/** How a FSpeechAudioBuffer keeps the PCM data appended to it */
+UENUM(BlueprintType)
+enum class ESpeechAudioStorage : uint8
+{
+	/** The PCM data as given */
+	PCM,
+	/** 4 bit IMA ADPCM, a quarter of the size of 16 bit PCM. Decoded a block at a time as it is read. */
+	ADPCM,
+};
+
+inline int32 GetSpeechSampleByteSize(ESpeechSampleFormat Format)
+{
+	return Format == ESpeechSampleFormat::Float32 ? sizeof(float) : sizeof(int16);
+}
+
+/**
+ * PCM data stored as a list of chunks. A single producer appends chunks while readers consume
+ * whatever has already been published. Published chunks are never moved or freed until the buffer
+ * itself is destroyed, so readers never need a lock.
+ *
+ * With ADPCM storage every chunk is encoded as it is appended. Positions, sizes and the data readers
+ * get back are still those of the PCM data, in the sample format of the buffer.
+ */
+class RUNTIMESPEECHTOFACE_API FSpeechAudioBuffer
+{
+public:
+	explicit FSpeechAudioBuffer(ESpeechSampleFormat InSampleFormat = ESpeechSampleFormat::Int16, ESpeechAudioStorage InStorage = ESpeechAudioStorage::PCM, int32 InNumChannels = 1)
+		: SampleFormat(InSampleFormat)
+		, Storage(InStorage)
+		, NumChannels(FMath::Max(InNumChannels, 1))
+	{
+	}
+	~FSpeechAudioBuffer();
+
+	UE_NONCOPYABLE(FSpeechAudioBuffer);
+
+	/**
+	 * Append a chunk of PCM data. Only one thread may append at a time. With ADPCM storage a partial frame at the end
+	 * is held back until the next chunk completes it.
+	 */
+	void Append(TArray<uint8>&& PCMData);
+
+	/** Mark the buffer as complete. Readers reaching the end afterwards are done rather than starving. Called by the producer. */
+	void Finish();
+
+	bool IsFinished() const { return bFinished.load(std::memory_order_acquire); }
+
+	/** Number of bytes published to readers */
+	int64 GetNumBytes() const { return NumBytes.load(std::memory_order_acquire); }
+
+	/** Number of bytes the published data takes in memory, less than GetNumBytes when it is encoded */
+	int64 GetStoredBytes() const { return StoredBytes.load(std::memory_order_acquire); }
+
+	/** Copy all published data into a single contiguous array, decoding it if needed */
+	TArray<uint8> CopyData() const;
+
+	ESpeechSampleFormat GetSampleFormat() const { return SampleFormat; }
+
+	ESpeechAudioStorage GetStorage() const { return Storage; }
+
+private:
+	friend class FSpeechAudioReader;
+
+	struct FChunk
+	{
+		// PCM data, or ADPCM blocks if bEncoded
+		TArray<uint8> Data;
+		int64 Offset = 0;
+		// Bytes of PCM data in the chunk
+		int32 NumBytes = 0;
+		bool bEncoded = false;
+		std::atomic<FChunk*> Next = nullptr;
+	};
+
+	// Link a chunk after the last one and publish its bytes to readers
+	void Publish(FChunk* NewChunk);
+
+	// Decode one ADPCM block of an encoded chunk to PCM data in the sample format of the buffer
+	void DecodeBlock(const FChunk& Chunk, int32 BlockIndex, TArray<uint8>& OutData) const;
+
+	// Bytes of PCM data in a full ADPCM block
+	int32 GetBlockNumBytes() const;
+
+	const ESpeechSampleFormat SampleFormat;
+	const ESpeechAudioStorage Storage;
+
+	// Channels ADPCM blocks are encoded with, interleaved PCM data is split into them
+	const int32 NumChannels;
+
+	std::atomic<FChunk*> Head = nullptr;
+
+	// Last chunk in the list. Accessed only by the producer.
+	FChunk* Tail = nullptr;
+
+	// Trailing bytes of the last append that do not make a whole frame, encoded with the next one. Accessed only by the producer.
+	TArray<uint8> PartialFrame;
+
+	std::atomic<int64> NumBytes = 0;
+	std::atomic<int64> StoredBytes = 0;
+	std::atomic<bool> bFinished = false;
+};
+
+/** Playback cursor over a FSpeechAudioBuffer. Not thread safe, each consumer owns its own reader. */
+class RUNTIMESPEECHTOFACE_API FSpeechAudioReader
+{
+public:
+	/** Start reading a new buffer from the beginning */
+	void SetBuffer(const TSharedPtr<const FSpeechAudioBuffer>& InBuffer);
+
+	/** Copy up to NumBytes of published data, returns the number of bytes copied. Encoded data is decoded a block at a time. */
+	int32 Read(uint8* OutData, int32 NumBytes);
+
+	void Seek(int64 ByteOffset);
+
+	int64 GetPosition() const { return Position; }
+
+	/** True if all published data has been consumed but the producer has not finished the buffer yet */
+	bool IsStarving() const;
+
+	/** True if there is no buffer, or it is finished and everything has been consumed */
+	bool IsAtEnd() const;
+
+private:
+	TSharedPtr<const FSpeechAudioBuffer> Buffer;
+	const FSpeechAudioBuffer::FChunk* Chunk = nullptr;
+	int64 Position = 0;
+
+	// ADPCM block decoded by the last read, the reads after it mostly copy from it
+	TArray<uint8> DecodedBlock;
+	const FSpeechAudioBuffer::FChunk* DecodedChunk = nullptr;
+	int32 DecodedBlockIndex = INDEX_NONE;
+};
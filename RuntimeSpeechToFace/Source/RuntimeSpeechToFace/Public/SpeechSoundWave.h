@@ -9,6 +9,7 @@
 #include "Containers/Queue.h"
 #include "Sound/SoundWave.h"
 #include "misc/ScopeRWLock.h"
+#include "SpeechAudioBuffer.h"
 #include "SpeechSoundWave.generated.h"
 
 #if PLATFORM_IOS
@@ -17,6 +18,8 @@
 #define DEFAULT_PROCEDURAL_SOUNDWAVE_BUFFER_SIZE 1024
 #endif
 
+class UAudioComponent;
+
 DECLARE_DYNAMIC_DELEGATE_OneParam(FOnSoundWaveDelegate, USpeechSoundWave*, SoundWave);
 
 UCLASS(MinimalAPI)
@@ -25,12 +28,36 @@ class USpeechSoundWave : public USoundWave
 	GENERATED_BODY()
 
 private:
+	// Guards AudioBuffer and Voices for game side access. Never taken by the audio render thread.
 	mutable FRWLock AudioLock;
 
-	// The actual audio buffer that can be consumed. QueuedAudio is fed to this buffer. Accessed only audio thread.
-	TSharedPtr<TArray<uint8>> AudioBuffer;
+	// The audio that is currently set on this wave, appended to by AppendAudio.
+	TSharedPtr<FSpeechAudioBuffer> AudioBuffer;
+
+	// Voices created by CreateSoundGenerator, handed new audio and seeks through their own queues.
+	TArray<TWeakPtr<class FSpeechSoundGenerator, ESPMode::ThreadSafe>> Voices;
+
+	// Buffers published by SetAudio/AppendAudio that the audio render thread has not picked up yet.
+	// Each comes with the playback state's BufferGeneration it was published under.
+	TQueue<TPair<TSharedPtr<FSpeechAudioBuffer>, uint32>, EQueueMode::Mpsc> PendingRenderBuffers;
+
+	// Playback cursor of GeneratePCMData. Accessed only by the audio render thread.
+	FSpeechAudioReader RenderReader;
+
+	// Last seek request applied to RenderReader. Accessed only by the audio render thread.
+	uint32 RenderSeekSerial = 0;
 
-	uint32_t SampleIndex;
+	// Identifies GeneratePCMData to the playback clock, and the buffer generation RenderReader is on.
+	uint64 RenderVoiceId = 0;
+	uint32 RenderBufferGeneration = 0;
+
+	// Seek requests and underrun statistics shared with every voice playing this wave.
+	TSharedPtr<struct FSpeechPlaybackState> PlaybackState;
+
+	// Format of the samples in AudioBuffer and of the data returned by GeneratePCMData.
+	ESpeechSampleFormat SampleFormat = ESpeechSampleFormat::Int16;
+
+	void PublishAudioBuffer(const TSharedPtr<FSpeechAudioBuffer>& NewBuffer);
 
 protected:
 
@@ -53,14 +80,30 @@ public:
 	static void CreateSpeechSoundWaveFromContentString(const TArray<uint8>& ContentString, const FOnSoundWaveDelegate& SoundWaveCallback);
 
 	/** Make a copy that shares AudioBuffer **/
-	UFUNCTION(BlueprintCallable)
+	UFUNCTION(BlueprintCallable, meta = (DeprecatedFunction, DeprecationMessage = "Each playing instance now has its own playback cursor, play the same wave instead."))
 	USpeechSoundWave* MakeShallowCopy() const;
 
+	/**
+	 * Move the currently playing instances of this wave to the given sample, only those played by AudioComponent if one
+	 * is given. Instances started later begin at their start time.
+	 */
 	UFUNCTION(BlueprintCallable)
-	void Seek(int Index);
+	void Seek(int Index, UAudioComponent* AudioComponent = nullptr);
+
+	/** Number of times playback ran out of appended audio before FinishAppending was called */
+	UFUNCTION(BlueprintCallable)
+	int32 GetBufferUnderrunCount() const;
+
+	/** The audio currently set on this wave, for readers that decode it as they go rather than copying it */
+	TSharedPtr<const FSpeechAudioBuffer> GetAudioBuffer() const;
+
+	/** Playback clock published by the audio render thread, used to keep animation in sync with playback */
+	TSharedPtr<const struct FSpeechPlaybackState> GetPlaybackState() const;
 
 	//~ Begin UObject Interface. 
 	virtual void Serialize(FArchive& Ar) override;
+	virtual void PostInitProperties() override;
+	virtual void GetResourceSizeEx(FResourceSizeEx& CumulativeResourceSize) override;
 	virtual void GetAssetRegistryTags(FAssetRegistryTagsContext Context) const override;
 	UE_DEPRECATED(5.4, "Implement the version that takes FAssetRegistryTagsContext instead.")
 	virtual void GetAssetRegistryTags(TArray<FAssetRegistryTag>& OutTags) const override;
@@ -74,13 +117,40 @@ public:
 	virtual void InitAudioResource( FByteBulkData& CompressedData ) override;
 	virtual bool InitAudioResource(FName Format) override;
 	virtual int32 GetResourceSizeForFormat(FName Format) override;
-	virtual bool IsSeekable() const override { return false; }
+	virtual bool IsSeekable() const override { return true; }
+	virtual ISoundGeneratorPtr CreateSoundGenerator(const FSoundGeneratorInitParams& InParams, TArray<FAudioParameter>&& InDefaultParameters) override;
+	virtual Audio::EAudioMixerStreamDataFormat::Type GetGeneratedPCMDataFormat() const override;
 	//~ End USoundWave Interface.
 
-	/** Set AudioBuffer data */
-	void SetAudio(const TSharedPtr<TArray<uint8>>& PCMData);
+	/**
+	 * Set AudioBuffer data. Float32 data is stored and played as is, without conversion to 16 bit. Stored as
+	 * URuntimeSpeechToFaceSettings::SpeechAudioStorage, set NumChannels first so ADPCM encodes every channel apart.
+	 */
+	void SetAudio(const TSharedPtr<TArray<uint8>>& PCMData, ESpeechSampleFormat Format = ESpeechSampleFormat::Int16);
+	void SetAudio(TArray<uint8>&& PCMData, ESpeechSampleFormat Format = ESpeechSampleFormat::Int16);
+
+	/**
+	 * Append PCM data, starting a new buffer if the current one was finished. Can be called while the wave is playing.
+	 * Only one thread may append at a time, and the format must not change until FinishAppending is called.
+	 */
+	void AppendAudio(TArray<uint8>&& PCMData, ESpeechSampleFormat Format = ESpeechSampleFormat::Int16);
+
+	/** Mark the appended audio as complete so reaching its end is no longer reported as an underrun */
+	void FinishAppending();
 
 	TArray<uint8> GetPCMData() const;
+	TArray<uint8> GetPCMData(ESpeechSampleFormat& OutFormat) const;
+
+	/** Copy NumFrames frames of PCM data from FirstFrame on, or up to the end if NumFrames is INDEX_NONE */
+	TArray<uint8> GetPCMData(ESpeechSampleFormat& OutFormat, int64 FirstFrame, int64 NumFrames) const;
+
+	ESpeechSampleFormat GetSampleFormat() const { return SampleFormat; }
+
+	/** Bytes of audio held by this wave, as stored */
+	int64 GetAudioMemorySize() const;
+
+	/** Free the PCM data, unless a voice is still playing or paused on it. Returns whether it was freed. */
+	bool ReleaseAudio();
 
 	/** Size in bytes of a single sample of audio in the procedural audio buffer. */
 	int32 SampleByteSize;
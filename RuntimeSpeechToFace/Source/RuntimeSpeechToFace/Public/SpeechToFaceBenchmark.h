@@ -0,0 +1,35 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#if !UE_BUILD_SHIPPING
+
+/** Timing of one kernel on one synthetic input */
+struct FSpeechToFaceBenchmarkResult
+{
+	FString Kernel;
+
+	// Input the kernel ran on, e.g. "10s_2ch"
+	FString Case;
+
+	int32 Iterations = 0;
+	double MinMs = 0.0;
+	double MedianMs = 0.0;
+	double MeanMs = 0.0;
+};
+
+namespace SpeechToFaceBenchmark
+{
+	/** Run the body once to warm up, then Iterations times, and record its timing */
+	RUNTIMESPEECHTOFACE_API void Measure(const TCHAR* Kernel, const FString& Case, int32 Iterations, TFunctionRef<void()> Body, TArray<FSpeechToFaceBenchmarkResult>& OutResults);
+
+	/** Time the CPU kernels of the pipeline, playback and evaluation on synthetic clips of several lengths and channel counts */
+	RUNTIMESPEECHTOFACE_API void RunAll(int32 Iterations, TArray<FSpeechToFaceBenchmarkResult>& OutResults);
+
+	/** Deterministic speech-like PCM data: a gliding tone with noise, amplitude modulated at syllable rate */
+	RUNTIMESPEECHTOFACE_API void MakeSyntheticAudio(float Duration, uint32 SampleRate, uint16 NumChannels, TArray<uint8>& OutPCMData);
+}
+
+#endif
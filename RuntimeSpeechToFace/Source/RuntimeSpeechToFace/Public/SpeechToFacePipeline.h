@@ -0,0 +1,198 @@
+// Speech to face inference pipeline shared by the async action and offline baking
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "AudioDrivenAnimationMood.h"
+#include "Animation/AnimCurveTypes.h"
+#include "NNERuntimeCPU.h"
+#include "SpeechAudioBuffer.h"
+
+class USoundWave;
+
+/** PCM audio ready to run through the pipeline */
+struct FSpeechAudioData
+{
+	TArray<uint8> PCMData;
+	ESpeechSampleFormat SampleFormat = ESpeechSampleFormat::Int16;
+	uint32 SampleRate = 0;
+	uint16 NumChannels = 0;
+
+	// Stored audio of a speech sound wave, streamed through in place of PCMData so it is never decoded all at once
+	TSharedPtr<const FSpeechAudioBuffer> Buffer;
+	int64 BufferOffset = 0;
+	int64 BufferNumBytes = 0;
+
+	// Used for logging only
+	FString Name;
+
+	/** Bytes of PCM data, in PCMData or streamed from Buffer */
+	int64 GetNumBytes() const { return Buffer ? BufferNumBytes : PCMData.Num(); }
+
+	/** Visit the PCM data in order, in blocks of whole frames. Audio streamed from Buffer is decoded a block at a time. */
+	RUNTIMESPEECHTOFACE_API void ForEachBlock(TFunctionRef<void(const uint8* Data, int32 NumBytes)> Visitor) const;
+};
+
+struct FSpeechToFaceParams
+{
+	EAudioDrivenAnimationMood Mood = EAudioDrivenAnimationMood::AutoDetect;
+	float MoodIntensity = 1.0f;
+	bool bGenerateBlinks = false;
+	bool bGenerateHeadAnimation = false;
+};
+
+/** Encoder output for a clip. Mood and the other generation parameters only affect the decoder, so this can be reused across them. */
+struct FSpeechAudioFeatures
+{
+	struct FSegment
+	{
+		// First frame of the segment, in 50 fps predictor frames
+		int32 StartFrame = 0;
+		int32 NumFrames = 0;
+
+		// NumFrames x 512 encoder features
+		TArray<float> Values;
+	};
+
+	// Voiced parts of the clip. Frames outside of them are silent and skip inference.
+	TArray<FSegment> Segments;
+
+	// Number of 16 kHz samples of the whole clip
+	int32 NumSamples = 0;
+};
+
+/** Raw control values generated for a clip, sampled at a fixed frame rate */
+struct FSpeechToFaceAnimationData
+{
+	TArray<FName> CurveNames;
+
+	// NumFrames x CurveNames.Num() values, frame major
+	TArray<float> Values;
+
+	float FrameRate = 30.0f;
+
+	int32 GetNumFrames() const { return CurveNames.Num() > 0 ? Values.Num() / CurveNames.Num() : 0; }
+
+	/** Build one curve per control with a key on every frame */
+	RUNTIMESPEECHTOFACE_API void BuildCurves(TArray<FFloatCurve>& OutCurves) const;
+
+	/** Keep the frames from StartTime on for Duration seconds, dropping the ones generated for context around them */
+	RUNTIMESPEECHTOFACE_API void TrimToRange(float StartTime, float Duration);
+};
+
+/** Model instances pinned to one input length. Shorter inputs are padded to it, so the instances always run the same shapes. */
+struct FSpeechToFaceShapeBucket
+{
+	// Input length in 16 kHz samples, a whole number of predictor frames
+	int32 NumSamples = 0;
+
+	TSharedPtr<UE::NNE::IModelInstanceCPU> AudioExtractor;
+	TSharedPtr<UE::NNE::IModelInstanceCPU> RigLogicPredictor;
+};
+
+/** Model instances for one request. Instances must not be used by more than one request at a time. */
+struct FSpeechToFaceModelInstances
+{
+	TSharedPtr<UE::NNE::IModelInstanceCPU> AudioExtractor;
+	TSharedPtr<UE::NNE::IModelInstanceCPU> RigLogicPredictor;
+
+	// Instances for inputs that fit a shape bucket, shortest first. Longer inputs run on the instances above.
+	TArray<FSpeechToFaceShapeBucket> ShapeBuckets;
+
+	// Working buffers reused by the requests run on these instances
+	TSharedPtr<struct FSpeechToFaceScratch> Scratch;
+
+	bool IsValid() const { return AudioExtractor.IsValid() && RigLogicPredictor.IsValid() && Scratch.IsValid(); }
+};
+
+/** Loaded encoder and decoder models. Any number of instances can be created from them. */
+class RUNTIMESPEECHTOFACE_API FSpeechToFaceModels
+{
+public:
+	/** Load the models of a quality tier in URuntimeSpeechToFaceSettings, None for the default models. Must be called on the game thread. */
+	static TSharedPtr<FSpeechToFaceModels> Load(FName QualityTier = NAME_None);
+
+	FSpeechToFaceModelInstances CreateInstances() const;
+
+private:
+	TSharedPtr<UE::NNE::IModelCPU> AudioEncoder;
+	TSharedPtr<UE::NNE::IModelCPU> AnimationDecoder;
+};
+
+/** What the inference CPU governor is doing, see SpeechToFacePipeline::GetInferenceGovernorStats */
+struct FSpeechToFaceGovernorStats
+{
+	int32 NumRunning = 0;
+
+	// Requests waiting for budget now, and every request that had to wait so far
+	int32 NumDeferred = 0;
+	int64 TotalDeferred = 0;
+
+	// Requests allowed to run at once after adapting to the frame time
+	int32 MaxRunning = 0;
+
+	// Share of the configured budget currently allowed, lowered while the game misses its target frame time
+	float BudgetScale = 1.0f;
+
+	float FrameTimeMs = 0.0f;
+};
+
+namespace SpeechToFacePipeline
+{
+	/** Get the PCM data of a sound wave, decompressing it if needed. With EndTime after StartTime, only that span is decoded. */
+	RUNTIMESPEECHTOFACE_API bool GetSoundWaveAudio(USoundWave* SoundWave, FSpeechAudioData& OutAudio, float StartTime = 0.0f, float EndTime = 0.0f);
+
+	/** Decode a wav or ogg file */
+	RUNTIMESPEECHTOFACE_API bool DecodeAudioFile(const FString& FilePath, const TArray<uint8>& FileContent, FSpeechAudioData& OutAudio);
+
+	/** Decode the contents of a wav file. 16 bit and float samples are kept as they are, other bit depths become float. */
+	RUNTIMESPEECHTOFACE_API bool DecodeWav(const TArray<uint8>& WavData, FSpeechAudioData& OutAudio);
+
+	/**
+	 * Run work on the inference threads configured in URuntimeSpeechToFaceSettings. Thread safe. Over the CPU budget
+	 * set there, the work is deferred until the game thread ticks with budget left. If the inference threads shut down
+	 * before the work starts, OnAbandoned runs in its place, so whatever waits on the work can fail instead of leaking.
+	 */
+	RUNTIMESPEECHTOFACE_API void LaunchInference(TUniqueFunction<void()>&& Work, TUniqueFunction<void()>&& OnAbandoned);
+
+	/** Current state of the CPU budget inference runs within */
+	RUNTIMESPEECHTOFACE_API FSpeechToFaceGovernorStats GetInferenceGovernorStats();
+
+	/** Stop the inference threads, waiting for running work and running the OnAbandoned of queued work */
+	void ShutdownInferenceThreadPool();
+
+	/** Run the encoder and decoder over the audio and convert the result to raw rig controls */
+	RUNTIMESPEECHTOFACE_API bool GenerateAnimation(const FSpeechToFaceModelInstances& Models, const FSpeechAudioData& Audio, const FSpeechToFaceParams& Params, FSpeechToFaceAnimationData& OutAnimation, FString& OutError);
+
+	/** Run only the decoder over previously extracted features */
+	RUNTIMESPEECHTOFACE_API bool GenerateAnimation(const FSpeechToFaceModelInstances& Models, const FSpeechAudioFeatures& Features, const FSpeechToFaceParams& Params, FSpeechToFaceAnimationData& OutAnimation, FString& OutError);
+
+	/** Hash identifying the audio in the feature cache. Features depend on the encoder, so the quality tier is part of it. */
+	RUNTIMESPEECHTOFACE_API uint64 HashAudio(const FSpeechAudioData& Audio, FName QualityTier = NAME_None);
+
+	/** Hash identifying the features of one channel of audio hashed by HashAudio, the audio hash itself for INDEX_NONE */
+	RUNTIMESPEECHTOFACE_API uint64 HashAudioChannel(uint64 AudioHash, int32 Channel);
+
+	/**
+	 * Get the encoder features of the audio, from the feature cache or by running the encoder and caching the result.
+	 * Channel selects one channel of the audio, INDEX_NONE mixes all channels down. AudioHash must identify that channel.
+	 */
+	RUNTIMESPEECHTOFACE_API TSharedPtr<const FSpeechAudioFeatures> GetAudioFeatures(const FSpeechToFaceModelInstances& Models, const FSpeechAudioData& Audio, uint64 AudioHash, FString& OutError, int32 Channel = INDEX_NONE);
+
+	/** Get the encoder features of mono samples at the encoder rate, as produced by GetEncoderSamples. Name is only used for logging. */
+	RUNTIMESPEECHTOFACE_API TSharedPtr<const FSpeechAudioFeatures> GetAudioFeatures(const FSpeechToFaceModelInstances& Models, TConstArrayView<float> Samples, uint64 AudioHash, const FString& Name, FString& OutError);
+
+	/**
+	 * Convert the audio to the mono samples at the encoder rate that feature extraction consumes: decoded, converted to
+	 * float and resampled. Lets the conversion run ahead of inference, on any thread. Channel works as in GetAudioFeatures.
+	 */
+	RUNTIMESPEECHTOFACE_API bool GetEncoderSamples(const FSpeechAudioData& Audio, int32 Channel, TArray<float>& OutSamples, FString& OutError);
+
+	/** Find features in the feature cache, null if they were never extracted or have been evicted */
+	RUNTIMESPEECHTOFACE_API TSharedPtr<const FSpeechAudioFeatures> FindCachedAudioFeatures(uint64 AudioHash);
+
+#if !UE_BUILD_SHIPPING
+	/** Time the audio conversion, resampling and rig control conversion kernels, for SpeechToFaceBenchmark::RunAll */
+	void BenchmarkKernels(int32 Iterations, TArray<struct FSpeechToFaceBenchmarkResult>& OutResults);
+#endif
+}
@@ -30,6 +30,7 @@ public class RuntimeSpeechToFace : ModuleRules
 				"Engine",
 				"AudioExtensions",
 				"MetaHumanCoreTech",
+				"NNE",
 				// ... add other public dependencies that you statically link with here ...
 			}
 			);
@@ -41,7 +42,6 @@ public class RuntimeSpeechToFace : ModuleRules
 				"Slate",
 				"SlateCore",
 				"AnimGraphRuntime",
-				"NNE",
 				"SignalProcessing",
 				"AudioPlatformConfiguration",
 				"VorbisAudioDecoder",
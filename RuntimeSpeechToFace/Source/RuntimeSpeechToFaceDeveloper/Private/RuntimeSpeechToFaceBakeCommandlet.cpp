@@ -0,0 +1,265 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#include "RuntimeSpeechToFaceBakeCommandlet.h"
+#include "Async/ParallelFor.h"
+#include "HAL/FileManager.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "Misc/SecureHash.h"
+#include "RuntimeAnimation.h"
+#include "RuntimeSpeechToFaceSettings.h"
+#include "SpeechToFacePipeline.h"
+
+DEFINE_LOG_CATEGORY_STATIC(LogRuntimeSpeechToFaceBake, Log, All);
+
+static const TCHAR* BakedAnimationExtension = TEXT(".s2fa");
+
+struct FBakeItem
+{
+	FString SourcePath;
+	FString OutputPath;
+};
+
+static FString ComputeSourceHash(const TArray<uint8>& FileContent, const FSpeechToFaceParams& Params, const FSoftObjectPath& AudioEncoder, const FSoftObjectPath& AnimationDecoder, const URuntimeSpeechToFaceSettings* Settings)
+{
+	// Everything the baked result depends on, so a change to any of them rebakes the file
+	FString ParamsString = FString::Printf(TEXT("%d|%f|%d|%d|%s|%s|%d|%f|%d|%d|%f|%f|%f|%f"),
+		static_cast<int32>(Params.Mood), Params.MoodIntensity, Params.bGenerateBlinks, Params.bGenerateHeadAnimation,
+		*AudioEncoder.ToString(), *AnimationDecoder.ToString(),
+		Settings->bCompressAnimations, Settings->CompressionSettings.Tolerance, Settings->CompressionSettings.bAllowQuantization,
+		Settings->bSkipSilence, Settings->SilenceThresholdDb, Settings->MinSilenceDuration, Settings->SilenceContextDuration, Settings->SilenceDecayTime);
+
+	// Inputs are padded to the shape buckets, which changes the model output near the end of each clip
+	TArray<float> BucketDurations = Settings->ShapeBucketDurations;
+	BucketDurations.Sort();
+	for (const float BucketDuration : BucketDurations)
+	{
+		ParamsString += FString::Printf(TEXT("|%f"), BucketDuration);
+	}
+	const FTCHARToUTF8 ParamsUtf8(*ParamsString);
+
+	FMD5 Md5;
+	Md5.Update(FileContent.GetData(), FileContent.Num());
+	Md5.Update(reinterpret_cast<const uint8*>(ParamsUtf8.Get()), ParamsUtf8.Length());
+
+	FMD5Hash Hash;
+	Hash.Set(Md5);
+	return LexToString(Hash);
+}
+
+URuntimeSpeechToFaceBakeCommandlet::URuntimeSpeechToFaceBakeCommandlet()
+{
+	IsClient = false;
+	IsEditor = true;
+	IsServer = false;
+	LogToConsole = true;
+}
+
+int32 URuntimeSpeechToFaceBakeCommandlet::Main(const FString& Params)
+{
+	FString SourceDir;
+	FString FileListPath;
+	FString OutputDir;
+	FParse::Value(*Params, TEXT("Source="), SourceDir);
+	FParse::Value(*Params, TEXT("FileList="), FileListPath);
+	if (!FParse::Value(*Params, TEXT("Output="), OutputDir) || (SourceDir.IsEmpty() && FileListPath.IsEmpty()))
+	{
+		UE_LOG(LogRuntimeSpeechToFaceBake, Error, TEXT("Usage: -run=RuntimeSpeechToFaceBake -Source=<Dir> | -FileList=<File> -Output=<Dir>"));
+		return 1;
+	}
+
+	FSpeechToFaceParams BakeParams;
+	FString MoodName;
+	if (FParse::Value(*Params, TEXT("Mood="), MoodName))
+	{
+		const int64 MoodValue = StaticEnum<EAudioDrivenAnimationMood>()->GetValueByNameString(MoodName);
+		if (MoodValue == INDEX_NONE)
+		{
+			UE_LOG(LogRuntimeSpeechToFaceBake, Error, TEXT("Unknown mood: %s"), *MoodName);
+			return 1;
+		}
+		BakeParams.Mood = static_cast<EAudioDrivenAnimationMood>(MoodValue);
+	}
+	FParse::Value(*Params, TEXT("MoodIntensity="), BakeParams.MoodIntensity);
+	BakeParams.bGenerateBlinks = FParse::Param(*Params, TEXT("Blinks"));
+	BakeParams.bGenerateHeadAnimation = FParse::Param(*Params, TEXT("Head"));
+	const bool bForce = FParse::Param(*Params, TEXT("Force"));
+
+	FString QualityTierName;
+	FParse::Value(*Params, TEXT("Tier="), QualityTierName);
+	const FName QualityTier = QualityTierName.IsEmpty() ? NAME_None : FName(*QualityTierName);
+	FSoftObjectPath AudioEncoder;
+	FSoftObjectPath AnimationDecoder;
+	if (!GetDefault<URuntimeSpeechToFaceSettings>()->GetQualityTierModels(QualityTier, AudioEncoder, AnimationDecoder))
+	{
+		UE_LOG(LogRuntimeSpeechToFaceBake, Error, TEXT("Unknown quality tier: %s"), *QualityTierName);
+		return 1;
+	}
+
+	int32 NumThreads = FPlatformMisc::NumberOfCoresIncludingHyperthreads();
+	FParse::Value(*Params, TEXT("Threads="), NumThreads);
+	NumThreads = FMath::Max(NumThreads, 1);
+
+	// Gather the inputs
+	TArray<FString> SourceFiles;
+	if (!SourceDir.IsEmpty())
+	{
+		IFileManager::Get().FindFilesRecursive(SourceFiles, *SourceDir, TEXT("*.wav"), true, false, false);
+		IFileManager::Get().FindFilesRecursive(SourceFiles, *SourceDir, TEXT("*.ogg"), true, false, false);
+	}
+	if (!FileListPath.IsEmpty())
+	{
+		TArray<FString> Lines;
+		if (!FFileHelper::LoadFileToStringArray(Lines, *FileListPath))
+		{
+			UE_LOG(LogRuntimeSpeechToFaceBake, Error, TEXT("Failed to load file list: %s"), *FileListPath);
+			return 1;
+		}
+		for (FString& Line : Lines)
+		{
+			Line.TrimStartAndEndInline();
+			if (!Line.IsEmpty())
+			{
+				SourceFiles.Add(Line);
+			}
+		}
+	}
+
+	// Files under the source directory keep their relative path under the output directory, so lines with the same
+	// name in different folders do not overwrite each other
+	FString SourceRoot = SourceDir.IsEmpty() ? FString() : FPaths::ConvertRelativePathToFull(SourceDir);
+	FPaths::NormalizeDirectoryName(SourceRoot);
+	TArray<FBakeItem> Items;
+	TSet<FString> OutputPaths;
+	for (const FString& SourceFile : SourceFiles)
+	{
+		FString RelativePath = FPaths::ConvertRelativePathToFull(SourceFile);
+		if (SourceRoot.IsEmpty() || !FPaths::MakePathRelativeTo(RelativePath, *(SourceRoot + TEXT("/"))) || RelativePath.StartsWith(TEXT("..")))
+		{
+			RelativePath = FPaths::GetCleanFilename(SourceFile);
+		}
+
+		const FString OutputPath = OutputDir / FPaths::ChangeExtension(RelativePath, BakedAnimationExtension);
+		bool bAlreadyInSet = false;
+		OutputPaths.Add(OutputPath, &bAlreadyInSet);
+		if (bAlreadyInSet)
+		{
+			UE_LOG(LogRuntimeSpeechToFaceBake, Warning, TEXT("Skipping %s, another source file is baked to %s"), *SourceFile, *OutputPath);
+			continue;
+		}
+
+		FBakeItem& Item = Items.AddDefaulted_GetRef();
+		Item.SourcePath = SourceFile;
+		Item.OutputPath = OutputPath;
+	}
+	if (Items.Num() == 0)
+	{
+		UE_LOG(LogRuntimeSpeechToFaceBake, Warning, TEXT("No audio files to bake"));
+		return 0;
+	}
+	IFileManager::Get().MakeDirectory(*OutputDir, true);
+
+	TSharedPtr<FSpeechToFaceModels> Models = FSpeechToFaceModels::Load(QualityTier);
+	if (!Models)
+	{
+		UE_LOG(LogRuntimeSpeechToFaceBake, Error, TEXT("Failed to load models"));
+		return 1;
+	}
+
+	// Model instances are not thread safe, every worker runs its own
+	NumThreads = FMath::Min(NumThreads, Items.Num());
+	TArray<FSpeechToFaceModelInstances> WorkerInstances;
+	for (int32 WorkerIndex = 0; WorkerIndex < NumThreads; ++WorkerIndex)
+	{
+		FSpeechToFaceModelInstances Instances = Models->CreateInstances();
+		if (!Instances.IsValid())
+		{
+			UE_LOG(LogRuntimeSpeechToFaceBake, Error, TEXT("Failed to create model instances"));
+			return 1;
+		}
+		WorkerInstances.Add(MoveTemp(Instances));
+	}
+
+	const URuntimeSpeechToFaceSettings* Settings = GetDefault<URuntimeSpeechToFaceSettings>();
+	const FRuntimeAnimCompressionSettings CompressionSettings = Settings->CompressionSettings;
+	const bool bCompress = Settings->bCompressAnimations;
+
+	UE_LOG(LogRuntimeSpeechToFaceBake, Display, TEXT("Baking %d files on %d workers"), Items.Num(), NumThreads);
+	const double StartTime = FPlatformTime::Seconds();
+
+	// Workers pull the next file as they finish, so long lines do not hold up a whole batch
+	std::atomic<int32> NextItem(0);
+	std::atomic<int32> NumBaked(0);
+	std::atomic<int32> NumSkipped(0);
+	std::atomic<int32> NumFailed(0);
+	ParallelFor(NumThreads, [&](int32 WorkerIndex)
+		{
+			const FSpeechToFaceModelInstances& Instances = WorkerInstances[WorkerIndex];
+			for (int32 ItemIndex = NextItem++; ItemIndex < Items.Num(); ItemIndex = NextItem++)
+			{
+				const FBakeItem& Item = Items[ItemIndex];
+
+				TArray<uint8> FileContent;
+				if (!FFileHelper::LoadFileToArray(FileContent, *Item.SourcePath))
+				{
+					UE_LOG(LogRuntimeSpeechToFaceBake, Error, TEXT("Failed to load file at path: %s"), *Item.SourcePath);
+					++NumFailed;
+					continue;
+				}
+
+				const FString SourceHash = ComputeSourceHash(FileContent, BakeParams, AudioEncoder, AnimationDecoder, Settings);
+				FString BakedHash;
+				if (!bForce && URuntimeAnimation::ReadBakedAnimationHash(Item.OutputPath, BakedHash) && BakedHash == SourceHash)
+				{
+					++NumSkipped;
+					continue;
+				}
+
+				FSpeechAudioData Audio;
+				if (!SpeechToFacePipeline::DecodeAudioFile(Item.SourcePath, FileContent, Audio))
+				{
+					UE_LOG(LogRuntimeSpeechToFaceBake, Error, TEXT("Failed to decode audio: %s"), *Item.SourcePath);
+					++NumFailed;
+					continue;
+				}
+
+				FSpeechToFaceAnimationData AnimationData;
+				FString Error;
+				if (!SpeechToFacePipeline::GenerateAnimation(Instances, Audio, BakeParams, AnimationData, Error))
+				{
+					UE_LOG(LogRuntimeSpeechToFaceBake, Error, TEXT("%s: %s"), *Item.SourcePath, *Error);
+					++NumFailed;
+					continue;
+				}
+
+				TArray<FFloatCurve> Curves;
+				AnimationData.BuildCurves(Curves);
+
+				// Uncompressed bakes still use key tracks, with a zero tolerance nothing is dropped
+				FRuntimeAnimCompressionSettings TrackSettings = CompressionSettings;
+				if (!bCompress)
+				{
+					TrackSettings.Tolerance = 0.0f;
+					TrackSettings.bAllowQuantization = false;
+				}
+				TArray<FRuntimeAnimTrack> Tracks;
+				URuntimeAnimation::CompressCurves(Curves, TrackSettings, Tracks);
+
+				const float Duration = static_cast<float>(Audio.GetNumBytes()) / (GetSpeechSampleByteSize(Audio.SampleFormat) * Audio.NumChannels * Audio.SampleRate);
+				if (!URuntimeAnimation::SaveBakedAnimation(Item.OutputPath, SourceHash, Duration, Tracks))
+				{
+					UE_LOG(LogRuntimeSpeechToFaceBake, Error, TEXT("Failed to save baked animation: %s"), *Item.OutputPath);
+					++NumFailed;
+					continue;
+				}
+
+				UE_LOG(LogRuntimeSpeechToFaceBake, Display, TEXT("Baked %s"), *Item.OutputPath);
+				++NumBaked;
+			}
+		});
+
+	UE_LOG(LogRuntimeSpeechToFaceBake, Display, TEXT("Baked %d, skipped %d unchanged, %d failed in %.2f s"),
+		NumBaked.load(), NumSkipped.load(), NumFailed.load(), FPlatformTime::Seconds() - StartTime);
+
+	return NumFailed.load() > 0 ? 1 : 0;
+}
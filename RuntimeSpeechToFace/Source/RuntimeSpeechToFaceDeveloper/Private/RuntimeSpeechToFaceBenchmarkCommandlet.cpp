@@ -0,0 +1,59 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#include "RuntimeSpeechToFaceBenchmarkCommandlet.h"
+#include "Dom/JsonObject.h"
+#include "Misc/FileHelper.h"
+#include "Serialization/JsonSerializer.h"
+#include "Serialization/JsonWriter.h"
+#include "SpeechToFaceBenchmark.h"
+
+DEFINE_LOG_CATEGORY_STATIC(LogRuntimeSpeechToFaceBenchmark, Log, All);
+
+URuntimeSpeechToFaceBenchmarkCommandlet::URuntimeSpeechToFaceBenchmarkCommandlet()
+{
+	IsClient = false;
+	IsEditor = true;
+	IsServer = false;
+	LogToConsole = true;
+}
+
+int32 URuntimeSpeechToFaceBenchmarkCommandlet::Main(const FString& Params)
+{
+	int32 Iterations = 20;
+	FParse::Value(*Params, TEXT("Iterations="), Iterations);
+	FString OutputPath;
+	FParse::Value(*Params, TEXT("Output="), OutputPath);
+
+	TArray<FSpeechToFaceBenchmarkResult> Results;
+	SpeechToFaceBenchmark::RunAll(Iterations, Results);
+
+	TArray<TSharedPtr<FJsonValue>> JsonResults;
+	for (const FSpeechToFaceBenchmarkResult& Result : Results)
+	{
+		UE_LOG(LogRuntimeSpeechToFaceBenchmark, Display, TEXT("%-28s %-10s min %8.3f ms  median %8.3f ms  mean %8.3f ms"),
+			*Result.Kernel, *Result.Case, Result.MinMs, Result.MedianMs, Result.MeanMs);
+
+		TSharedRef<FJsonObject> JsonResult = MakeShared<FJsonObject>();
+		JsonResult->SetStringField(TEXT("kernel"), Result.Kernel);
+		JsonResult->SetStringField(TEXT("case"), Result.Case);
+		JsonResult->SetNumberField(TEXT("iterations"), Result.Iterations);
+		JsonResult->SetNumberField(TEXT("min_ms"), Result.MinMs);
+		JsonResult->SetNumberField(TEXT("median_ms"), Result.MedianMs);
+		JsonResult->SetNumberField(TEXT("mean_ms"), Result.MeanMs);
+		JsonResults.Add(MakeShared<FJsonValueObject>(JsonResult));
+	}
+
+	if (!OutputPath.IsEmpty())
+	{
+		FString JsonString;
+		const TSharedRef<TJsonWriter<>> Writer = TJsonWriterFactory<>::Create(&JsonString);
+		if (!FJsonSerializer::Serialize(JsonResults, Writer) || !FFileHelper::SaveStringToFile(JsonString, *OutputPath))
+		{
+			UE_LOG(LogRuntimeSpeechToFaceBenchmark, Error, TEXT("Failed to write results to %s"), *OutputPath);
+			return 1;
+		}
+		UE_LOG(LogRuntimeSpeechToFaceBenchmark, Display, TEXT("Wrote %d results to %s"), Results.Num(), *OutputPath);
+	}
+
+	return 0;
+}
@@ -0,0 +1,27 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "Commandlets/Commandlet.h"
+
+#include "RuntimeSpeechToFaceBakeCommandlet.generated.h"
+
+/**
+ * Bake face animations for voice lines known at build time, so they play without running inference.
+ *
+ * Usage: -run=RuntimeSpeechToFaceBake -Source=<Dir> | -FileList=<File> -Output=<Dir>
+ *        [-Mood=<Name>] [-MoodIntensity=<Value>] [-Blinks] [-Head] [-Tier=<QualityTier>] [-Threads=<Count>] [-Force]
+ *
+ * Every .wav and .ogg file is written to <Output>/<Name>.s2fa, which URuntimeAnimation::LoadBakedAnimation reads.
+ * Files whose audio, parameters and models are unchanged since the last bake are skipped unless -Force is given.
+ */
+UCLASS()
+class URuntimeSpeechToFaceBakeCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+	URuntimeSpeechToFaceBakeCommandlet();
+
+	virtual int32 Main(const FString& Params) override;
+};
@@ -0,0 +1,26 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "Commandlets/Commandlet.h"
+
+#include "RuntimeSpeechToFaceBenchmarkCommandlet.generated.h"
+
+/**
+ * Time the CPU kernels of the speech to face pipeline, playback and curve evaluation on synthetic clips, so a
+ * change to one of them can be compared before and after without a map or audio device.
+ *
+ * Usage: -run=RuntimeSpeechToFaceBenchmark [-Iterations=<Count>] [-Output=<File.json>] -nullrhi
+ *
+ * Every kernel and input is logged with its min, median and mean time, and written as a JSON array when -Output is given.
+ */
+UCLASS()
+class URuntimeSpeechToFaceBenchmarkCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+	URuntimeSpeechToFaceBenchmarkCommandlet();
+
+	virtual int32 Main(const FString& Params) override;
+};
@@ -26,6 +26,7 @@ public class RuntimeSpeechToFaceDeveloper : ModuleRules
 			{
 				"AnimGraph",
 				"BlueprintGraph",
+				"Json",
 			}
 		);
 	}